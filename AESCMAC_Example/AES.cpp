@@ -0,0 +1,863 @@
+﻿//
+// AES block cipher engines (FIPS 197). See AES.h for the engine interface.
+//
+// Every engine function is a template on the key length Nk (key expansion) or
+// the round count Nr (everything else), instantiated for AES-128, AES-192 and
+// AES-256.
+//
+
+#include "AES.h"
+#include "AES_Bitsliced.h"
+
+#include <cstring>
+
+// Software AES engine used when the CPU has no AES-NI:
+//   AES_BITSLICED_ENGINE  the constant-time bitsliced engine (widest SIMD
+//                         available); a single message costs a full pass per block.
+//   AES_TTABLE_ENGINE     the T-table engine: fast, but its table lookups are
+//                         cache-timing dependent. Opt-in.
+// With both defined, single chains run on T-table code with a schedule rebuilt
+// from the bitsliced one, and multi-block work is bitsliced; key expansion,
+// CMAC's L and GCM's H stay constant-time. With neither, the byte-wise
+// reference implementation (SubBytes/ShiftRows/MixColumns/AddRoundKey) is used.
+#define AES_BITSLICED_ENGINE
+// #define AES_TTABLE_ENGINE
+
+// Fully unrolls a loop over the rounds; the round count is a template parameter.
+#if defined(__clang__) || defined(__GNUC__)
+#define AES_UNROLL_ROUNDS _Pragma("GCC unroll 14")
+#else
+#define AES_UNROLL_ROUNDS
+#endif
+
+
+// ---------------------- AES Implementation ----------------------
+
+// AES S-box (FIPS 197)
+static constexpr byte sbox[256] = {
+    0x63,0x7c,0x77,0x7b,0xf2,0x6b,0x6f,0xc5,0x30,0x01,0x67,0x2b,0xfe,0xd7,0xab,0x76,
+    0xca,0x82,0xc9,0x7d,0xfa,0x59,0x47,0xf0,0xad,0xd4,0xa2,0xaf,0x9c,0xa4,0x72,0xc0,
+    0xb7,0xfd,0x93,0x26,0x36,0x3f,0xf7,0xcc,0x34,0xa5,0xe5,0xf1,0x71,0xd8,0x31,0x15,
+    0x04,0xc7,0x23,0xc3,0x18,0x96,0x05,0x9a,0x07,0x12,0x80,0xe2,0xeb,0x27,0xb2,0x75,
+    0x09,0x83,0x2c,0x1a,0x1b,0x6e,0x5a,0xa0,0x52,0x3b,0xd6,0xb3,0x29,0xe3,0x2f,0x84,
+    0x53,0xd1,0x00,0xed,0x20,0xfc,0xb1,0x5b,0x6a,0xcb,0xbe,0x39,0x4a,0x4c,0x58,0xcf,
+    0xd0,0xef,0xaa,0xfb,0x43,0x4d,0x33,0x85,0x45,0xf9,0x02,0x7f,0x50,0x3c,0x9f,0xa8,
+    0x51,0xa3,0x40,0x8f,0x92,0x9d,0x38,0xf5,0xbc,0xb6,0xda,0x21,0x10,0xff,0xf3,0xd2,
+    0xcd,0x0c,0x13,0xec,0x5f,0x97,0x44,0x17,0xc4,0xa7,0x7e,0x3d,0x64,0x5d,0x19,0x73,
+    0x60,0x81,0x4f,0xdc,0x22,0x2a,0x90,0x88,0x46,0xee,0xb8,0x14,0xde,0x5e,0x0b,0xdb,
+    0xe0,0x32,0x3a,0x0a,0x49,0x06,0x24,0x5c,0xc2,0xd3,0xac,0x62,0x91,0x95,0xe4,0x79,
+    0xe7,0xc8,0x37,0x6d,0x8d,0xd5,0x4e,0xa9,0x6c,0x56,0xf4,0xea,0x65,0x7a,0xae,0x08,
+    0xba,0x78,0x25,0x2e,0x1c,0xa6,0xb4,0xc6,0xe8,0xdd,0x74,0x1f,0x4b,0xbd,0x8b,0x8a,
+    0x70,0x3e,0xb5,0x66,0x48,0x03,0xf6,0x0e,0x61,0x35,0x57,0xb9,0x86,0xc1,0x1d,0x9e,
+    0xe1,0xf8,0x98,0x11,0x69,0xd9,0x8e,0x94,0x9b,0x1e,0x87,0xe9,0xce,0x55,0x28,0xdf,
+    0x8c,0xa1,0x89,0x0d,0xbf,0xe6,0x42,0x68,0x41,0x99,0x2d,0x0f,0xb0,0x54,0xbb,0x16
+};
+
+// Round constants for key expansion
+static const byte Rcon[11] = {
+    0x00, 0x01, 0x02, 0x04, 0x08,
+    0x10, 0x20, 0x40, 0x80, 0x1B,
+    0x36
+};
+
+// Multiply by 2 in GF(2^8)
+static constexpr inline byte xtime(byte x)
+{
+    return (byte)((x << 1) ^ ((x & 0x80) ? 0x1b : 0));
+}
+
+// Expands a 4 * Nk-byte AES key into a 16 * (Nr + 1)-byte round key array.
+template <int Nk>
+static void KeyExpansion(const byte* key, byte roundKeys[])
+{
+    const int keyBytes = 4 * Nk;
+    const int totalBytes = 16 * (Nk + 7);
+    memcpy(roundKeys, key, keyBytes);
+    int bytesGenerated = keyBytes;
+    int rconIteration = 1;
+    byte temp[4];
+
+    while (bytesGenerated < totalBytes) 
+    {
+        for (int i = 0; i < 4; i++)
+            temp[i] = roundKeys[bytesGenerated - 4 + i];
+
+        if (bytesGenerated % keyBytes == 0) {
+            // RotWord: cyclic left shift.
+            byte t = temp[0];
+            temp[0] = temp[1];
+            temp[1] = temp[2];
+            temp[2] = temp[3];
+            temp[3] = t;
+            // SubWord: apply the S-box.
+            for (int i = 0; i < 4; i++)
+                temp[i] = sbox[temp[i]];
+            // XOR with round constant.
+            temp[0] ^= Rcon[rconIteration];
+            rconIteration++;
+        }
+        else if (Nk > 6 && bytesGenerated % keyBytes == 16) {
+            // AES-256 applies SubWord to the middle word as well.
+            for (int i = 0; i < 4; i++)
+                temp[i] = sbox[temp[i]];
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            roundKeys[bytesGenerated] = roundKeys[bytesGenerated - keyBytes] ^ temp[i];
+            bytesGenerated++;
+        }
+    }
+}
+
+// AddRoundKey: XORs the state with the round key.
+static void AddRoundKey(byte state[4][4], const byte roundKey[16]) 
+{
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++)
+            state[r][c] ^= roundKey[c * 4 + r]; // Column-major order.
+}
+
+// SubBytes: applies the S-box to every byte of the state.
+static void SubBytes(byte state[4][4]) 
+{
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++)
+            state[r][c] = sbox[state[r][c]];
+}
+
+// ShiftRows: cyclically shifts each row of the state to the left by its row index.
+static void ShiftRows(byte state[4][4])
+{
+    byte temp[4];
+    // Row 1 shift by 1.
+    temp[0] = state[1][0]; temp[1] = state[1][1];
+    temp[2] = state[1][2]; temp[3] = state[1][3];
+    state[1][0] = temp[1]; state[1][1] = temp[2];
+    state[1][2] = temp[3]; state[1][3] = temp[0];
+
+    // Row 2 shift by 2.
+    temp[0] = state[2][0]; temp[1] = state[2][1];
+    temp[2] = state[2][2]; temp[3] = state[2][3];
+    state[2][0] = temp[2]; state[2][1] = temp[3];
+    state[2][2] = temp[0]; state[2][3] = temp[1];
+
+    // Row 3 shift by 3 (or right by 1).
+    temp[0] = state[3][0]; temp[1] = state[3][1];
+    temp[2] = state[3][2]; temp[3] = state[3][3];
+    state[3][0] = temp[3]; state[3][1] = temp[0];
+    state[3][2] = temp[1]; state[3][3] = temp[2];
+}
+
+// MixColumns: mixes the columns of the state.
+static void MixColumns(byte state[4][4]) 
+{
+    for (int c = 0; c < 4; c++) 
+    {
+        byte a0 = state[0][c];
+        byte a1 = state[1][c];
+        byte a2 = state[2][c];
+        byte a3 = state[3][c];
+        byte r0 = xtime(a0) ^ (a1 ^ xtime(a1)) ^ a2 ^ a3;
+        byte r1 = a0 ^ xtime(a1) ^ (a2 ^ xtime(a2)) ^ a3;
+        byte r2 = a0 ^ a1 ^ xtime(a2) ^ (a3 ^ xtime(a3));
+        byte r3 = (a0 ^ xtime(a0)) ^ a1 ^ a2 ^ xtime(a3);
+        state[0][c] = r0;
+        state[1][c] = r1;
+        state[2][c] = r2;
+        state[3][c] = r3;
+    }
+}
+
+// Encrypts a single 16-byte block using AES with Nr rounds.
+template <int Nr>
+static void AES_Encrypt_Block(const byte in[16], byte out[16], const byte roundKeys[])
+{
+    byte state[4][4];
+    // Copy input into state (column-major order).
+    for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++)
+            state[r][c] = in[c * 4 + r];
+
+    AddRoundKey(state, roundKeys);
+
+    for (int round = 1; round < Nr; round++) 
+    {
+        SubBytes(state);
+        ShiftRows(state);
+        MixColumns(state);
+        AddRoundKey(state, roundKeys + round * 16);
+    }
+
+    // Final round (without MixColumns).
+    SubBytes(state);
+    ShiftRows(state);
+    AddRoundKey(state, roundKeys + Nr * 16);
+
+    // Copy state to output.
+    for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++)
+            out[c * 4 + r] = state[r][c];
+}
+
+void SecureZero(void* p, size_t len)
+{
+#if defined(__GNUC__)
+    memset(p, 0, len);
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+#else
+    volatile byte* v = static_cast<volatile byte*>(p);
+    while (len--)
+        *v++ = 0;
+#endif
+}
+
+// ---------------------- AES T-table Engine ----------------------
+//
+// Word-oriented AES: every state column is held in one 32-bit word (big-endian,
+// row 0 in the top byte). SubBytes, ShiftRows and MixColumns of a full round
+// collapse into four table lookups and XORs per column:
+//
+//   Te0[x] = (2*S[x], S[x], S[x], 3*S[x])   Te1..Te3 = Te0 rotated right by 8/16/24 bits
+//
+// The tables are generated at compile time from sbox.
+
+// Loads/stores a big-endian 32-bit word.
+static inline uint32_t GetU32(const byte* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void PutU32(byte* p, uint32_t w)
+{
+    p[0] = (byte)(w >> 24);
+    p[1] = (byte)(w >> 16);
+    p[2] = (byte)(w >> 8);
+    p[3] = (byte)w;
+}
+
+static constexpr uint32_t RotR8(uint32_t w)
+{
+    return (w >> 8) | (w << 24);
+}
+
+struct AES_TTables
+{
+    uint32_t Te[4][256];
+};
+
+static constexpr AES_TTables MakeTTables()
+{
+    AES_TTables t = {};
+    for (int i = 0; i < 256; i++)
+    {
+        uint32_t s  = sbox[i];
+        uint32_t s2 = xtime(sbox[i]);
+        uint32_t s3 = s2 ^ s;
+        uint32_t w  = (s2 << 24) | (s << 16) | (s << 8) | s3;
+        t.Te[0][i] = w;
+        t.Te[1][i] = RotR8(w);
+        t.Te[2][i] = RotR8(RotR8(w));
+        t.Te[3][i] = RotR8(RotR8(RotR8(w)));
+    }
+    return t;
+}
+
+static constexpr AES_TTables TTables = MakeTTables();
+
+// SubWord: applies the S-box to each byte of a word.
+static inline uint32_t SubWord(uint32_t w)
+{
+    return ((uint32_t)sbox[w >> 24] << 24) | ((uint32_t)sbox[(w >> 16) & 0xff] << 16) |
+           ((uint32_t)sbox[(w >> 8) & 0xff] << 8) | (uint32_t)sbox[w & 0xff];
+}
+
+// Expands a 4 * Nk-byte AES key into 4 * (Nr + 1) round-key words (one word per column).
+template <int Nk>
+static void KeyExpansion_T(const byte* key, uint32_t rk[])
+{
+    for (int i = 0; i < Nk; i++)
+        rk[i] = GetU32(key + 4 * i);
+
+    for (int i = Nk; i < 4 * (Nk + 7); i++)
+    {
+        uint32_t temp = rk[i - 1];
+        if (i % Nk == 0)
+        {
+            // RotWord, SubWord and XOR with the round constant.
+            temp = SubWord((temp << 8) | (temp >> 24)) ^ ((uint32_t)Rcon[i / Nk] << 24);
+        }
+        else if (Nk > 6 && i % Nk == 4)
+        {
+            temp = SubWord(temp);
+        }
+        rk[i] = rk[i - Nk] ^ temp;
+    }
+}
+
+// One full round on a column-word state: t = MixColumns(ShiftRows(SubBytes(s))) + k.
+static inline void TTableRound(const uint32_t s[4], uint32_t t[4], const uint32_t k[4])
+{
+    const uint32_t* Te0 = TTables.Te[0];
+    const uint32_t* Te1 = TTables.Te[1];
+    const uint32_t* Te2 = TTables.Te[2];
+    const uint32_t* Te3 = TTables.Te[3];
+
+    t[0] = Te0[s[0] >> 24] ^ Te1[(s[1] >> 16) & 0xff] ^ Te2[(s[2] >> 8) & 0xff] ^ Te3[s[3] & 0xff] ^ k[0];
+    t[1] = Te0[s[1] >> 24] ^ Te1[(s[2] >> 16) & 0xff] ^ Te2[(s[3] >> 8) & 0xff] ^ Te3[s[0] & 0xff] ^ k[1];
+    t[2] = Te0[s[2] >> 24] ^ Te1[(s[3] >> 16) & 0xff] ^ Te2[(s[0] >> 8) & 0xff] ^ Te3[s[1] & 0xff] ^ k[2];
+    t[3] = Te0[s[3] >> 24] ^ Te1[(s[0] >> 16) & 0xff] ^ Te2[(s[1] >> 8) & 0xff] ^ Te3[s[2] & 0xff] ^ k[3];
+}
+
+// Final round (SubBytes and ShiftRows only).
+static inline void TTableFinalRound(const uint32_t s[4], uint32_t t[4], const uint32_t k[4])
+{
+    for (int c = 0; c < 4; c++)
+    {
+        t[c] = ((uint32_t)sbox[s[c] >> 24] << 24) ^ ((uint32_t)sbox[(s[(c + 1) & 3] >> 16) & 0xff] << 16) ^
+               ((uint32_t)sbox[(s[(c + 2) & 3] >> 8) & 0xff] << 8) ^ (uint32_t)sbox[s[(c + 3) & 3] & 0xff] ^ k[c];
+    }
+}
+
+// Encrypts a single 16-byte block using the T-table engine.
+template <int Nr>
+static void AES_Encrypt_Block_T(const byte in[16], byte out[16], const uint32_t rk[])
+{
+    uint32_t s[4], t[4];
+    for (int c = 0; c < 4; c++)
+        s[c] = GetU32(in + 4 * c) ^ rk[c];
+
+    AES_UNROLL_ROUNDS
+    for (int round = 1; round < Nr; round++)
+    {
+        TTableRound(s, t, rk + round * 4);
+        memcpy(s, t, sizeof(s));
+    }
+    TTableFinalRound(s, t, rk + Nr * 4);
+
+    for (int c = 0; c < 4; c++)
+        PutU32(out + 4 * c, t[c]);
+}
+
+// Advances L independent CBC-MAC chains by nBlocks blocks each. The lanes are
+// interleaved round by round so that their table lookups overlap.
+template <size_t L, int Nr>
+static void CBCMAC_Lanes_T(const AES_RoundKeys* const rk[], byte* const X[], const byte* const blocks[], size_t nBlocks)
+{
+    uint32_t s[L][4], t[L][4];
+    for (size_t l = 0; l < L; l++)
+        for (int c = 0; c < 4; c++)
+            s[l][c] = GetU32(X[l] + 4 * c);
+
+    for (size_t i = 0; i < nBlocks; i++)
+    {
+        for (size_t l = 0; l < L; l++)
+            for (int c = 0; c < 4; c++)
+                s[l][c] ^= GetU32(blocks[l] + i * 16 + 4 * c) ^ rk[l]->words[c];
+
+        for (int round = 1; round < Nr; round++)
+        {
+            for (size_t l = 0; l < L; l++)
+                TTableRound(s[l], t[l], rk[l]->words + round * 4);
+            memcpy(s, t, sizeof(s));
+        }
+        for (size_t l = 0; l < L; l++)
+            TTableFinalRound(s[l], t[l], rk[l]->words + Nr * 4);
+        memcpy(s, t, sizeof(s));
+    }
+
+    for (size_t l = 0; l < L; l++)
+        for (int c = 0; c < 4; c++)
+            PutU32(X[l] + 4 * c, s[l][c]);
+}
+
+// ---------------------- AES AES-NI Engine ----------------------
+//
+// Hardware backend for x86/x64 CPUs with the AES instruction set. The round keys
+// use the FIPS 197 byte order, so the schedule is interchangeable with the
+// reference engine. Only compiled for x86 targets; selected at run time via CPUID.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AES_HAVE_AESNI
+#endif
+
+#ifdef AES_HAVE_AESNI
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AES_TARGET_AESNI
+#else
+#include <cpuid.h>
+#define AES_TARGET_AESNI __attribute__((target("aes,sse2")))
+#endif
+
+// Fully unrolls the per-lane loops so every lane's state stays in a register.
+#if defined(__clang__) || defined(__GNUC__)
+#define AES_UNROLL_LANES _Pragma("GCC unroll 8")
+#else
+#define AES_UNROLL_LANES
+#endif
+
+// Returns true if the CPU supports AES-NI (CPUID.01H:ECX.AES[bit 25]).
+static bool CpuHasAesNi()
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[2] & (1 << 25)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ecx & (1u << 25)) != 0;
+#endif
+}
+
+// One step of the key schedule: folds the previous round key and the
+// AESKEYGENASSIST result (RotWord/SubWord/Rcon of the last column).
+AES_TARGET_AESNI static inline __m128i KeyExpansionStep_NI(__m128i key, __m128i assist)
+{
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+// Expands a 4 * Nk-byte AES key into Nr + 1 round keys using AESKEYGENASSIST.
+template <int Nk>
+static void KeyExpansion_NI(const byte* key, byte roundKeys[]);
+
+template <>
+AES_TARGET_AESNI void KeyExpansion_NI<4>(const byte* key, byte roundKeys[])
+{
+    __m128i* rk = reinterpret_cast<__m128i*>(roundKeys);
+    __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    _mm_store_si128(rk + 0, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x01)); _mm_store_si128(rk + 1, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x02)); _mm_store_si128(rk + 2, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x04)); _mm_store_si128(rk + 3, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x08)); _mm_store_si128(rk + 4, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x10)); _mm_store_si128(rk + 5, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x20)); _mm_store_si128(rk + 6, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x40)); _mm_store_si128(rk + 7, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x80)); _mm_store_si128(rk + 8, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x1b)); _mm_store_si128(rk + 9, k);
+    k = KeyExpansionStep_NI(k, _mm_aeskeygenassist_si128(k, 0x36)); _mm_store_si128(rk + 10, k);
+}
+
+// AES-192 step: lo holds words 0-3 and the low half of hi words 4-5 of the
+// previous 6-word block; both are advanced to the next block. assist is
+// AESKEYGENASSIST of hi (word 1 is RotWord/SubWord/Rcon of word 5).
+AES_TARGET_AESNI static inline void KeyExpansionStep192_NI(__m128i& lo, __m128i& hi, __m128i assist)
+{
+    lo = KeyExpansionStep_NI(lo, _mm_shuffle_epi32(assist, 0x55));
+    __m128i last = _mm_shuffle_epi32(lo, 0xff);
+    hi = _mm_xor_si128(hi, _mm_slli_si128(hi, 4));
+    hi = _mm_xor_si128(hi, last);
+}
+
+// The 6-word blocks straddle round keys: Combine64_NI joins the low halves of
+// two registers, Middle64_NI the high half of low with the low half of high.
+AES_TARGET_AESNI static inline __m128i Combine64_NI(__m128i low, __m128i high)
+{
+    return _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(low), _mm_castsi128_pd(high), 0));
+}
+
+AES_TARGET_AESNI static inline __m128i Middle64_NI(__m128i low, __m128i high)
+{
+    return _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(low), _mm_castsi128_pd(high), 1));
+}
+
+template <>
+AES_TARGET_AESNI void KeyExpansion_NI<6>(const byte* key, byte roundKeys[])
+{
+    __m128i* rk = reinterpret_cast<__m128i*>(roundKeys);
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    __m128i hi = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(key + 16));
+    __m128i prev;
+    _mm_store_si128(rk + 0, lo);
+
+    // Two steps produce 12 words, i.e. three round keys.
+    prev = hi; KeyExpansionStep192_NI(lo, hi, _mm_aeskeygenassist_si128(hi, 0x01));
+    _mm_store_si128(rk + 1, Combine64_NI(prev, lo));
+    _mm_store_si128(rk + 2, Middle64_NI(lo, hi));
+    KeyExpansionStep192_NI(lo, hi, _mm_aeskeygenassist_si128(hi, 0x02));
+    _mm_store_si128(rk + 3, lo);
+    prev = hi; KeyExpansionStep192_NI(lo, hi, _mm_aeskeygenassist_si128(hi, 0x04));
+    _mm_store_si128(rk + 4, Combine64_NI(prev, lo));
+    _mm_store_si128(rk + 5, Middle64_NI(lo, hi));
+    KeyExpansionStep192_NI(lo, hi, _mm_aeskeygenassist_si128(hi, 0x08));
+    _mm_store_si128(rk + 6, lo);
+    prev = hi; KeyExpansionStep192_NI(lo, hi, _mm_aeskeygenassist_si128(hi, 0x10));
+    _mm_store_si128(rk + 7, Combine64_NI(prev, lo));
+    _mm_store_si128(rk + 8, Middle64_NI(lo, hi));
+    KeyExpansionStep192_NI(lo, hi, _mm_aeskeygenassist_si128(hi, 0x20));
+    _mm_store_si128(rk + 9, lo);
+    prev = hi; KeyExpansionStep192_NI(lo, hi, _mm_aeskeygenassist_si128(hi, 0x40));
+    _mm_store_si128(rk + 10, Combine64_NI(prev, lo));
+    _mm_store_si128(rk + 11, Middle64_NI(lo, hi));
+    KeyExpansionStep192_NI(lo, hi, _mm_aeskeygenassist_si128(hi, 0x80));
+    _mm_store_si128(rk + 12, lo);
+}
+
+// AES-256 odd step: the second half of each 8-word block only applies SubWord
+// (AESKEYGENASSIST word 2) to the last word of the first half.
+AES_TARGET_AESNI static inline __m128i KeyExpansionStep256_NI(__m128i key, __m128i prev)
+{
+    return KeyExpansionStep_NI(key, _mm_shuffle_epi32(_mm_aeskeygenassist_si128(prev, 0x00), 0xaa));
+}
+
+template <>
+AES_TARGET_AESNI void KeyExpansion_NI<8>(const byte* key, byte roundKeys[])
+{
+    __m128i* rk = reinterpret_cast<__m128i*>(roundKeys);
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16));
+    _mm_store_si128(rk + 0, a);
+    _mm_store_si128(rk + 1, b);
+    a = KeyExpansionStep_NI(a, _mm_aeskeygenassist_si128(b, 0x01)); _mm_store_si128(rk + 2, a);
+    b = KeyExpansionStep256_NI(b, a);                                 _mm_store_si128(rk + 3, b);
+    a = KeyExpansionStep_NI(a, _mm_aeskeygenassist_si128(b, 0x02)); _mm_store_si128(rk + 4, a);
+    b = KeyExpansionStep256_NI(b, a);                                 _mm_store_si128(rk + 5, b);
+    a = KeyExpansionStep_NI(a, _mm_aeskeygenassist_si128(b, 0x04)); _mm_store_si128(rk + 6, a);
+    b = KeyExpansionStep256_NI(b, a);                                 _mm_store_si128(rk + 7, b);
+    a = KeyExpansionStep_NI(a, _mm_aeskeygenassist_si128(b, 0x08)); _mm_store_si128(rk + 8, a);
+    b = KeyExpansionStep256_NI(b, a);                                 _mm_store_si128(rk + 9, b);
+    a = KeyExpansionStep_NI(a, _mm_aeskeygenassist_si128(b, 0x10)); _mm_store_si128(rk + 10, a);
+    b = KeyExpansionStep256_NI(b, a);                                 _mm_store_si128(rk + 11, b);
+    a = KeyExpansionStep_NI(a, _mm_aeskeygenassist_si128(b, 0x20)); _mm_store_si128(rk + 12, a);
+    b = KeyExpansionStep256_NI(b, a);                                 _mm_store_si128(rk + 13, b);
+    a = KeyExpansionStep_NI(a, _mm_aeskeygenassist_si128(b, 0x40)); _mm_store_si128(rk + 14, a);
+}
+
+// Encrypts a single 16-byte block with AESENC/AESENCLAST.
+template <int Nr>
+AES_TARGET_AESNI static void AES_Encrypt_Block_NI(const byte in[16], byte out[16], const byte roundKeys[])
+{
+    const __m128i* rk = reinterpret_cast<const __m128i*>(roundKeys);
+    __m128i s = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), _mm_load_si128(rk));
+    AES_UNROLL_ROUNDS
+    for (int round = 1; round < Nr; round++)
+        s = _mm_aesenc_si128(s, _mm_load_si128(rk + round));
+    s = _mm_aesenclast_si128(s, _mm_load_si128(rk + Nr));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), s);
+}
+
+// CBC-MAC over nBlocks full blocks: X = CIPHK(X + Mi) for each block.
+// The chaining value and all round keys stay in registers for the whole chain
+// (Nr + 2 of the 16 XMM registers on x64).
+template <int Nr>
+AES_TARGET_AESNI static void CBCMAC_Blocks_NI(const byte roundKeys[], byte X[16], const byte* blocks, size_t nBlocks)
+{
+    const __m128i* rk = reinterpret_cast<const __m128i*>(roundKeys);
+    __m128i k[Nr + 1];
+    AES_UNROLL_ROUNDS
+    for (int round = 0; round <= Nr; round++)
+        k[round] = _mm_load_si128(rk + round);
+
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(X));
+    for (size_t i = 0; i < nBlocks; i++)
+    {
+        __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + i * 16));
+        c = _mm_xor_si128(c, _mm_xor_si128(m, k[0]));
+        AES_UNROLL_ROUNDS
+        for (int round = 1; round < Nr; round++)
+            c = _mm_aesenc_si128(c, k[round]);
+        c = _mm_aesenclast_si128(c, k[Nr]);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(X), c);
+}
+
+// Advances L independent CBC-MAC chains by nBlocks blocks each. AESENC has a
+// latency of several cycles but issues every cycle, so interleaving L chains
+// keeps the AES unit busy where a single CBC chain would stall on each round.
+template <size_t L, int Nr>
+AES_TARGET_AESNI static void CBCMAC_Lanes_NI(const AES_RoundKeys* const rk[], byte* const X[], const byte* const blocks[], size_t nBlocks)
+{
+    const __m128i* k[L];
+    __m128i c[L];
+    AES_UNROLL_LANES
+    for (size_t l = 0; l < L; l++)
+    {
+        k[l] = reinterpret_cast<const __m128i*>(rk[l]->bytes);
+        c[l] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(X[l]));
+    }
+
+    for (size_t i = 0; i < nBlocks; i++)
+    {
+        AES_UNROLL_LANES
+        for (size_t l = 0; l < L; l++)
+        {
+            __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks[l] + i * 16));
+            c[l] = _mm_xor_si128(c[l], _mm_xor_si128(m, _mm_load_si128(k[l])));
+        }
+        for (int round = 1; round < Nr; round++)
+        {
+            AES_UNROLL_LANES
+            for (size_t l = 0; l < L; l++)
+                c[l] = _mm_aesenc_si128(c[l], _mm_load_si128(k[l] + round));
+        }
+        AES_UNROLL_LANES
+        for (size_t l = 0; l < L; l++)
+            c[l] = _mm_aesenclast_si128(c[l], _mm_load_si128(k[l] + Nr));
+    }
+
+    AES_UNROLL_LANES
+    for (size_t l = 0; l < L; l++)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(X[l]), c[l]);
+}
+
+// Encrypts nBlocks independent blocks, 8 at a time so the AESENC latency of
+// one block is hidden behind the others (the lanes of CBCMAC_Lanes_NI without
+// the chaining).
+template <int Nr>
+AES_TARGET_AESNI static void EncryptBlocks_NI(const byte roundKeys[], const byte* in, byte* out, size_t nBlocks)
+{
+    const __m128i* rk = reinterpret_cast<const __m128i*>(roundKeys);
+    __m128i k[Nr + 1];
+    AES_UNROLL_ROUNDS
+    for (int round = 0; round <= Nr; round++)
+        k[round] = _mm_load_si128(rk + round);
+
+    size_t i = 0;
+    for (; i + 8 <= nBlocks; i += 8)
+    {
+        __m128i s[8];
+        AES_UNROLL_LANES
+        for (size_t l = 0; l < 8; l++)
+            s[l] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + (i + l) * 16)), k[0]);
+        AES_UNROLL_ROUNDS
+        for (int round = 1; round < Nr; round++)
+        {
+            AES_UNROLL_LANES
+            for (size_t l = 0; l < 8; l++)
+                s[l] = _mm_aesenc_si128(s[l], k[round]);
+        }
+        AES_UNROLL_LANES
+        for (size_t l = 0; l < 8; l++)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + (i + l) * 16), _mm_aesenclast_si128(s[l], k[Nr]));
+    }
+    for (; i < nBlocks; i++)
+    {
+        __m128i s = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 16)), k[0]);
+        AES_UNROLL_ROUNDS
+        for (int round = 1; round < Nr; round++)
+            s = _mm_aesenc_si128(s, k[round]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 16), _mm_aesenclast_si128(s, k[Nr]));
+    }
+}
+
+#endif // AES_HAVE_AESNI
+// ---------------------- AES Engine Selection ----------------------
+//
+// CMAC calls the block cipher through AES_Engine, picked once at startup:
+// AES-NI when CPUID reports it, otherwise the software engine chosen by
+// AES_TTABLE_ENGINE and AES_BITSLICED_ENGINE. Each engine carries one AES_Cipher per key size, filled
+// with the template instantiations for that key length.
+
+template <int Nk>
+static void ExpandKey_Ref(const byte* key, AES_RoundKeys& rk) { KeyExpansion<Nk>(key, rk.bytes); }
+template <int Nr>
+static void Encrypt_Ref(const byte in[16], byte out[16], const AES_RoundKeys& rk) { AES_Encrypt_Block<Nr>(in, out, rk.bytes); }
+
+template <int Nk>
+static void ExpandKey_T(const byte* key, AES_RoundKeys& rk) { KeyExpansion_T<Nk>(key, rk.words); }
+
+template <int Nr>
+void AES_EncryptBlock_T(const byte in[16], byte out[16], const uint32_t rk[]) { AES_Encrypt_Block_T<Nr>(in, out, rk); }
+template void AES_EncryptBlock_T<10>(const byte in[16], byte out[16], const uint32_t rk[]);
+template void AES_EncryptBlock_T<12>(const byte in[16], byte out[16], const uint32_t rk[]);
+template void AES_EncryptBlock_T<14>(const byte in[16], byte out[16], const uint32_t rk[]);
+
+template <int Nr>
+void AES_CbcMac_T(const uint32_t rk[], byte X[16], const byte* blocks, size_t nBlocks)
+{
+    byte Y[16];
+    for (size_t i = 0; i < nBlocks; i++)
+    {
+        for (int j = 0; j < 16; j++)
+            Y[j] = X[j] ^ blocks[i * 16 + j];
+        AES_Encrypt_Block_T<Nr>(Y, X, rk);
+    }
+}
+template void AES_CbcMac_T<10>(const uint32_t rk[], byte X[16], const byte* blocks, size_t nBlocks);
+template void AES_CbcMac_T<12>(const uint32_t rk[], byte X[16], const byte* blocks, size_t nBlocks);
+template void AES_CbcMac_T<14>(const uint32_t rk[], byte X[16], const byte* blocks, size_t nBlocks);
+template <int Nr>
+static void Encrypt_T(const byte in[16], byte out[16], const AES_RoundKeys& rk) { AES_Encrypt_Block_T<Nr>(in, out, rk.words); }
+
+// Generic CBC-MAC chain for the software engines.
+template <void (*Encrypt)(const byte[16], byte[16], const AES_RoundKeys&)>
+static void CBCMAC_Blocks(const AES_RoundKeys& rk, byte X[16], const byte* blocks, size_t nBlocks)
+{
+    byte Y[16];
+    for (size_t i = 0; i < nBlocks; i++)
+    {
+        for (int j = 0; j < 16; j++)
+            Y[j] = X[j] ^ blocks[i * 16 + j];
+        Encrypt(Y, X, rk);
+    }
+}
+
+// Generic ECB loop for the software engines.
+template <void (*Encrypt)(const byte[16], byte[16], const AES_RoundKeys&)>
+static void EncryptBlocks(const AES_RoundKeys& rk, const byte* in, byte* out, size_t nBlocks)
+{
+    for (size_t i = 0; i < nBlocks; i++)
+        Encrypt(in + i * 16, out + i * 16, rk);
+}
+
+// Runs the lanes one after another; used by the reference engine.
+template <void (*Encrypt)(const byte[16], byte[16], const AES_RoundKeys&)>
+static void CBCMAC_Lanes(const AES_RoundKeys* const rk[], byte* const X[], const byte* const blocks[], size_t nBlocks, size_t nLanes)
+{
+    for (size_t l = 0; l < nLanes; l++)
+        CBCMAC_Blocks<Encrypt>(*rk[l], X[l], blocks[l], nBlocks);
+}
+
+// Instantiates an interleaved lane kernel for the lane count given at run time.
+template <template <size_t, int> class Kernel, int Nr>
+static void DispatchLanes(const AES_RoundKeys* const rk[], byte* const X[], const byte* const blocks[], size_t nBlocks, size_t nLanes)
+{
+    switch (nLanes)
+    {
+    case 1: Kernel<1, Nr>::Run(rk, X, blocks, nBlocks); break;
+    case 2: Kernel<2, Nr>::Run(rk, X, blocks, nBlocks); break;
+    case 3: Kernel<3, Nr>::Run(rk, X, blocks, nBlocks); break;
+    case 4: Kernel<4, Nr>::Run(rk, X, blocks, nBlocks); break;
+    case 5: Kernel<5, Nr>::Run(rk, X, blocks, nBlocks); break;
+    case 6: Kernel<6, Nr>::Run(rk, X, blocks, nBlocks); break;
+    case 7: Kernel<7, Nr>::Run(rk, X, blocks, nBlocks); break;
+    case 8: Kernel<8, Nr>::Run(rk, X, blocks, nBlocks); break;
+    }
+}
+
+template <size_t L, int Nr>
+struct LanesKernel_T
+{
+    static void Run(const AES_RoundKeys* const rk[], byte* const X[], const byte* const blocks[], size_t nBlocks)
+    {
+        CBCMAC_Lanes_T<L, Nr>(rk, X, blocks, nBlocks);
+    }
+};
+
+template <int Nk>
+static constexpr AES_Cipher ReferenceCipher()
+{
+    return { 4 * Nk, Nk + 6, ExpandKey_Ref<Nk>, Encrypt_Ref<Nk + 6>, CBCMAC_Blocks<Encrypt_Ref<Nk + 6>>, CBCMAC_Lanes<Encrypt_Ref<Nk + 6>>,
+             EncryptBlocks<Encrypt_Ref<Nk + 6>> };
+}
+
+template <int Nk>
+static constexpr AES_Cipher TTableCipher()
+{
+    return { 4 * Nk, Nk + 6, ExpandKey_T<Nk>, Encrypt_T<Nk + 6>, CBCMAC_Blocks<Encrypt_T<Nk + 6>>, DispatchLanes<LanesKernel_T, Nk + 6>,
+             EncryptBlocks<Encrypt_T<Nk + 6>> };
+}
+
+static const AES_Engine ReferenceEngine = { AES_Backend::Reference, "reference", 1, ReferenceCipher<4>(), ReferenceCipher<6>(), ReferenceCipher<8>() };
+static const AES_Engine TTableEngine    = { AES_Backend::TTable,    "ttable",    4, TTableCipher<4>(),    TTableCipher<6>(),    TTableCipher<8>() };
+
+#ifdef AES_HAVE_AESNI
+template <int Nk>
+static void ExpandKey_NI(const byte* key, AES_RoundKeys& rk) { KeyExpansion_NI<Nk>(key, rk.bytes); }
+template <int Nr>
+static void Encrypt_NI(const byte in[16], byte out[16], const AES_RoundKeys& rk) { AES_Encrypt_Block_NI<Nr>(in, out, rk.bytes); }
+template <int Nr>
+static void CBCMAC_NI(const AES_RoundKeys& rk, byte X[16], const byte* blocks, size_t nBlocks) { CBCMAC_Blocks_NI<Nr>(rk.bytes, X, blocks, nBlocks); }
+
+template <int Nr>
+static void EncryptBlocks_NI(const AES_RoundKeys& rk, const byte* in, byte* out, size_t nBlocks) { EncryptBlocks_NI<Nr>(rk.bytes, in, out, nBlocks); }
+
+template <size_t L, int Nr>
+struct LanesKernel_NI
+{
+    static void Run(const AES_RoundKeys* const rk[], byte* const X[], const byte* const blocks[], size_t nBlocks)
+    {
+        CBCMAC_Lanes_NI<L, Nr>(rk, X, blocks, nBlocks);
+    }
+};
+
+template <int Nk>
+static constexpr AES_Cipher AesNiCipher()
+{
+    return { 4 * Nk, Nk + 6, ExpandKey_NI<Nk>, Encrypt_NI<Nk + 6>, CBCMAC_NI<Nk + 6>, DispatchLanes<LanesKernel_NI, Nk + 6>,
+             EncryptBlocks_NI<Nk + 6> };
+}
+
+static const AES_Engine AesNiEngine = { AES_Backend::AESNI, "aesni", 8, AesNiCipher<4>(), AesNiCipher<6>(), AesNiCipher<8>() };
+#endif
+
+// Returns AES-NI if the CPU supports it, otherwise the configured software engine.
+static const AES_Engine* DetectEngine()
+{
+#ifdef AES_HAVE_AESNI
+    if (CpuHasAesNi())
+        return &AesNiEngine;
+#endif
+#if defined(AES_TTABLE_ENGINE) && defined(AES_BITSLICED_ENGINE)
+    return GetBitslicedEngine(AES_Backend::TTableBitsliced);
+#elif defined(AES_BITSLICED_ENGINE)
+    if (const AES_Engine* engine = GetBitslicedEngine(AES_Backend::BitslicedAVX2))
+        return engine;
+    if (const AES_Engine* engine = GetBitslicedEngine(AES_Backend::BitslicedSSE2))
+        return engine;
+    return GetBitslicedEngine(AES_Backend::Bitsliced);
+#elif defined(AES_TTABLE_ENGINE)
+    return &TTableEngine;
+#else
+    return &ReferenceEngine;
+#endif
+}
+
+// Engine used by CMAC; detected on first use, so it is valid even from other
+// translation units' static initializers.
+static const AES_Engine*& ActiveEngine()
+{
+    static const AES_Engine* engine = DetectEngine();
+    return engine;
+}
+
+bool AES_SelectBackend(AES_Backend backend)
+{
+    switch (backend)
+    {
+    case AES_Backend::Reference:
+        ActiveEngine() = &ReferenceEngine;
+        return true;
+    case AES_Backend::TTable:
+        ActiveEngine() = &TTableEngine;
+        return true;
+    case AES_Backend::AESNI:
+#ifdef AES_HAVE_AESNI
+        if (CpuHasAesNi())
+        {
+            ActiveEngine() = &AesNiEngine;
+            return true;
+        }
+#endif
+        return false;
+    case AES_Backend::Bitsliced:
+    case AES_Backend::BitslicedSSE2:
+    case AES_Backend::BitslicedAVX2:
+    case AES_Backend::TTableBitsliced:
+        if (const AES_Engine* engine = GetBitslicedEngine(backend))
+        {
+            ActiveEngine() = engine;
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+const AES_Engine& AES_GetEngine()
+{
+    return *ActiveEngine();
+}
+
+const char* AES_BackendName()
+{
+    return ActiveEngine()->name;
+}
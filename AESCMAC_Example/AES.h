@@ -0,0 +1,120 @@
+//
+// AES block cipher (FIPS 197) used by the CMAC implementation and the CTR/GCM
+// modes (AES_Modes.h), for 128, 192 and 256-bit keys.
+//
+// Engines:
+//  - reference: byte-wise SubBytes/ShiftRows/MixColumns/AddRoundKey.
+//  - ttable:    32-bit word engine with precomputed round tables.
+//  - aesni:     x86 AES instruction set (selected automatically via CPUID).
+//  - bitsliced: constant-time engine without table lookups, processing 4
+//               (portable), 8 (SSE2) or 16 (AVX2) blocks per pass (the default
+//               without AES-NI).
+//  - ttable+bitsliced: opt-in; the bitsliced schedule and kernels, with single
+//               chains on T-table code (faster, not constant-time).
+//
+// Every engine implements all three key sizes. The functions for one key size
+// (AES_Cipher) are separate template instantiations, so the round count and
+// schedule size are compile-time constants inside them.
+//
+// The engine is picked once at startup; callers reach it through AES_GetEngine().
+// A key schedule is only valid for the engine and key size that expanded it.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Define a byte type.
+using byte = uint8_t;
+
+// Key sizes; the value is the key length in bytes.
+enum class AES_KeySize
+{
+    AES128 = 16,
+    AES192 = 24,
+    AES256 = 32
+};
+
+// AES_Params: compile-time parameters of AES with a KeyBits-bit key.
+template <size_t KeyBits>
+struct AES_Params
+{
+    static_assert(KeyBits == 128 || KeyBits == 192 || KeyBits == 256, "AES keys are 128, 192 or 256 bits");
+    static const size_t keyBytes = KeyBits / 8;
+    static const int Nk = (int)(KeyBits / 32);  // Key length in 32-bit words.
+    static const int Nr = Nk + 6;               // Number of rounds.
+    static const AES_KeySize keySize = (AES_KeySize)keyBytes;
+};
+
+const int AES_MAX_ROUNDS = 14;
+
+// Expanded key in the layout of the engine that produced it (Nr + 1 round keys).
+union alignas(16) AES_RoundKeys
+{
+    byte     bytes[16 * (AES_MAX_ROUNDS + 1)];    // Reference and AES-NI engines: FIPS 197 byte order.
+    uint32_t words[4 * (AES_MAX_ROUNDS + 1)];     // T-table engine: one big-endian column per word.
+    uint64_t bitsliced[2 * (AES_MAX_ROUNDS + 1)]; // Bitsliced and T-table + bitsliced engines: two compressed bitsliced words per round key.
+};
+static_assert(sizeof(AES_RoundKeys) == 16 * (AES_MAX_ROUNDS + 1), "one schedule of the largest key size");
+
+enum class AES_Backend
+{
+    Reference,
+    TTable,
+    AESNI,
+    Bitsliced,
+    BitslicedSSE2,
+    BitslicedAVX2,
+    TTableBitsliced
+};
+
+// Maximum number of independent CBC-MAC chains an engine advances in lockstep.
+const size_t AES_MAX_LANES = 16;
+
+// AES_Cipher: an engine's block cipher functions for one key size.
+struct AES_Cipher
+{
+    size_t keyBytes;
+    int rounds;
+    // Expands a keyBytes-byte key.
+    void (*expandKey)(const byte* key, AES_RoundKeys& rk);
+    void (*encrypt)(const byte in[16], byte out[16], const AES_RoundKeys& rk);
+    // Runs the CBC-MAC chain X = CIPHK(X + Mi) over nBlocks full blocks.
+    void (*cbcMac)(const AES_RoundKeys& rk, byte X[16], const byte* blocks, size_t nBlocks);
+    // Advances nLanes (1 to AES_MAX_LANES) independent CBC-MAC chains by nBlocks
+    // blocks each; lane l uses key rk[l], chaining value X[l] and input blocks[l].
+    void (*cbcMacLanes)(const AES_RoundKeys* const rk[], byte* const X[], const byte* const blocks[], size_t nBlocks, size_t nLanes);
+    // Encrypts nBlocks independent blocks (ECB), e.g. CTR-mode counter blocks.
+    // in and out may be the same buffer.
+    void (*encryptBlocks)(const AES_RoundKeys& rk, const byte* in, byte* out, size_t nBlocks);
+};
+
+struct AES_Engine
+{
+    AES_Backend backend;
+    const char* name;
+    // Number of interleaved lanes that saturates this engine (1 = no gain).
+    size_t lanes;
+    AES_Cipher aes128;
+    AES_Cipher aes192;
+    AES_Cipher aes256;
+
+    const AES_Cipher& Cipher(AES_KeySize keySize) const
+    {
+        return keySize == AES_KeySize::AES256 ? aes256 : keySize == AES_KeySize::AES192 ? aes192 : aes128;
+    }
+};
+
+// AES_GetEngine: engine currently used by CMAC.
+const AES_Engine& AES_GetEngine();
+
+// AES_SelectBackend: forces a specific engine (e.g. for testing or benchmarking).
+// Returns false, leaving the current engine in place, if the backend is not
+// supported on this CPU. Not thread-safe: call before any CMAC is in flight.
+bool AES_SelectBackend(AES_Backend backend);
+
+// AES_BackendName: name of the engine currently used by CMAC.
+const char* AES_BackendName();
+
+// SecureZero: clears key material in a way the compiler cannot elide.
+void SecureZero(void* p, size_t len);
@@ -0,0 +1,436 @@
+﻿//
+// Bitsliced constant-time AES engines.
+//
+// The sbox[] lookups of the reference and T-table engines index memory with
+// secret data, which leaks through the cache. These engines compute SubBytes
+// as a Boolean circuit over bitsliced state instead (key expansion included),
+// so their timing does not depend on keys or data. The cost is that every call
+// works on a full group of blocks: 4 per 64-bit word in the portable engine,
+// 8 with SSE2 and 16 with AVX2. They pay off in CMAC_Batch, where each block
+// slot carries an independent message with its own key, and in CTR. The opt-in
+// T-table + bitsliced engine uses them only there and runs single chains on
+// T-table code, which is faster but not constant-time.
+//
+// The round functions live in AES_BitslicedCore.inl, which is included once
+// per slice width below.
+
+#include "AES_Bitsliced.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define AES_HAVE_BITSLICED_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Fully unrolls the loops over the 8 bit planes so the state stays in registers.
+#if defined(__clang__) || defined(__GNUC__)
+#define AES_BS_UNROLL _Pragma("GCC unroll 8")
+#else
+#define AES_BS_UNROLL
+#endif
+
+// ---------------------- Block Interleaving ----------------------
+
+// Decodes a little-endian 32-bit word.
+static inline uint32_t GetU32LE(const byte* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void PutU32LE(byte* p, uint32_t w)
+{
+    p[0] = (byte)w;
+    p[1] = (byte)(w >> 8);
+    p[2] = (byte)(w >> 16);
+    p[3] = (byte)(w >> 24);
+}
+
+// Spreads the four little-endian words of a block over two 64-bit words,
+// ready for Ortho (aes_ct64 interleave_in).
+static inline void InterleaveInWords(uint64_t& q0, uint64_t& q1, const uint32_t w[4])
+{
+    uint64_t x0 = w[0], x1 = w[1], x2 = w[2], x3 = w[3];
+    x0 |= (x0 << 16);
+    x1 |= (x1 << 16);
+    x2 |= (x2 << 16);
+    x3 |= (x3 << 16);
+    x0 &= 0x0000FFFF0000FFFFull;
+    x1 &= 0x0000FFFF0000FFFFull;
+    x2 &= 0x0000FFFF0000FFFFull;
+    x3 &= 0x0000FFFF0000FFFFull;
+    x0 |= (x0 << 8);
+    x1 |= (x1 << 8);
+    x2 |= (x2 << 8);
+    x3 |= (x3 << 8);
+    x0 &= 0x00FF00FF00FF00FFull;
+    x1 &= 0x00FF00FF00FF00FFull;
+    x2 &= 0x00FF00FF00FF00FFull;
+    x3 &= 0x00FF00FF00FF00FFull;
+    q0 = x0 | (x2 << 8);
+    q1 = x1 | (x3 << 8);
+}
+
+// Inverse of InterleaveInWords.
+static inline void InterleaveOutWords(uint32_t w[4], uint64_t q0, uint64_t q1)
+{
+    uint64_t x0 = q0 & 0x00FF00FF00FF00FFull;
+    uint64_t x1 = q1 & 0x00FF00FF00FF00FFull;
+    uint64_t x2 = (q0 >> 8) & 0x00FF00FF00FF00FFull;
+    uint64_t x3 = (q1 >> 8) & 0x00FF00FF00FF00FFull;
+    x0 |= (x0 >> 8);
+    x1 |= (x1 >> 8);
+    x2 |= (x2 >> 8);
+    x3 |= (x3 >> 8);
+    x0 &= 0x0000FFFF0000FFFFull;
+    x1 &= 0x0000FFFF0000FFFFull;
+    x2 &= 0x0000FFFF0000FFFFull;
+    x3 &= 0x0000FFFF0000FFFFull;
+    w[0] = (uint32_t)x0 | (uint32_t)(x0 >> 16);
+    w[1] = (uint32_t)x1 | (uint32_t)(x1 >> 16);
+    w[2] = (uint32_t)x2 | (uint32_t)(x2 >> 16);
+    w[3] = (uint32_t)x3 | (uint32_t)(x3 >> 16);
+}
+
+static inline void InterleaveIn(uint64_t& q0, uint64_t& q1, const byte block[16])
+{
+    uint32_t w[4];
+    for (int i = 0; i < 4; i++)
+        w[i] = GetU32LE(block + 4 * i);
+    InterleaveInWords(q0, q1, w);
+}
+
+static inline void InterleaveOut(byte block[16], uint64_t q0, uint64_t q1)
+{
+    uint32_t w[4];
+    InterleaveOutWords(w, q0, q1);
+    for (int i = 0; i < 4; i++)
+        PutU32LE(block + 4 * i, w[i]);
+}
+
+// ---------------------- Slice Types ----------------------
+
+// Portable: one 64-bit word (4 blocks).
+namespace BitslicedU64
+{
+    typedef uint64_t Slice;
+    static const size_t SliceWords = 1;
+
+    static inline Slice Xor(Slice a, Slice b) { return a ^ b; }
+    static inline Slice And(Slice a, Slice b) { return a & b; }
+    static inline Slice Or(Slice a, Slice b) { return a | b; }
+    static inline Slice Not(Slice a) { return ~a; }
+    template <int n> static inline Slice Shl(Slice a) { return a << n; }
+    template <int n> static inline Slice Shr(Slice a) { return a >> n; }
+    static inline Slice Set1(uint64_t m) { return m; }
+    static inline Slice Load(const uint64_t* p) { return p[0]; }
+    static inline void Store(uint64_t* p, Slice a) { p[0] = a; }
+
+#include "AES_BitslicedCore.inl"
+}
+
+#ifdef AES_HAVE_BITSLICED_SIMD
+
+// SSE2: two 64-bit words (8 blocks). SSE2 is part of the x86-64 baseline.
+namespace BitslicedSSE2
+{
+    struct Slice { __m128i v; };
+    static const size_t SliceWords = 2;
+
+    static inline Slice Xor(Slice a, Slice b) { return { _mm_xor_si128(a.v, b.v) }; }
+    static inline Slice And(Slice a, Slice b) { return { _mm_and_si128(a.v, b.v) }; }
+    static inline Slice Or(Slice a, Slice b) { return { _mm_or_si128(a.v, b.v) }; }
+    static inline Slice Not(Slice a) { return { _mm_xor_si128(a.v, _mm_set1_epi32(-1)) }; }
+    template <int n> static inline Slice Shl(Slice a) { return { _mm_slli_epi64(a.v, n) }; }
+    template <int n> static inline Slice Shr(Slice a) { return { _mm_srli_epi64(a.v, n) }; }
+    static inline Slice Set1(uint64_t m) { return { _mm_set1_epi64x((long long)m) }; }
+    static inline Slice Load(const uint64_t* p) { return { _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)) }; }
+    static inline void Store(uint64_t* p, Slice a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a.v); }
+
+#include "AES_BitslicedCore.inl"
+}
+
+// AVX2: four 64-bit words (16 blocks). Everything in this namespace is compiled
+// for AVX2 and only called after CpuHasAvx2() returned true.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace BitslicedAVX2
+{
+    struct Slice { __m256i v; };
+    static const size_t SliceWords = 4;
+
+    static inline Slice Xor(Slice a, Slice b) { return { _mm256_xor_si256(a.v, b.v) }; }
+    static inline Slice And(Slice a, Slice b) { return { _mm256_and_si256(a.v, b.v) }; }
+    static inline Slice Or(Slice a, Slice b) { return { _mm256_or_si256(a.v, b.v) }; }
+    static inline Slice Not(Slice a) { return { _mm256_xor_si256(a.v, _mm256_set1_epi32(-1)) }; }
+    template <int n> static inline Slice Shl(Slice a) { return { _mm256_slli_epi64(a.v, n) }; }
+    template <int n> static inline Slice Shr(Slice a) { return { _mm256_srli_epi64(a.v, n) }; }
+    static inline Slice Set1(uint64_t m) { return { _mm256_set1_epi64x((long long)m) }; }
+    static inline Slice Load(const uint64_t* p) { return { _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)) }; }
+    static inline void Store(uint64_t* p, Slice a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.v); }
+
+#include "AES_BitslicedCore.inl"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+// Returns true if the CPU and OS support AVX2 (CPUID.07H:EBX.AVX2[bit 5] with
+// YMM state enabled in XCR0).
+static bool CpuHasAvx2()
+{
+    unsigned int ecx1, ebx7;
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    ecx1 = (unsigned int)regs[2];
+    __cpuidex(regs, 7, 0);
+    ebx7 = (unsigned int)regs[1];
+#else
+    unsigned int eax, ebx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx1, &edx))
+        return false;
+    unsigned int ecx7;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx7, &ecx7, &edx))
+        return false;
+#endif
+    // OSXSAVE (bit 27) and AVX (bit 28).
+    if ((ecx1 & (1u << 27)) == 0 || (ecx1 & (1u << 28)) == 0)
+        return false;
+#ifdef _MSC_VER
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int xcr0Lo, xcr0Hi;
+    __asm__ __volatile__("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+    unsigned long long xcr0 = ((unsigned long long)xcr0Hi << 32) | xcr0Lo;
+#endif
+    if ((xcr0 & 0x6) != 0x6)
+        return false;
+    return (ebx7 & (1u << 5)) != 0;
+}
+
+#endif // AES_HAVE_BITSLICED_SIMD
+
+// ---------------------- Key Expansion ----------------------
+
+// Round constants for key expansion (Rcon[1..10] of FIPS 197).
+static const byte RconBS[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36 };
+
+// SubWord through the S-box circuit, so key expansion has no lookups either.
+static uint32_t SubWordBS(uint32_t x)
+{
+    uint64_t q[8] = { 0 };
+    q[0] = x;
+    BitslicedU64::Ortho(q);
+    BitslicedU64::Sbox(q);
+    BitslicedU64::Ortho(q);
+    return (uint32_t)q[0];
+}
+
+// Packs nRoundKeys round keys of w[] (little-endian words) into the compressed
+// bitsliced schedule: two 64-bit words per round key, holding its bits once per
+// block slot group (see LaneRoundKeys and ExpandRoundKeys).
+static void CompressRoundKeys(const uint32_t w[], int nRoundKeys, uint64_t compressed[])
+{
+    for (int i = 0, j = 0; i < 4 * nRoundKeys; i += 4, j += 2)
+    {
+        uint64_t q[8];
+        InterleaveInWords(q[0], q[4], w + i);
+        q[1] = q[2] = q[3] = q[0];
+        q[5] = q[6] = q[7] = q[4];
+        BitslicedU64::Ortho(q);
+        compressed[j] = (q[0] & 0x1111111111111111ull) | (q[1] & 0x2222222222222222ull)
+                      | (q[2] & 0x4444444444444444ull) | (q[3] & 0x8888888888888888ull);
+        compressed[j + 1] = (q[4] & 0x1111111111111111ull) | (q[5] & 0x2222222222222222ull)
+                          | (q[6] & 0x4444444444444444ull) | (q[7] & 0x8888888888888888ull);
+    }
+}
+
+// Expands a 4 * Nk-byte AES key into the compressed bitsliced schedule.
+template <int Nk>
+static void KeyExpansion_BS(const byte* key, uint64_t compressed[])
+{
+    const int nWords = 4 * (Nk + 7);
+    uint32_t w[nWords];
+    for (int i = 0; i < Nk; i++)
+        w[i] = GetU32LE(key + 4 * i);
+
+    uint32_t tmp = w[Nk - 1];
+    for (int i = Nk; i < nWords; i++)
+    {
+        if (i % Nk == 0)
+        {
+            // RotWord (little-endian words), SubWord and XOR with the round constant.
+            tmp = (tmp << 24) | (tmp >> 8);
+            tmp = SubWordBS(tmp) ^ RconBS[i / Nk - 1];
+        }
+        else if (Nk > 6 && i % Nk == 4)
+        {
+            tmp = SubWordBS(tmp);
+        }
+        tmp ^= w[i - Nk];
+        w[i] = tmp;
+    }
+
+    CompressRoundKeys(w, Nk + 7, compressed);
+    SecureZero(w, sizeof(w));
+}
+
+static inline uint32_t ByteSwap32(uint32_t x)
+{
+    return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+// Expands the compressed schedule to 8 * (Nr + 1) words, with every round key
+// replicated into all 4 block slots of a 64-bit word.
+template <int Nr>
+static void ExpandRoundKeys(const uint64_t compressed[], uint64_t sk[])
+{
+    for (int u = 0, v = 0; u < 2 * (Nr + 1); u++, v += 4)
+    {
+        uint64_t x0 = compressed[u] & 0x1111111111111111ull;
+        uint64_t x1 = (compressed[u] & 0x2222222222222222ull) >> 1;
+        uint64_t x2 = (compressed[u] & 0x4444444444444444ull) >> 2;
+        uint64_t x3 = (compressed[u] & 0x8888888888888888ull) >> 3;
+        sk[v + 0] = (x0 << 4) - x0;
+        sk[v + 1] = (x1 << 4) - x1;
+        sk[v + 2] = (x2 << 4) - x2;
+        sk[v + 3] = (x3 << 4) - x3;
+    }
+}
+
+// Rebuilds the T-table schedule (one big-endian column per word) from the
+// compressed bitsliced one, without lookups: ExpandRoundKeys gives every round
+// key as the bitsliced form of 4 equal blocks, which Ortho turns back into words.
+template <int Nr>
+static void BitslicedToWords(const uint64_t compressed[], uint32_t words[])
+{
+    uint64_t sk[8 * (Nr + 1)];
+    ExpandRoundKeys<Nr>(compressed, sk);
+    for (int r = 0; r <= Nr; r++)
+    {
+        uint64_t* q = sk + 8 * r;
+        BitslicedU64::Ortho(q);
+        uint32_t w[4];
+        InterleaveOutWords(w, q[0], q[4]);
+        for (int i = 0; i < 4; i++)
+            words[4 * r + i] = ByteSwap32(w[i]);
+    }
+    SecureZero(sk, sizeof(sk));
+}
+
+// ---------------------- Engine Functions ----------------------
+
+template <int Nk>
+static void ExpandKey_BS(const byte* key, AES_RoundKeys& rk)
+{
+    KeyExpansion_BS<Nk>(key, rk.bitsliced);
+}
+
+template <int Nr>
+static void Encrypt_BS(const byte in[16], byte out[16], const AES_RoundKeys& rk)
+{
+    uint64_t sk[8 * (Nr + 1)];
+    ExpandRoundKeys<Nr>(rk.bitsliced, sk);
+
+    uint64_t q[8] = { 0 };
+    InterleaveIn(q[0], q[4], in);
+    BitslicedU64::Ortho(q);
+    BitslicedU64::EncryptRounds<Nr>(q, sk);
+    BitslicedU64::Ortho(q);
+    InterleaveOut(out, q[0], q[4]);
+}
+
+// Single CBC-MAC chain: one useful block slot out of four, but still constant-time.
+template <int Nr>
+static void CBCMAC_BS(const AES_RoundKeys& rk, byte X[16], const byte* blocks, size_t nBlocks)
+{
+    const AES_RoundKeys* rks[1] = { &rk };
+    byte* Xs[1] = { X };
+    const byte* bs[1] = { blocks };
+    BitslicedU64::CbcMacLanes<Nr>(rks, Xs, bs, nBlocks, 1);
+}
+
+// T-table + bitsliced: single blocks and single chains go through the T-table
+// functions of AES.cpp, on a T-table schedule rebuilt from the bitsliced one
+// for the call. The rebuild costs about one key expansion per call, which a
+// chain of more than a few blocks earns back.
+template <int Nr>
+static void Encrypt_TBS(const byte in[16], byte out[16], const AES_RoundKeys& rk)
+{
+    uint32_t words[4 * (Nr + 1)];
+    BitslicedToWords<Nr>(rk.bitsliced, words);
+    AES_EncryptBlock_T<Nr>(in, out, words);
+    SecureZero(words, sizeof(words));
+}
+
+template <int Nr>
+static void CBCMAC_TBS(const AES_RoundKeys& rk, byte X[16], const byte* blocks, size_t nBlocks)
+{
+    if (nBlocks == 0)
+        return;
+    uint32_t words[4 * (Nr + 1)];
+    BitslicedToWords<Nr>(rk.bitsliced, words);
+    AES_CbcMac_T<Nr>(words, X, blocks, nBlocks);
+    SecureZero(words, sizeof(words));
+}
+
+// One AES_Cipher per key size; only the lane and ECB kernels depend on the slice width.
+#define AES_BITSLICED_CIPHER(Nk, Kernel) \
+    { 4 * (Nk), (Nk) + 6, ExpandKey_BS<Nk>, Encrypt_BS<(Nk) + 6>, CBCMAC_BS<(Nk) + 6>, Kernel::CbcMacLanes<(Nk) + 6>, \
+      Kernel::EncryptBlocks<(Nk) + 6> }
+#define AES_BITSLICED_CIPHERS(Kernel) \
+    AES_BITSLICED_CIPHER(4, Kernel), AES_BITSLICED_CIPHER(6, Kernel), AES_BITSLICED_CIPHER(8, Kernel)
+
+#define AES_TTABLE_BITSLICED_CIPHER(Nk, Kernel) \
+    { 4 * (Nk), (Nk) + 6, ExpandKey_BS<Nk>, Encrypt_TBS<(Nk) + 6>, CBCMAC_TBS<(Nk) + 6>, Kernel::CbcMacLanes<(Nk) + 6>, \
+      Kernel::EncryptBlocks<(Nk) + 6> }
+#define AES_TTABLE_BITSLICED_CIPHERS(Kernel) \
+    AES_TTABLE_BITSLICED_CIPHER(4, Kernel), AES_TTABLE_BITSLICED_CIPHER(6, Kernel), AES_TTABLE_BITSLICED_CIPHER(8, Kernel)
+
+static const AES_Engine BitslicedEngine = { AES_Backend::Bitsliced, "bitsliced", 8, AES_BITSLICED_CIPHERS(BitslicedU64) };
+
+#ifdef AES_HAVE_BITSLICED_SIMD
+static const AES_Engine BitslicedSSE2Engine = { AES_Backend::BitslicedSSE2, "bitsliced-sse2", 8, AES_BITSLICED_CIPHERS(BitslicedSSE2) };
+static const AES_Engine BitslicedAVX2Engine = { AES_Backend::BitslicedAVX2, "bitsliced-avx2", 16, AES_BITSLICED_CIPHERS(BitslicedAVX2) };
+static const AES_Engine TTableBitslicedSSE2Engine = { AES_Backend::TTableBitsliced, "ttable+bitsliced-sse2", 8, AES_TTABLE_BITSLICED_CIPHERS(BitslicedSSE2) };
+static const AES_Engine TTableBitslicedAVX2Engine = { AES_Backend::TTableBitsliced, "ttable+bitsliced-avx2", 16, AES_TTABLE_BITSLICED_CIPHERS(BitslicedAVX2) };
+#else
+static const AES_Engine TTableBitslicedEngine = { AES_Backend::TTableBitsliced, "ttable+bitsliced", 8, AES_TTABLE_BITSLICED_CIPHERS(BitslicedU64) };
+#endif
+
+const AES_Engine* GetBitslicedEngine(AES_Backend backend)
+{
+    switch (backend)
+    {
+    case AES_Backend::Bitsliced:
+        return &BitslicedEngine;
+#ifdef AES_HAVE_BITSLICED_SIMD
+    case AES_Backend::BitslicedSSE2:
+        return &BitslicedSSE2Engine;
+    case AES_Backend::BitslicedAVX2:
+        return CpuHasAvx2() ? &BitslicedAVX2Engine : nullptr;
+    case AES_Backend::TTableBitsliced:
+        return CpuHasAvx2() ? &TTableBitslicedAVX2Engine : &TTableBitslicedSSE2Engine;
+#else
+    case AES_Backend::TTableBitsliced:
+        return &TTableBitslicedEngine;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
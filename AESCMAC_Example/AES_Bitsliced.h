@@ -0,0 +1,21 @@
+//
+// Bitsliced constant-time AES engines (AES_Bitsliced.cpp), for 128, 192 and
+// 256-bit keys.
+//
+
+#pragma once
+
+#include "AES.h"
+
+// GetBitslicedEngine: returns the engine for AES_Backend::Bitsliced,
+// BitslicedSSE2, BitslicedAVX2 or TTableBitsliced (with the widest kernels this
+// CPU supports), or nullptr if this CPU or build lacks it.
+const AES_Engine* GetBitslicedEngine(AES_Backend backend);
+
+// AES_EncryptBlock_T / AES_CbcMac_T: the T-table encryption and CBC-MAC chain
+// of AES.cpp (Nr = 10, 12 or 14) on a T-table schedule, which the T-table +
+// bitsliced engine rebuilds from its bitsliced one.
+template <int Nr>
+void AES_EncryptBlock_T(const byte in[16], byte out[16], const uint32_t rk[]);
+template <int Nr>
+void AES_CbcMac_T(const uint32_t rk[], byte X[16], const byte* blocks, size_t nBlocks);
@@ -0,0 +1,376 @@
+//
+// Bitsliced AES round functions, written once against an abstract slice type.
+//
+// AES_Bitsliced.cpp includes this file once per SIMD width, inside a namespace
+// that provides:
+//   Slice              a vector of SliceWords 64-bit words
+//   SliceWords         number of 64-bit words per Slice
+//   Xor/And/Or/Not     bitwise operations
+//   Shl<n>/Shr<n>      shifts within each 64-bit word
+//   Set1(m)            m broadcast to every 64-bit word
+//   Load(p)/Store(p,x) move SliceWords 64-bit words between memory and a Slice
+//
+// Each 64-bit word carries one bit of every byte of 4 blocks (the layout of
+// BearSSL's aes_ct64), so a Slice processes 4 * SliceWords blocks at a time.
+// There are no table lookups and no data-dependent branches.
+
+// Number of blocks processed by one call of the round functions.
+static const size_t Capacity = 4 * SliceWords;
+
+// SubBytes on all blocks: the Boyar-Peralta S-box circuit (113 gates).
+// Input and output bits are numbered in reverse order (x0 is the high bit).
+static inline void Sbox(Slice q[8])
+{
+    Slice x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+    Slice x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // Top linear transformation.
+    Slice y14 = Xor(x3, x5);
+    Slice y13 = Xor(x0, x6);
+    Slice y9  = Xor(x0, x3);
+    Slice y8  = Xor(x0, x5);
+    Slice t0  = Xor(x1, x2);
+    Slice y1  = Xor(t0, x7);
+    Slice y4  = Xor(y1, x3);
+    Slice y12 = Xor(y13, y14);
+    Slice y2  = Xor(y1, x0);
+    Slice y5  = Xor(y1, x6);
+    Slice y3  = Xor(y5, y8);
+    Slice t1  = Xor(x4, y12);
+    Slice y15 = Xor(t1, x5);
+    Slice y20 = Xor(t1, x1);
+    Slice y6  = Xor(y15, x7);
+    Slice y10 = Xor(y15, t0);
+    Slice y11 = Xor(y20, y9);
+    Slice y7  = Xor(x7, y11);
+    Slice y17 = Xor(y10, y11);
+    Slice y19 = Xor(y10, y8);
+    Slice y16 = Xor(t0, y11);
+    Slice y21 = Xor(y13, y16);
+    Slice y18 = Xor(x0, y16);
+
+    // Non-linear section.
+    Slice t2  = And(y12, y15);
+    Slice t3  = And(y3, y6);
+    Slice t4  = Xor(t3, t2);
+    Slice t5  = And(y4, x7);
+    Slice t6  = Xor(t5, t2);
+    Slice t7  = And(y13, y16);
+    Slice t8  = And(y5, y1);
+    Slice t9  = Xor(t8, t7);
+    Slice t10 = And(y2, y7);
+    Slice t11 = Xor(t10, t7);
+    Slice t12 = And(y9, y11);
+    Slice t13 = And(y14, y17);
+    Slice t14 = Xor(t13, t12);
+    Slice t15 = And(y8, y10);
+    Slice t16 = Xor(t15, t12);
+    Slice t17 = Xor(t4, t14);
+    Slice t18 = Xor(t6, t16);
+    Slice t19 = Xor(t9, t14);
+    Slice t20 = Xor(t11, t16);
+    Slice t21 = Xor(t17, y20);
+    Slice t22 = Xor(t18, y19);
+    Slice t23 = Xor(t19, y21);
+    Slice t24 = Xor(t20, y18);
+
+    Slice t25 = Xor(t21, t22);
+    Slice t26 = And(t21, t23);
+    Slice t27 = Xor(t24, t26);
+    Slice t28 = And(t25, t27);
+    Slice t29 = Xor(t28, t22);
+    Slice t30 = Xor(t23, t24);
+    Slice t31 = Xor(t22, t26);
+    Slice t32 = And(t31, t30);
+    Slice t33 = Xor(t32, t24);
+    Slice t34 = Xor(t23, t33);
+    Slice t35 = Xor(t27, t33);
+    Slice t36 = And(t24, t35);
+    Slice t37 = Xor(t36, t34);
+    Slice t38 = Xor(t27, t36);
+    Slice t39 = And(t29, t38);
+    Slice t40 = Xor(t25, t39);
+
+    Slice t41 = Xor(t40, t37);
+    Slice t42 = Xor(t29, t33);
+    Slice t43 = Xor(t29, t40);
+    Slice t44 = Xor(t33, t37);
+    Slice t45 = Xor(t42, t41);
+    Slice z0  = And(t44, y15);
+    Slice z1  = And(t37, y6);
+    Slice z2  = And(t33, x7);
+    Slice z3  = And(t43, y16);
+    Slice z4  = And(t40, y1);
+    Slice z5  = And(t29, y7);
+    Slice z6  = And(t42, y11);
+    Slice z7  = And(t45, y17);
+    Slice z8  = And(t41, y10);
+    Slice z9  = And(t44, y12);
+    Slice z10 = And(t37, y3);
+    Slice z11 = And(t33, y4);
+    Slice z12 = And(t43, y13);
+    Slice z13 = And(t40, y5);
+    Slice z14 = And(t29, y2);
+    Slice z15 = And(t42, y9);
+    Slice z16 = And(t45, y14);
+    Slice z17 = And(t41, y8);
+
+    // Bottom linear transformation.
+    Slice t46 = Xor(z15, z16);
+    Slice t47 = Xor(z10, z11);
+    Slice t48 = Xor(z5, z13);
+    Slice t49 = Xor(z9, z10);
+    Slice t50 = Xor(z2, z12);
+    Slice t51 = Xor(z2, z5);
+    Slice t52 = Xor(z7, z8);
+    Slice t53 = Xor(z0, z3);
+    Slice t54 = Xor(z6, z7);
+    Slice t55 = Xor(z16, z17);
+    Slice t56 = Xor(z12, t48);
+    Slice t57 = Xor(t50, t53);
+    Slice t58 = Xor(z4, t46);
+    Slice t59 = Xor(z3, t54);
+    Slice t60 = Xor(t46, t57);
+    Slice t61 = Xor(z14, t57);
+    Slice t62 = Xor(t52, t58);
+    Slice t63 = Xor(t49, t58);
+    Slice t64 = Xor(z4, t59);
+    Slice t65 = Xor(t61, t62);
+    Slice t66 = Xor(z1, t63);
+    Slice s0  = Xor(t59, t63);
+    Slice s6  = Xor(t56, Not(t62));
+    Slice s7  = Xor(t48, Not(t60));
+    Slice t67 = Xor(t64, t65);
+    Slice s3  = Xor(t53, t66);
+    Slice s4  = Xor(t51, t66);
+    Slice s5  = Xor(t47, t65);
+    Slice s1  = Xor(t64, Not(s3));
+    Slice s2  = Xor(t55, Not(t67));
+
+    q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+    q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+}
+
+// Swaps the bits selected by ch in x with the bits selected by cl in y, s bits apart.
+template <int s>
+static inline void SwapBits(Slice& x, Slice& y, uint64_t cl, uint64_t ch)
+{
+    Slice a = x, b = y;
+    x = Or(And(a, Set1(cl)), Shl<s>(And(b, Set1(cl))));
+    y = Or(Shr<s>(And(a, Set1(ch))), And(b, Set1(ch)));
+}
+
+// Ortho: converts between interleaved words and bitsliced form (self-inverse).
+static inline void Ortho(Slice q[8])
+{
+    AES_BS_UNROLL
+    for (int i = 0; i < 8; i += 2)
+        SwapBits<1>(q[i], q[i + 1], 0x5555555555555555ull, 0xAAAAAAAAAAAAAAAAull);
+    AES_BS_UNROLL
+    for (int i = 0; i < 8; i += 4)
+    {
+        SwapBits<2>(q[i], q[i + 2], 0x3333333333333333ull, 0xCCCCCCCCCCCCCCCCull);
+        SwapBits<2>(q[i + 1], q[i + 3], 0x3333333333333333ull, 0xCCCCCCCCCCCCCCCCull);
+    }
+    AES_BS_UNROLL
+    for (int i = 0; i < 4; i++)
+        SwapBits<4>(q[i], q[i + 4], 0x0F0F0F0F0F0F0F0Full, 0xF0F0F0F0F0F0F0F0ull);
+}
+
+static inline void AddRoundKey(Slice q[8], const Slice sk[8])
+{
+    AES_BS_UNROLL
+    for (int i = 0; i < 8; i++)
+        q[i] = Xor(q[i], sk[i]);
+}
+
+static inline void ShiftRows(Slice q[8])
+{
+    AES_BS_UNROLL
+    for (int i = 0; i < 8; i++)
+    {
+        Slice x = q[i];
+        q[i] = Or(Or(Or(And(x, Set1(0x000000000000FFFFull)),
+                        Shr<4>(And(x, Set1(0x00000000FFF00000ull)))),
+                     Or(Shl<12>(And(x, Set1(0x00000000000F0000ull))),
+                        Shr<8>(And(x, Set1(0x0000FF0000000000ull))))),
+                  Or(Or(Shl<8>(And(x, Set1(0x000000FF00000000ull))),
+                        Shr<12>(And(x, Set1(0xF000000000000000ull)))),
+                     Shl<4>(And(x, Set1(0x0FFF000000000000ull)))));
+    }
+}
+
+static inline Slice RotR16(Slice x)
+{
+    return Or(Shr<16>(x), Shl<48>(x));
+}
+
+static inline Slice RotR32(Slice x)
+{
+    return Or(Shr<32>(x), Shl<32>(x));
+}
+
+static inline void MixColumns(Slice q[8])
+{
+    Slice r[8];
+    AES_BS_UNROLL
+    for (int i = 0; i < 8; i++)
+        r[i] = RotR16(q[i]);
+
+    Slice q7r7 = Xor(q[7], r[7]);
+    Slice n0 = Xor(Xor(q7r7, r[0]), RotR32(Xor(q[0], r[0])));
+    Slice n1 = Xor(Xor(Xor(q[0], r[0]), Xor(q7r7, r[1])), RotR32(Xor(q[1], r[1])));
+    Slice n2 = Xor(Xor(Xor(q[1], r[1]), r[2]), RotR32(Xor(q[2], r[2])));
+    Slice n3 = Xor(Xor(Xor(q[2], r[2]), Xor(q7r7, r[3])), RotR32(Xor(q[3], r[3])));
+    Slice n4 = Xor(Xor(Xor(q[3], r[3]), Xor(q7r7, r[4])), RotR32(Xor(q[4], r[4])));
+    Slice n5 = Xor(Xor(Xor(q[4], r[4]), r[5]), RotR32(Xor(q[5], r[5])));
+    Slice n6 = Xor(Xor(Xor(q[5], r[5]), r[6]), RotR32(Xor(q[6], r[6])));
+    Slice n7 = Xor(Xor(Xor(q[6], r[6]), r[7]), RotR32(q7r7));
+    q[0] = n0; q[1] = n1; q[2] = n2; q[3] = n3;
+    q[4] = n4; q[5] = n5; q[6] = n6; q[7] = n7;
+}
+
+// Encrypts the bitsliced state with Nr + 1 bitsliced round keys (8 slices each).
+template <int Nr>
+static inline void EncryptRounds(Slice q[8], const Slice sk[])
+{
+    AddRoundKey(q, sk);
+    for (int round = 1; round < Nr; round++)
+    {
+        Sbox(q);
+        ShiftRows(q);
+        MixColumns(q);
+        AddRoundKey(q, sk + round * 8);
+    }
+    Sbox(q);
+    ShiftRows(q);
+    AddRoundKey(q, sk + Nr * 8);
+}
+
+// Bitslices one block per lane (zero for lanes >= nLanes) and XORs it into q.
+static inline void XorBlocksIn(Slice q[8], const byte* const blocks[], size_t offset, size_t nLanes)
+{
+    uint64_t w[8][SliceWords];
+    for (size_t s = 0; s < SliceWords; s++)
+    {
+        for (size_t j = 0; j < 4; j++)
+        {
+            size_t lane = s * 4 + j;
+            if (lane < nLanes)
+                InterleaveIn(w[j][s], w[j + 4][s], blocks[lane] + offset);
+            else
+                w[j][s] = w[j + 4][s] = 0;
+        }
+    }
+
+    Slice m[8];
+    for (int i = 0; i < 8; i++)
+        m[i] = Load(w[i]);
+    Ortho(m);
+    for (int i = 0; i < 8; i++)
+        q[i] = Xor(q[i], m[i]);
+}
+
+// Converts the bitsliced state back to one block per lane.
+static inline void StoreBlocks(Slice q[8], byte* const out[], size_t nLanes)
+{
+    Ortho(q);
+    uint64_t w[8][SliceWords];
+    for (int i = 0; i < 8; i++)
+        Store(w[i], q[i]);
+    for (size_t s = 0; s < SliceWords; s++)
+    {
+        for (size_t j = 0; j < 4; j++)
+        {
+            size_t lane = s * 4 + j;
+            if (lane < nLanes)
+                InterleaveOut(out[lane], w[j][s], w[j + 4][s]);
+        }
+    }
+}
+
+// Builds bitsliced round keys where every block slot carries its own lane's key.
+template <int Nr>
+static inline void LaneRoundKeys(Slice sk[], const AES_RoundKeys* const rk[], size_t nLanes)
+{
+    for (int plane = 0; plane < 8 * (Nr + 1); plane++)
+    {
+        int word = (plane / 8) * 2 + (plane % 8) / 4;
+        int bit = plane % 4;
+        uint64_t w[SliceWords];
+        for (size_t s = 0; s < SliceWords; s++)
+        {
+            uint64_t v = 0;
+            for (size_t j = 0; j < 4 && s * 4 + j < nLanes; j++)
+                v |= ((rk[s * 4 + j]->bitsliced[word] >> bit) & 0x1111111111111111ull) << j;
+            w[s] = v;
+        }
+        sk[plane] = Load(w);
+    }
+}
+
+// Advances up to Capacity independent CBC-MAC chains by nBlocks blocks each.
+// The chaining values stay bitsliced from the first block to the last.
+template <int Nr>
+static void CbcMacGroup(const AES_RoundKeys* const rk[], byte* const X[], const byte* const blocks[], size_t nBlocks, size_t nLanes)
+{
+    Slice sk[8 * (Nr + 1)];
+    LaneRoundKeys<Nr>(sk, rk, nLanes);
+
+    Slice q[8];
+    for (int i = 0; i < 8; i++)
+        q[i] = Set1(0);
+    XorBlocksIn(q, X, 0, nLanes);
+
+    for (size_t i = 0; i < nBlocks; i++)
+    {
+        XorBlocksIn(q, blocks, i * 16, nLanes);
+        EncryptRounds<Nr>(q, sk);
+    }
+
+    StoreBlocks(q, X, nLanes);
+}
+
+// Encrypts nBlocks independent blocks under one key, Capacity blocks per pass.
+template <int Nr>
+static void EncryptBlocks(const AES_RoundKeys& rk, const byte* in, byte* out, size_t nBlocks)
+{
+    // LaneRoundKeys with the same key in every slot: each bit is replicated
+    // into all 4 slots of its nibble.
+    Slice sk[8 * (Nr + 1)];
+    for (int plane = 0; plane < 8 * (Nr + 1); plane++)
+    {
+        int word = (plane / 8) * 2 + (plane % 8) / 4;
+        uint64_t x = (rk.bitsliced[word] >> (plane % 4)) & 0x1111111111111111ull;
+        sk[plane] = Set1((x << 4) - x);
+    }
+
+    for (size_t first = 0; first < nBlocks; first += Capacity)
+    {
+        size_t n = nBlocks - first < Capacity ? nBlocks - first : Capacity;
+        const byte* src[Capacity];
+        byte* dst[Capacity];
+        for (size_t j = 0; j < n; j++)
+        {
+            src[j] = in + (first + j) * 16;
+            dst[j] = out + (first + j) * 16;
+        }
+
+        Slice q[8];
+        for (int i = 0; i < 8; i++)
+            q[i] = Set1(0);
+        XorBlocksIn(q, src, 0, n);
+        EncryptRounds<Nr>(q, sk);
+        StoreBlocks(q, dst, n);
+    }
+}
+
+template <int Nr>
+static void CbcMacLanes(const AES_RoundKeys* const rk[], byte* const X[], const byte* const blocks[], size_t nBlocks, size_t nLanes)
+{
+    for (size_t first = 0; first < nLanes; first += Capacity)
+    {
+        size_t n = nLanes - first < Capacity ? nLanes - first : Capacity;
+        CbcMacGroup<Nr>(rk + first, X + first, blocks + first, nBlocks, n);
+    }
+}
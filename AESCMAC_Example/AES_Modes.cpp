@@ -0,0 +1,479 @@
+﻿//
+// AES-CTR and AES-GCM. See AES_Modes.h for the interface.
+//
+// GCM encryption (NIST SP 800-38D, Section 7.1):
+//  1. H = CIPHK(0^128).
+//  2. J0 = IV || 0^31 || 1 for a 96-bit IV, otherwise
+//     J0 = GHASH(IV || 0^s || 0^64 || [len(IV)]64), with IV zero-padded to a block.
+//  3. C = the CTR encryption of P starting at inc32(J0).
+//  4. S = GHASH(A || 0^v || C || 0^u || [len(A)]64 || [len(C)]64).
+//  5. T = CIPHK(J0) xor S.
+//
+// Steps 3 and 4 run chunk by chunk, so each ciphertext chunk is hashed right
+// after it is written.
+
+#include "AES_Modes.h"
+#include "CMAC_Stats.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AES_HAVE_PCLMUL
+#endif
+
+#ifdef AES_HAVE_PCLMUL
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AES_TARGET_PCLMUL
+#else
+#include <cpuid.h>
+#define AES_TARGET_PCLMUL __attribute__((target("pclmul,ssse3")))
+#endif
+#endif
+
+// Blocks of key stream generated per encryptBlocks call, and the GCM chunk size.
+static const size_t CHUNK_BLOCKS = AES_MAX_LANES;
+
+static inline uint64_t GetU64BE(const byte* p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static inline void PutU64BE(byte* p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        p[i] = (byte)v;
+        v >>= 8;
+    }
+}
+
+// ---------------------- Counter Mode ----------------------
+
+// Increment128: adds 1 to a counter block taken as a 128-bit big-endian integer.
+static void Increment128(byte counter[16])
+{
+    for (int i = 15; i >= 0; i--)
+    {
+        if (++counter[i] != 0)
+            break;
+    }
+}
+
+// Increment32: inc32 of SP 800-38D, which only counts in the last 32 bits.
+static void Increment32(byte counter[16])
+{
+    for (int i = 15; i >= 12; i--)
+    {
+        if (++counter[i] != 0)
+            break;
+    }
+}
+
+// CtrChunk: XORs len (at most CHUNK_BLOCKS * 16) bytes with the key stream and
+// advances counter past the blocks it used. The counter blocks of the chunk are
+// encrypted in one encryptBlocks call.
+template <void (*Increment)(byte[16])>
+static void CtrChunk(const AES_Cipher& cipher, const AES_RoundKeys& rk, byte counter[16], const byte* in, byte* out, size_t len)
+{
+    alignas(16) byte stream[CHUNK_BLOCKS * 16];
+    size_t nBlocks = (len + 15) / 16;
+    for (size_t i = 0; i < nBlocks; i++)
+    {
+        memcpy(stream + 16 * i, counter, 16);
+        Increment(counter);
+    }
+    cipher.encryptBlocks(rk, stream, stream, nBlocks);
+    for (size_t i = 0; i < len; i++)
+        out[i] = in[i] ^ stream[i];
+}
+
+AesCtrKey::AesCtrKey(const byte* key, AES_KeySize keySize)
+    : engine(&AES_GetEngine()), cipher(&engine->Cipher(keySize))
+{
+    CMAC_ExpandKey(*cipher, key, roundKeys);
+}
+
+AesCtrKey::~AesCtrKey()
+{
+    SecureZero(&roundKeys, sizeof(roundKeys));
+}
+
+void AesCtrKey::Crypt(byte counter[16], const byte* in, byte* out, size_t len) const
+{
+    CMAC_STATS_BLOCKS(*engine, (len + 15) / 16);
+    for (size_t offset = 0; offset < len; offset += CHUNK_BLOCKS * 16)
+    {
+        size_t n = len - offset < CHUNK_BLOCKS * 16 ? len - offset : CHUNK_BLOCKS * 16;
+        CtrChunk<Increment128>(*cipher, roundKeys, counter, in + offset, out + offset, n);
+    }
+}
+
+// ---------------------- GHASH (portable) ----------------------
+//
+// Constant-time carry-less multiplication built from ordinary 64-bit integer
+// multiplies, the method of BearSSL's ghash_ctmul64: with only every fourth
+// bit of each operand set, the carries of a product never reach the next bit
+// that is kept, so four masked multiplies per quarter give an exact carry-less
+// product. The high halves come from the same routine on bit-reversed inputs.
+
+// BMul64: low 64 bits of the carry-less product of x and y.
+static inline uint64_t BMul64(uint64_t x, uint64_t y)
+{
+    const uint64_t m0 = 0x1111111111111111ull, m1 = 0x2222222222222222ull;
+    const uint64_t m2 = 0x4444444444444444ull, m3 = 0x8888888888888888ull;
+    uint64_t x0 = x & m0, x1 = x & m1, x2 = x & m2, x3 = x & m3;
+    uint64_t y0 = y & m0, y1 = y & m1, y2 = y & m2, y3 = y & m3;
+    uint64_t z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+    uint64_t z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+    uint64_t z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+    uint64_t z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+    return (z0 & m0) | (z1 & m1) | (z2 & m2) | (z3 & m3);
+}
+
+// Rev64: reverses the bit order of a 64-bit word.
+static inline uint64_t Rev64(uint64_t x)
+{
+    x = ((x & 0x5555555555555555ull) << 1) | ((x >> 1) & 0x5555555555555555ull);
+    x = ((x & 0x3333333333333333ull) << 2) | ((x >> 2) & 0x3333333333333333ull);
+    x = ((x & 0x0F0F0F0F0F0F0F0Full) << 4) | ((x >> 4) & 0x0F0F0F0F0F0F0F0Full);
+    x = ((x & 0x00FF00FF00FF00FFull) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFull);
+    x = ((x & 0x0000FFFF0000FFFFull) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFull);
+    return (x << 32) | (x >> 32);
+}
+
+static void GhashUpdate_Portable(const GHASH_Key& key, byte Y[16], const byte* blocks, size_t nBlocks)
+{
+    uint64_t h1 = key.h[0], h0 = key.h[1];
+    uint64_t h2 = h0 ^ h1;
+    uint64_t h0r = Rev64(h0), h1r = Rev64(h1);
+    uint64_t h2r = h0r ^ h1r;
+
+    uint64_t y1 = GetU64BE(Y), y0 = GetU64BE(Y + 8);
+    for (size_t i = 0; i < nBlocks; i++)
+    {
+        y1 ^= GetU64BE(blocks + 16 * i);
+        y0 ^= GetU64BE(blocks + 16 * i + 8);
+
+        // Karatsuba: three 64x64 products for the low halves, three on the
+        // reversed operands for the high halves.
+        uint64_t y0r = Rev64(y0), y1r = Rev64(y1);
+        uint64_t y2 = y0 ^ y1, y2r = y0r ^ y1r;
+        uint64_t z0 = BMul64(y0, h0);
+        uint64_t z1 = BMul64(y1, h1);
+        uint64_t z2 = BMul64(y2, h2);
+        uint64_t z0h = BMul64(y0r, h0r);
+        uint64_t z1h = BMul64(y1r, h1r);
+        uint64_t z2h = BMul64(y2r, h2r);
+        z2 ^= z0 ^ z1;
+        z2h ^= z0h ^ z1h;
+        z0h = Rev64(z0h) >> 1;
+        z1h = Rev64(z1h) >> 1;
+        z2h = Rev64(z2h) >> 1;
+
+        // The 256-bit product v3:v2:v1:v0, shifted left by one for the
+        // reflected bit order, then reduced modulo x^128 + x^7 + x^2 + x + 1.
+        uint64_t v0 = z0;
+        uint64_t v1 = z0h ^ z2;
+        uint64_t v2 = z1 ^ z2h;
+        uint64_t v3 = z1h;
+        v3 = (v3 << 1) | (v2 >> 63);
+        v2 = (v2 << 1) | (v1 >> 63);
+        v1 = (v1 << 1) | (v0 >> 63);
+        v0 = v0 << 1;
+        v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);
+        v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);
+        v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+        v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+        y0 = v2;
+        y1 = v3;
+    }
+    PutU64BE(Y, y1);
+    PutU64BE(Y + 8, y0);
+}
+
+// ---------------------- GHASH (PCLMULQDQ) ----------------------
+//
+// Carry-less multiplication in hardware, following Intel's white paper on
+// GCM with PCLMULQDQ: blocks are byte-reversed so a 128-bit register holds the
+// bit-reflected field element, products are shifted left by one bit and then
+// reduced. Four blocks are folded per reduction with the precomputed powers
+// H^4..H: Y' = (Y + X1)H^4 + X2 H^3 + X3 H^2 + X4 H.
+
+#ifdef AES_HAVE_PCLMUL
+
+// Returns true if the CPU has PCLMULQDQ (CPUID.01H:ECX[bit 1]) and SSSE3 (bit 9).
+static bool CpuHasPclmul()
+{
+    unsigned int ecx;
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    ecx = (unsigned int)regs[2];
+#else
+    unsigned int eax, ebx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+#endif
+    return (ecx & (1u << 1)) != 0 && (ecx & (1u << 9)) != 0;
+}
+
+AES_TARGET_PCLMUL static inline __m128i ByteReverse(__m128i x)
+{
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+// Adds the unreduced 256-bit product a * b to lo/mid/hi (mid = the two cross terms).
+AES_TARGET_PCLMUL static inline void ClmulAccumulate(__m128i a, __m128i b, __m128i& lo, __m128i& mid, __m128i& hi)
+{
+    lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(a, b, 0x00));
+    hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(a, b, 0x11));
+    mid = _mm_xor_si128(mid, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01)));
+}
+
+// Shifts the accumulated product left by one bit and reduces it modulo the GCM polynomial.
+AES_TARGET_PCLMUL static inline __m128i ClmulReduce(__m128i lo, __m128i mid, __m128i hi)
+{
+    __m128i t3 = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    __m128i t6 = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    __m128i t7 = _mm_srli_epi32(t3, 31);
+    __m128i t8 = _mm_srli_epi32(t6, 31);
+    t3 = _mm_slli_epi32(t3, 1);
+    t6 = _mm_slli_epi32(t6, 1);
+    __m128i t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    t3 = _mm_or_si128(t3, t7);
+    t6 = _mm_or_si128(t6, t8);
+    t6 = _mm_or_si128(t6, t9);
+
+    t7 = _mm_slli_epi32(t3, 31);
+    t8 = _mm_slli_epi32(t3, 30);
+    t9 = _mm_slli_epi32(t3, 25);
+    t7 = _mm_xor_si128(t7, _mm_xor_si128(t8, t9));
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    t3 = _mm_xor_si128(t3, t7);
+
+    __m128i t2 = _mm_srli_epi32(t3, 1);
+    t2 = _mm_xor_si128(t2, _mm_srli_epi32(t3, 2));
+    t2 = _mm_xor_si128(t2, _mm_srli_epi32(t3, 7));
+    t2 = _mm_xor_si128(t2, t8);
+    t3 = _mm_xor_si128(t3, t2);
+    return _mm_xor_si128(t6, t3);
+}
+
+AES_TARGET_PCLMUL static inline __m128i ClmulMultiply(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    ClmulAccumulate(a, b, lo, mid, hi);
+    return ClmulReduce(lo, mid, hi);
+}
+
+AES_TARGET_PCLMUL static void GhashUpdate_Pclmul(const GHASH_Key& key, byte Y[16], const byte* blocks, size_t nBlocks)
+{
+    const __m128i* powers = reinterpret_cast<const __m128i*>(key.powers);
+    __m128i h1 = _mm_load_si128(powers);
+    __m128i h2 = _mm_load_si128(powers + 1);
+    __m128i h3 = _mm_load_si128(powers + 2);
+    __m128i h4 = _mm_load_si128(powers + 3);
+    __m128i y = ByteReverse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Y)));
+
+    size_t i = 0;
+    for (; i + 4 <= nBlocks; i += 4)
+    {
+        const __m128i* x = reinterpret_cast<const __m128i*>(blocks + 16 * i);
+        __m128i x0 = _mm_xor_si128(y, ByteReverse(_mm_loadu_si128(x)));
+        __m128i x1 = ByteReverse(_mm_loadu_si128(x + 1));
+        __m128i x2 = ByteReverse(_mm_loadu_si128(x + 2));
+        __m128i x3 = ByteReverse(_mm_loadu_si128(x + 3));
+
+        __m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        ClmulAccumulate(x0, h4, lo, mid, hi);
+        ClmulAccumulate(x1, h3, lo, mid, hi);
+        ClmulAccumulate(x2, h2, lo, mid, hi);
+        ClmulAccumulate(x3, h1, lo, mid, hi);
+        y = ClmulReduce(lo, mid, hi);
+    }
+    for (; i < nBlocks; i++)
+    {
+        __m128i x = ByteReverse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i)));
+        y = ClmulMultiply(_mm_xor_si128(y, x), h1);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(Y), ByteReverse(y));
+}
+
+AES_TARGET_PCLMUL static void GhashInit_Pclmul(const byte H[16], GHASH_Key& key)
+{
+    __m128i* powers = reinterpret_cast<__m128i*>(key.powers);
+    __m128i h = ByteReverse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(H)));
+    __m128i p = h;
+    for (int i = 0; i < 4; i++)
+    {
+        _mm_store_si128(powers + i, p);
+        p = ClmulMultiply(p, h);
+    }
+}
+
+#endif // AES_HAVE_PCLMUL
+
+// ---------------------- GHASH ----------------------
+
+// GhashInit: sets up key for H, with PCLMULQDQ when the AES engine is AES-NI
+// (hardware AES and carry-less multiply come together) and the portable
+// multiplier otherwise, which keeps the bitsliced engines free of lookups.
+static void GhashInit(const byte H[16], GHASH_Key& key)
+{
+    memset(&key, 0, sizeof(key));
+#ifdef AES_HAVE_PCLMUL
+    static const bool hasPclmul = CpuHasPclmul();
+    if (AES_GetEngine().backend == AES_Backend::AESNI && hasPclmul)
+    {
+        key.update = GhashUpdate_Pclmul;
+        GhashInit_Pclmul(H, key);
+        return;
+    }
+#endif
+    key.update = GhashUpdate_Portable;
+    key.h[0] = GetU64BE(H);
+    key.h[1] = GetU64BE(H + 8);
+}
+
+// GhashBytes: hashes len bytes; a final partial block is padded with zeros.
+static void GhashBytes(const GHASH_Key& key, byte Y[16], const byte* data, size_t len)
+{
+    size_t nBlocks = len / 16;
+    if (nBlocks > 0)
+        key.update(key, Y, data, nBlocks);
+    size_t rem = len % 16;
+    if (rem > 0)
+    {
+        byte block[16] = { 0 };
+        memcpy(block, data + 16 * nBlocks, rem);
+        key.update(key, Y, block, 1);
+    }
+}
+
+// GhashLengths: hashes the block [a]64 || [b]64 of two byte counts, in bits.
+static void GhashLengths(const GHASH_Key& key, byte Y[16], size_t a, size_t b)
+{
+    byte block[16];
+    PutU64BE(block, (uint64_t)a * 8);
+    PutU64BE(block + 8, (uint64_t)b * 8);
+    key.update(key, Y, block, 1);
+}
+
+// ---------------------- GCM ----------------------
+
+AesGcmKey::AesGcmKey(const byte* key, AES_KeySize keySize)
+    : engine(&AES_GetEngine()), cipher(&engine->Cipher(keySize))
+{
+    CMAC_ExpandKey(*cipher, key, roundKeys);
+    CMAC_STATS_BLOCKS(*engine, 1);
+
+    byte H[16] = { 0 };
+    cipher->encryptBlocks(roundKeys, H, H, 1); // constant-time, like CMAC's L
+    GhashInit(H, ghash);
+    SecureZero(H, sizeof(H));
+}
+
+AesGcmKey::~AesGcmKey()
+{
+    SecureZero(&roundKeys, sizeof(roundKeys));
+    SecureZero(&ghash, sizeof(ghash));
+}
+
+void AesGcmKey::Crypt(bool encrypt, const byte* iv, size_t ivLen, const byte* aad, size_t aadLen,
+                      const byte* in, size_t len, byte* out, byte tag[16]) const
+{
+    CMAC_STATS_BLOCKS(*engine, (len + 15) / 16 + 1);   // The key stream and E(J0).
+    byte J0[16] = { 0 };
+    if (ivLen == 12)
+    {
+        memcpy(J0, iv, 12);
+        J0[15] = 1;
+    }
+    else
+    {
+        GhashBytes(ghash, J0, iv, ivLen);
+        GhashLengths(ghash, J0, 0, ivLen);
+    }
+
+    byte counter[16];
+    memcpy(counter, J0, 16);
+    Increment32(counter);
+
+    byte S[16] = { 0 };
+    GhashBytes(ghash, S, aad, aadLen);
+
+    // Chunks are whole blocks except the last, so only it can be zero-padded.
+    for (size_t offset = 0; offset < len; offset += CHUNK_BLOCKS * 16)
+    {
+        size_t n = len - offset < CHUNK_BLOCKS * 16 ? len - offset : CHUNK_BLOCKS * 16;
+        if (encrypt)
+        {
+            CtrChunk<Increment32>(*cipher, roundKeys, counter, in + offset, out + offset, n);
+            GhashBytes(ghash, S, out + offset, n);
+        }
+        else
+        {
+            GhashBytes(ghash, S, in + offset, n);
+            CtrChunk<Increment32>(*cipher, roundKeys, counter, in + offset, out + offset, n);
+        }
+    }
+    GhashLengths(ghash, S, aadLen, len);
+
+    cipher->encryptBlocks(roundKeys, J0, tag, 1);
+    for (int i = 0; i < 16; i++)
+        tag[i] ^= S[i];
+}
+
+// The input lengths SP 800-38D (Section 5.2.1.1) allows: a non-empty IV (an
+// empty one would give the same J0, and so the same key stream, for every
+// message), at most 2^39 - 256 bits of text, since the 32-bit counter must not
+// wrap into J0, and at most 2^64 - 1 bits of IV and AAD, whose bit lengths are
+// hashed as 64-bit values.
+static bool GcmLengthsValid(size_t ivLen, size_t aadLen, size_t len)
+{
+    return ivLen != 0 && (uint64_t)ivLen <= (1ull << 61) - 1 && (uint64_t)aadLen <= (1ull << 61) - 1 &&
+           (uint64_t)len <= (1ull << 36) - 32;
+}
+
+bool AesGcmKey::Encrypt(const byte* iv, size_t ivLen, const byte* aad, size_t aadLen,
+                        const byte* plaintext, size_t len, byte* ciphertext, byte tag[16]) const
+{
+    if (!GcmLengthsValid(ivLen, aadLen, len))
+        return false;
+    Crypt(true, iv, ivLen, aad, aadLen, plaintext, len, ciphertext, tag);
+    return true;
+}
+
+bool AesGcmKey::Decrypt(const byte* iv, size_t ivLen, const byte* aad, size_t aadLen,
+                        const byte* ciphertext, size_t len, const byte* tag, int Tlen, byte* plaintext) const
+{
+    if (!GcmLengthsValid(ivLen, aadLen, len))
+        return false;
+    if (Tlen != 128 && Tlen != 120 && Tlen != 112 && Tlen != 104 && Tlen != 96 && Tlen != 64 && Tlen != 32)
+        return false;
+
+    byte expected[16];
+    Crypt(false, iv, ivLen, aad, aadLen, ciphertext, len, plaintext, expected);
+
+    // Accumulate the differences so the running time does not depend on where
+    // the first mismatch is.
+    byte diff = 0;
+    for (int i = 0; i < Tlen / 8; i++)
+        diff |= expected[i] ^ tag[i];
+    if (diff != 0)
+    {
+        SecureZero(plaintext, len);
+        return false;
+    }
+    return true;
+}
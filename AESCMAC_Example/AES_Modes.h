@@ -0,0 +1,86 @@
+//
+// AES-CTR (NIST SP 800-38A) and AES-GCM (NIST SP 800-38D) on the same AES
+// engines as CMAC, for 128, 192 or 256-bit keys.
+//
+
+#pragma once
+
+#include "AES.h"
+
+// AesCtrKey: an AES key for counter mode, with its round keys precomputed.
+//
+// The key stream is generated AES_MAX_LANES counter blocks at a time through
+// AES_Cipher::encryptBlocks, so the AES-NI and bitsliced engines encrypt
+// several blocks per pass instead of one. Immutable after construction and
+// shareable between threads; the schedule is tied to the AES engine active at
+// construction. Key material is wiped when the object is destroyed.
+class AesCtrKey
+{
+public:
+    AesCtrKey(const byte* key, AES_KeySize keySize);
+    ~AesCtrKey();
+
+    // Crypt: out = in XOR CIPHK(T1) || CIPHK(T2) || ..., where T1 = counter and
+    // each counter block is the previous one plus 1 (mod 2^128, big-endian).
+    // Encryption and decryption are the same operation; in and out may be the
+    // same buffer. On return counter is the first unused counter block (a final
+    // partial block uses up its counter), so a message can be processed in
+    // pieces whose lengths are multiples of 16.
+    void Crypt(byte counter[16], const byte* in, byte* out, size_t len) const;
+
+private:
+    const AES_Engine* engine;
+    const AES_Cipher* cipher;   // engine's functions for this key size.
+    AES_RoundKeys roundKeys;
+};
+
+// GHASH_Key: the hash subkey H = CIPHK(0^128) in the layout of the GHASH
+// implementation picked for the key.
+struct GHASH_Key
+{
+    alignas(16) byte powers[4][16];     // PCLMULQDQ: H, H^2, H^3, H^4 with the bytes reversed.
+    uint64_t h[2];                      // Portable: H as two big-endian 64-bit halves.
+    // Y = (Y xor X1) * H, then the same for X2 ... XnBlocks (full blocks).
+    void (*update)(const GHASH_Key& key, byte Y[16], const byte* blocks, size_t nBlocks);
+};
+
+// AesGcmKey: an AES key for Galois/Counter Mode.
+//
+// Encryption is one pass over the data: each chunk of AES_MAX_LANES blocks is
+// encrypted in CTR mode and hashed by GHASH while it is still in L1, instead
+// of encrypting the whole buffer and then reading it again to authenticate it.
+// GHASH uses carry-less multiplication (PCLMULQDQ) with the AES-NI engine and
+// a portable constant-time multiplier with the software engines.
+//
+// The IV must be at least one byte (SP 800-38D requires len(IV) >= 1); 96 bits
+// is the recommended and fastest case.
+// Immutable after construction and shareable between threads.
+class AesGcmKey
+{
+public:
+    AesGcmKey(const byte* key, AES_KeySize keySize);
+    ~AesGcmKey();
+
+    // Encrypt: writes len bytes of ciphertext and the 128-bit tag over aad and
+    // the ciphertext. Truncate the tag if a shorter one is wanted. Returns
+    // false, writing nothing, if ivLen is 0 or a length exceeds the limits of
+    // SP 800-38D: len at most 2^36 - 32 bytes, aadLen and ivLen below 2^61.
+    bool Encrypt(const byte* iv, size_t ivLen, const byte* aad, size_t aadLen,
+                 const byte* plaintext, size_t len, byte* ciphertext, byte tag[16]) const;
+
+    // Decrypt: decrypts and checks the Tlen most significant bits of tag (Tlen
+    // is 128, 120, 112, 104, 96, 64 or 32) in constant time. Returns false, and
+    // zeroes plaintext, if the tag does not match; returns false without
+    // writing anything if Encrypt would refuse the lengths or Tlen is not allowed.
+    bool Decrypt(const byte* iv, size_t ivLen, const byte* aad, size_t aadLen,
+                 const byte* ciphertext, size_t len, const byte* tag, int Tlen, byte* plaintext) const;
+
+private:
+    void Crypt(bool encrypt, const byte* iv, size_t ivLen, const byte* aad, size_t aadLen,
+               const byte* in, size_t len, byte* out, byte tag[16]) const;
+
+    const AES_Engine* engine;
+    const AES_Cipher* cipher;   // engine's functions for this key size.
+    AES_RoundKeys roundKeys;
+    GHASH_Key ghash;
+};
@@ -0,0 +1,385 @@
+﻿//
+// Known-answer tests for AES-CTR (NIST SP 800-38A, F.5), AES-GCM (the test
+// cases of the GCM specification by McGrew and Viega, also used by SP 800-38D
+// validation) and AES-SIV (RFC 5297, Appendix A), run on every AES backend the
+// CPU supports. With the AES-NI engine GHASH uses PCLMULQDQ; with the others,
+// the portable multiplier.
+//
+// Exits with status 1 if any output differs.
+
+#include "AES_Modes.h"
+#include "AES_SIV.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static std::vector<byte> FromHex(const char* hex)
+{
+    std::vector<byte> out;
+    for (size_t i = 0; hex[i] != 0 && hex[i + 1] != 0; i += 2)
+    {
+        char digits[3] = { hex[i], hex[i + 1], 0 };
+        out.push_back((byte)strtoul(digits, nullptr, 16));
+    }
+    return out;
+}
+
+static void Check(const char* backend, const char* test, const byte* got, const std::vector<byte>& expected)
+{
+    if (expected.empty() || memcmp(got, expected.data(), expected.size()) == 0)
+        return;
+    failures++;
+    printf("FAIL %s %s: got ", backend, test);
+    for (size_t i = 0; i < expected.size(); i++)
+        printf("%02x", got[i]);
+    printf("\n");
+}
+
+// ---------------------- CTR ----------------------
+
+struct CtrVector
+{
+    const char* name;
+    const char* key;
+    const char* ciphertext;
+};
+
+static const char* CtrCounter = "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+static const char* CtrPlaintext =
+    "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+    "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+
+static const CtrVector CtrVectors[] = {
+    { "CTR-AES128 (F.5.1)", "2b7e151628aed2a6abf7158809cf4f3c",
+      "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+      "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee" },
+    { "CTR-AES192 (F.5.3)", "8e73b0f7da0e6452c810f32b809079e562f8ead2522c6b7b",
+      "1abc932417521ca24f2b0459fe7e6e0b090339ec0aa6faefd5ccc2c6f4ce8e94"
+      "1e36b26bd1ebc670d1bd1d665620abf74f78a7f6d29809585a97daec58c6b050" },
+    { "CTR-AES256 (F.5.5)", "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4",
+      "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"
+      "2b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6" },
+};
+
+static void TestCtr(const char* backend)
+{
+    std::vector<byte> plaintext = FromHex(CtrPlaintext);
+    for (const CtrVector& v : CtrVectors)
+    {
+        std::vector<byte> key = FromHex(v.key);
+        std::vector<byte> expected = FromHex(v.ciphertext);
+        AesCtrKey ctr(key.data(), (AES_KeySize)key.size());
+
+        byte counter[16];
+        byte out[64];
+        memcpy(counter, FromHex(CtrCounter).data(), 16);
+        ctr.Crypt(counter, plaintext.data(), out, 64);
+        Check(backend, v.name, out, expected);
+
+        // In two pieces, in place: the counter carries over.
+        memcpy(counter, FromHex(CtrCounter).data(), 16);
+        memcpy(out, plaintext.data(), 64);
+        ctr.Crypt(counter, out, out, 16);
+        ctr.Crypt(counter, out + 16, out + 16, 48);
+        Check(backend, v.name, out, expected);
+    }
+
+    // The counter is a 128-bit integer: check the carry across all 16 bytes
+    // against single-block encryptions of the expected counter values.
+    std::vector<byte> key = FromHex(CtrVectors[0].key);
+    AesCtrKey ctr(key.data(), AES_KeySize::AES128);
+    const AES_Cipher& cipher = AES_GetEngine().Cipher(AES_KeySize::AES128);
+    AES_RoundKeys rk;
+    cipher.expandKey(key.data(), rk);
+
+    byte counter[16];
+    memset(counter, 0xff, 16);
+    counter[15] = 0xfe;
+    byte zeros[48] = { 0 }, out[48];
+    ctr.Crypt(counter, zeros, out, 48);
+
+    std::vector<byte> expected(48);
+    byte block[16];
+    memset(block, 0xff, 16);
+    block[15] = 0xfe;
+    cipher.encrypt(block, &expected[0], rk);
+    block[15] = 0xff;
+    cipher.encrypt(block, &expected[16], rk);
+    memset(block, 0, 16);
+    cipher.encrypt(block, &expected[32], rk);
+    Check(backend, "CTR counter wrap", out, expected);
+    block[15] = 1;
+    Check(backend, "CTR next counter", counter, std::vector<byte>(block, block + 16));
+}
+
+// ---------------------- GCM ----------------------
+
+struct GcmVector
+{
+    const char* name;
+    const char* key;
+    const char* iv;
+    const char* aad;
+    const char* plaintext;
+    const char* ciphertext;
+    const char* tag;
+};
+
+#define GCM_P64 "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255"
+#define GCM_P60 "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39"
+#define GCM_AAD "feedfacedeadbeeffeedfacedeadbeefabaddad2"
+#define GCM_K128 "feffe9928665731c6d6a8f9467308308"
+
+static const GcmVector GcmVectors[] = {
+    { "GCM test case 1", "00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+      "58e2fccefa7e3061367f1d57a4e7455a" },
+    { "GCM test case 2", "00000000000000000000000000000000", "000000000000000000000000", "",
+      "00000000000000000000000000000000", "0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf" },
+    { "GCM test case 3", GCM_K128, "cafebabefacedbaddecaf888", "", GCM_P64,
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+      "4d5c2af327cd64a62cf35abd2ba6fab4" },
+    { "GCM test case 4", GCM_K128, "cafebabefacedbaddecaf888", GCM_AAD, GCM_P60,
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+      "5bc94fbc3221a5db94fae95ae7121a47" },
+    { "GCM test case 5", GCM_K128, "cafebabefacedbad", GCM_AAD, GCM_P60,
+      "61353b4c2806934a777ff51fa22a4755699b2a714fcdc6f83766e5f97b6c742373806900e49f24b22b097544d4896b424989b5e1ebac0f07c23f4598",
+      "3612d2e79e3b0785561be14aaca2fccb" },
+    { "GCM test case 6", GCM_K128,
+      "9313225df88406e555909c5aff5269aa6a7a9538534f7da1e4c303d2a318a728c3c0c95156809539fcf0e2429a6b525416aedbf5a0de6a57a637b39b",
+      GCM_AAD, GCM_P60,
+      "8ce24998625615b603a033aca13fb894be9112a5c3a211a8ba262a3cca7e2ca701e4a9a4fba43c90ccdcb281d48c7c6fd62875d2aca417034c34aee5",
+      "619cc5aefffe0bfa462af43c1699d050" },
+    { "GCM test case 7", "000000000000000000000000000000000000000000000000", "000000000000000000000000", "", "", "",
+      "cd33b28ac773f74ba00ed1f312572435" },
+    { "GCM test case 8", "000000000000000000000000000000000000000000000000", "000000000000000000000000", "",
+      "00000000000000000000000000000000", "98e7247c07f0fe411c267e4384b0f600", "2ff58d80033927ab8ef4d4587514f0fb" },
+    { "GCM test case 13", "0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000",
+      "", "", "", "530f8afbc74536b9a963b4f1c4cb738b" },
+    { "GCM test case 14", "0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000",
+      "", "00000000000000000000000000000000", "cea7403d4d606b6e074ec5d3baf39d18", "d0d1c8a799996bf0265b98b5d48ab919" },
+    { "GCM test case 16", GCM_K128 GCM_K128, "cafebabefacedbaddecaf888", GCM_AAD, GCM_P60,
+      "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+      "76fc6ece0f4e1768cddf8853bb2d551b" },
+};
+
+static void TestGcm(const char* backend)
+{
+    for (const GcmVector& v : GcmVectors)
+    {
+        std::vector<byte> key = FromHex(v.key), iv = FromHex(v.iv), aad = FromHex(v.aad);
+        std::vector<byte> plaintext = FromHex(v.plaintext), ciphertext = FromHex(v.ciphertext), tag = FromHex(v.tag);
+        AesGcmKey gcm(key.data(), (AES_KeySize)key.size());
+
+        std::vector<byte> out(plaintext.size() + 1);
+        byte outTag[16];
+        gcm.Encrypt(iv.data(), iv.size(), aad.data(), aad.size(), plaintext.data(), plaintext.size(), out.data(), outTag);
+        Check(backend, (std::string(v.name) + " ciphertext").c_str(), out.data(), ciphertext);
+        Check(backend, (std::string(v.name) + " tag").c_str(), outTag, tag);
+
+        if (!gcm.Decrypt(iv.data(), iv.size(), aad.data(), aad.size(), ciphertext.data(), ciphertext.size(), tag.data(), 128, out.data()))
+        {
+            failures++;
+            printf("FAIL %s %s: Decrypt rejected the tag\n", backend, v.name);
+        }
+        Check(backend, (std::string(v.name) + " plaintext").c_str(), out.data(), plaintext);
+
+        // A 96-bit truncated tag still verifies; a flipped tag bit does not.
+        if (!gcm.Decrypt(iv.data(), iv.size(), aad.data(), aad.size(), ciphertext.data(), ciphertext.size(), tag.data(), 96, out.data()))
+        {
+            failures++;
+            printf("FAIL %s %s: Decrypt rejected the 96-bit tag\n", backend, v.name);
+        }
+        tag[11] ^= 0x01;
+        if (gcm.Decrypt(iv.data(), iv.size(), aad.data(), aad.size(), ciphertext.data(), ciphertext.size(), tag.data(), 96, out.data()))
+        {
+            failures++;
+            printf("FAIL %s %s: Decrypt accepted a modified tag\n", backend, v.name);
+        }
+    }
+
+    // SP 800-38D requires a non-empty IV; both directions refuse an empty one.
+    const GcmVector& v = GcmVectors[0];
+    std::vector<byte> key = FromHex(v.key);
+    AesGcmKey gcm(key.data(), (AES_KeySize)key.size());
+    byte data[16] = { 0 }, out[16], tag[16] = { 0 };
+    if (gcm.Encrypt(data, 0, nullptr, 0, data, sizeof(data), out, tag) ||
+        gcm.Decrypt(data, 0, nullptr, 0, data, sizeof(data), tag, 128, out))
+    {
+        failures++;
+        printf("FAIL %s GCM accepted an empty IV\n", backend);
+    }
+
+    // Nor may the text exceed 2^36 - 32 bytes or the AAD 2^61 - 1 bytes. The
+    // lengths are checked before anything is read, so the buffers can be small.
+    if (sizeof(size_t) > 4)
+    {
+        const uint64_t maxLen = (1ull << 36) - 32, maxAadLen = (1ull << 61) - 1;
+        if (gcm.Encrypt(data, 12, data, 0, data, (size_t)(maxLen + 1), out, tag) ||
+            gcm.Decrypt(data, 12, data, 0, data, (size_t)(maxLen + 1), tag, 128, out) ||
+            gcm.Encrypt(data, 12, data, (size_t)(maxAadLen + 1), data, 0, out, tag) ||
+            gcm.Decrypt(data, 12, data, (size_t)(maxAadLen + 1), data, 0, tag, 128, out))
+        {
+            failures++;
+            printf("FAIL %s GCM accepted a text or AAD over the SP 800-38D limits\n", backend);
+        }
+    }
+}
+
+// Long messages (several chunks, odd tails) must give the same result on every
+// backend, which checks the PCLMULQDQ GHASH against the portable one.
+static void TestGcmLong(const char* backend, bool first, std::vector<byte>& results)
+{
+    std::vector<byte> data(5000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (byte)(i * 7 + (i >> 5));
+    byte key[32], iv[12];
+    memcpy(key, data.data() + 100, 32);
+    memcpy(iv, data.data() + 200, 12);
+    AesGcmKey gcm(key, AES_KeySize::AES256);
+
+    static const size_t lengths[] = { 17, 255, 256, 257, 1000, 4093 };
+    std::vector<byte> current;
+    for (size_t len : lengths)
+    {
+        std::vector<byte> out(len + 16);
+        gcm.Encrypt(iv, sizeof(iv), data.data() + 1, 37, data.data() + 500, len, out.data(), &out[len]);
+        current.insert(current.end(), out.begin(), out.end());
+    }
+
+    if (first)
+        results = current;
+    else
+        Check(backend, "GCM long messages", current.data(), results);
+}
+
+// ---------------------- SIV ----------------------
+
+struct SivVector
+{
+    const char* name;
+    const char* key;
+    const char* ad[3];      // nullptr-terminated; the nonce, if any, is last.
+    const char* plaintext;
+    const char* output;     // V || C
+};
+
+static const SivVector SivVectors[] = {
+    { "SIV A.1 (deterministic)",
+      "fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+      { "101112131415161718191a1b1c1d1e1f2021222324252627", nullptr },
+      "112233445566778899aabbccddee",
+      "85632d07c6e8f37f950acd320a2ecc9340c02b9690c4dc04daef7f6afe5c" },
+    { "SIV A.2 (nonce-based)",
+      "7f7e7d7c7b7a79787776757473727170404142434445464748494a4b4c4d4e4f",
+      { "00112233445566778899aabbccddeeffdeaddadadeaddadaffeeddccbbaa99887766554433221100",
+        "102030405060708090a0",
+        "09f911029d74e35bd84156c5635688c0" },
+      "7468697320697320736f6d6520706c61696e7465787420746f20656e6372797074207573696e67205349562d414553",
+      "7bdb6e3b432667eb06f4d14bff2fbd0fcb900f2fddbe4043266019" "65c889bf17dba77ceb094fa663b7a3f748ba8af829ea64ad544a272e9c485b62a3fd5c0d" },
+};
+
+static void TestSiv(const char* backend)
+{
+    for (const SivVector& v : SivVectors)
+    {
+        std::vector<byte> key = FromHex(v.key), plaintext = FromHex(v.plaintext), expected = FromHex(v.output);
+        std::vector<std::vector<byte>> adData;
+        std::vector<CmacSegment> ad;
+        for (size_t i = 0; i < 3 && v.ad[i] != nullptr; i++)
+            adData.push_back(FromHex(v.ad[i]));
+        for (const std::vector<byte>& a : adData)
+            ad.push_back({ a.data(), a.size() });
+
+        AesSivKey siv(key.data(), (AES_KeySize)(key.size() / 2));
+        std::vector<byte> out(16 + plaintext.size());
+        siv.Encrypt(ad.data(), ad.size(), plaintext.data(), plaintext.size(), out.data());
+        Check(backend, v.name, out.data(), expected);
+
+        std::vector<byte> decrypted(plaintext.size() + 1);
+        if (!siv.Decrypt(ad.data(), ad.size(), expected.data(), expected.size(), decrypted.data()))
+        {
+            failures++;
+            printf("FAIL %s %s: Decrypt rejected V\n", backend, v.name);
+        }
+        Check(backend, v.name, decrypted.data(), plaintext);
+
+        expected.back() ^= 0x01;
+        if (siv.Decrypt(ad.data(), ad.size(), expected.data(), expected.size(), decrypted.data()))
+        {
+            failures++;
+            printf("FAIL %s %s: Decrypt accepted a modified ciphertext\n", backend, v.name);
+        }
+    }
+
+    // Round trips around the 16-byte S2V cases and across decryption chunks.
+    std::vector<byte> data(9000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (byte)(i * 13 + (i >> 7));
+    for (AES_KeySize keySize : { AES_KeySize::AES128, AES_KeySize::AES192, AES_KeySize::AES256 })
+    {
+        AesSivKey siv(data.data() + 3, keySize);
+        CmacSegment ad[2] = { { data.data() + 70, 5 }, { data.data() + 90, 33 } };
+        static const size_t lengths[] = { 0, 1, 15, 16, 17, 31, 32, 4095, 4096, 4097, 4111, 4112, 8208 };
+        for (size_t len : lengths)
+        {
+            std::vector<byte> out(16 + len), back(len + 1);
+            siv.Encrypt(ad, 2, data.data() + 500, len, out.data());
+            bool ok = siv.Decrypt(ad, 2, out.data(), out.size(), back.data());
+            if (!ok || (len > 0 && memcmp(back.data(), data.data() + 500, len) != 0))
+            {
+                failures++;
+                printf("FAIL %s SIV round trip AES-%d len=%zu\n", backend, (int)keySize * 16, len);
+            }
+
+            // In place, and with out 16 bytes before the plaintext (V || C
+            // replacing a plaintext that sits right after room for V).
+            for (size_t shift : { (size_t)0, (size_t)16 })
+            {
+                std::vector<byte> buffer(16 + len);
+                memcpy(buffer.data() + shift, data.data() + 500, len);
+                siv.Encrypt(ad, 2, buffer.data() + shift, len, buffer.data());
+                if (buffer != out)
+                {
+                    failures++;
+                    printf("FAIL %s SIV overlapping encrypt AES-%d len=%zu shift=%zu\n", backend, (int)keySize * 16, len,
+                           shift);
+                }
+            }
+        }
+    }
+}
+
+int main()
+{
+    static const AES_Backend backends[] = {
+        AES_Backend::Reference, AES_Backend::TTable, AES_Backend::AESNI,
+        AES_Backend::Bitsliced, AES_Backend::BitslicedSSE2, AES_Backend::BitslicedAVX2,
+        AES_Backend::TTableBitsliced
+    };
+
+    std::vector<byte> longResults;
+    bool first = true;
+    for (AES_Backend backend : backends)
+    {
+        if (!AES_SelectBackend(backend))
+            continue;
+        printf("testing %s\n", AES_BackendName());
+        TestCtr(AES_BackendName());
+        TestGcm(AES_BackendName());
+        TestGcmLong(AES_BackendName(), first, longResults);
+        TestSiv(AES_BackendName());
+        first = false;
+    }
+
+    if (failures != 0)
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,159 @@
+﻿//
+// AES-SIV (RFC 5297). See AES_SIV.h for the interface.
+//
+// S2V (Section 2.4), for associated data S1 ... Sn-1 and plaintext Sn:
+//   D = CMAC(K1, <zero>)
+//   for i = 1 to n-1: D = dbl(D) xor CMAC(K1, Si)
+//   if len(Sn) >= 128 bits: T = Sn xorend D
+//   else:                   T = dbl(D) xor pad(Sn)
+//   V = CMAC(K1, T)
+// Encryption is then C = CTR(K2, Q, P) with Q = V with bits 63 and 31
+// cleared (Section 2.6), the counter counting as a 128-bit integer.
+//
+// "Sn xorend D" only changes the last block of Sn, so the CMAC chain over
+// everything before it never waits for D.
+
+#include "AES_SIV.h"
+
+#include <cstring>
+
+// Plaintext processed per step of the fused CTR + CMAC decryption.
+static const size_t DECRYPT_CHUNK = 4096;
+
+// SivCounter: Q = V & 1^64 || 0^1 || 1^31 || 0^1 || 1^31.
+static void SivCounter(const byte V[16], byte Q[16])
+{
+    memcpy(Q, V, 16);
+    Q[8] &= 0x7f;
+    Q[12] &= 0x7f;
+}
+
+AesSivKey::AesSivKey(const byte* key, AES_KeySize keySize)
+    : macKey(key, keySize), ctrKey(key + (size_t)keySize, keySize)
+{
+}
+
+// S2VHead: D after the zero block and the associated data components.
+void AesSivKey::S2VHead(const CmacSegment* ad, size_t nAd, byte D[16]) const
+{
+    static const byte zero[16] = { 0 };
+    byte macs[MAX_AD_COMPONENTS + 1][16];
+    CmacJob jobs[MAX_AD_COMPONENTS + 1];
+
+    jobs[0] = { &macKey, zero, 16, 128, macs[0] };
+    for (size_t i = 0; i < nAd; i++)
+        jobs[i + 1] = { &macKey, ad[i].data, ad[i].len, 128, macs[i + 1] };
+    CMAC_Batch(jobs, nAd + 1);
+
+    memcpy(D, macs[0], 16);
+    for (size_t i = 0; i < nAd; i++)
+    {
+        DoubleBlock(D, D);
+        for (int j = 0; j < 16; j++)
+            D[j] ^= macs[i + 1][j];
+    }
+}
+
+// S2VShort: the last S2V step for a plaintext of less than 16 bytes.
+void AesSivKey::S2VShort(const byte D[16], const byte* plaintext, size_t len, byte V[16]) const
+{
+    byte T[16] = { 0 };
+    if (len > 0)
+        memcpy(T, plaintext, len);
+    T[len] = 0x80;
+
+    byte dbl[16];
+    DoubleBlock(D, dbl);
+    for (int j = 0; j < 16; j++)
+        T[j] ^= dbl[j];
+    macKey.Mac(T, 16, 128, V);
+}
+
+bool AesSivKey::Encrypt(const CmacSegment* ad, size_t nAd, const byte* plaintext, size_t len, byte* out) const
+{
+    if (nAd > MAX_AD_COMPONENTS)
+        return false;
+
+    byte D[16], V[16];
+    S2VHead(ad, nAd, D);
+    if (len >= 16)
+    {
+        byte last[16];
+        for (int j = 0; j < 16; j++)
+            last[j] = plaintext[len - 16 + j] ^ D[j];
+        CmacSegment T[2] = { { plaintext, len - 16 }, { last, 16 } };
+        macKey.Mac(T, 2, 128, V);
+    }
+    else
+    {
+        S2VShort(D, plaintext, len, V);
+    }
+
+    // V goes in front of the ciphertext, so writing it first would overwrite
+    // plaintext that out overlaps. Then move the plaintext into place and
+    // encrypt there, which also covers in-place use (out == plaintext).
+    byte Q[16];
+    SivCounter(V, Q);
+    uintptr_t o = (uintptr_t)out, p = (uintptr_t)plaintext;
+    if (len > 0 && o < p + len && p < o + 16 + len)
+    {
+        memmove(out + 16, plaintext, len);
+        ctrKey.Crypt(Q, out + 16, out + 16, len);
+    }
+    else
+    {
+        ctrKey.Crypt(Q, plaintext, out + 16, len);
+    }
+    memcpy(out, V, 16);
+    return true;
+}
+
+bool AesSivKey::Decrypt(const CmacSegment* ad, size_t nAd, const byte* in, size_t inLen, byte* plaintext) const
+{
+    if (nAd > MAX_AD_COMPONENTS || inLen < 16)
+        return false;
+
+    const byte* V = in;
+    const byte* C = in + 16;
+    size_t len = inLen - 16;
+
+    byte D[16], T[16], Q[16];
+    S2VHead(ad, nAd, D);
+    SivCounter(V, Q);
+
+    if (len >= 16)
+    {
+        // Decrypt a chunk, then chain it into the CMAC while it is in L1; the
+        // last 16 bytes wait for "xorend D".
+        CmacStream stream(macKey);
+        size_t head = len - 16;
+        for (size_t offset = 0; offset < len; offset += DECRYPT_CHUNK)
+        {
+            size_t n = len - offset < DECRYPT_CHUNK ? len - offset : DECRYPT_CHUNK;
+            ctrKey.Crypt(Q, C + offset, plaintext + offset, n);
+            if (offset < head)
+                stream.Update(plaintext + offset, head - offset < n ? head - offset : n);
+        }
+
+        byte last[16];
+        for (int j = 0; j < 16; j++)
+            last[j] = plaintext[head + j] ^ D[j];
+        stream.Update(last, 16);
+        stream.Final(128, T);
+    }
+    else
+    {
+        ctrKey.Crypt(Q, C, plaintext, len);
+        S2VShort(D, plaintext, len, T);
+    }
+
+    byte diff = 0;
+    for (int j = 0; j < 16; j++)
+        diff |= T[j] ^ V[j];
+    if (diff != 0)
+    {
+        memset(plaintext, 0, len);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+//
+// AES-SIV (RFC 5297): deterministic authenticated encryption from AES-CMAC and
+// AES-CTR.
+//
+
+#pragma once
+
+#include "AES_Modes.h"
+#include "CMAC.h"
+
+// AesSivKey: an AES-SIV key, with the CMAC half (K1, for S2V) and the CTR half
+// (K2) both precomputed.
+//
+// The same plaintext and associated data always give the same ciphertext, so
+// SIV suits key wrapping and deduplicated storage; add a nonce as the last
+// associated data component for ordinary nonce-based encryption.
+//
+// S2V computes the CMACs of the constant zero block and of every associated
+// data component as one CMAC_Batch, so short components share the multi-lane
+// kernel, and streams the plaintext through CmacStream. The CTR half encrypts
+// AES_MAX_LANES blocks per pass, so a whole SIV encryption costs one CMAC of
+// the plaintext plus a much cheaper CTR pass. Decryption runs CTR and CMAC over
+// the same chunk before moving on, so the plaintext is read back from L1.
+//
+// Immutable after construction and shareable between threads.
+class AesSivKey
+{
+public:
+    // At most 126 associated data components (RFC 5297, Section 2.6).
+    static const size_t MAX_AD_COMPONENTS = 126;
+
+    // key is 2 * keySize bytes: K1 (S2V) followed by K2 (CTR), so AES-SIV-256,
+    // -384 and -512 use AES_KeySize AES128, AES192 and AES256.
+    AesSivKey(const byte* key, AES_KeySize keySize);
+
+    // Encrypt: writes the synthetic IV V followed by the ciphertext, 16 + len
+    // bytes, to out. out may overlap plaintext, e.g. encrypt in place with
+    // out == plaintext in a buffer of 16 + len bytes. Returns false if nAd
+    // exceeds MAX_AD_COMPONENTS.
+    bool Encrypt(const CmacSegment* ad, size_t nAd, const byte* plaintext, size_t len, byte* out) const;
+
+    // Decrypt: decrypts V || C (inLen >= 16 bytes) into inLen - 16 bytes of
+    // plaintext and checks V in constant time. Returns false, with plaintext
+    // zeroed, if V does not match. The buffers must not overlap.
+    bool Decrypt(const CmacSegment* ad, size_t nAd, const byte* in, size_t inLen, byte* plaintext) const;
+
+private:
+    void S2VHead(const CmacSegment* ad, size_t nAd, byte D[16]) const;
+    void S2VShort(const byte D[16], const byte* plaintext, size_t len, byte V[16]) const;
+
+    CmacKey macKey;
+    AesCtrKey ctrKey;
+};
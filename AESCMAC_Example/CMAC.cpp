@@ -0,0 +1,453 @@
+﻿//
+// This implementation of CMAC is based on NIST SP 800-38B,
+// “Recommendation for Block Cipher Modes of Operation: The CMAC Mode for Authentication”.
+// It uses AES-128, AES-192 or AES-256 as the underlying block cipher.
+//
+// Steps:
+//  1. Generate subkeys K1 and K2 from key K by encrypting a 0-block,
+//     then left-shifting and conditionally XORing with Rb (for AES, Rb = 0x87).
+//  2. Format the input message M: partition M into 16-byte blocks;
+//     if the last block is complete, XOR it with K1, else pad (with 0x80 followed by zeros)
+//     and XOR with K2.
+//  3. Compute C0 = 0^128, then for i = 1 to n, compute Ci = AES_Encrypt( Ci-1 + Mi ).
+//  4. The MAC T is the most-significant Tlen bits of Cn.
+//
+// Step 1 depends only on the key; CmacKey performs it once and reuses the
+// result for every message.
+
+#include "CMAC.h"
+#include "CMAC_Stats.h"
+
+#include <cstring>
+
+// ---------------------- CMAC Implementation ----------------------
+
+// LeftShiftBlock: left shifts a 16-byte block by one bit (in may equal out).
+static void LeftShiftBlock(const byte in[16], byte out[16])
+{
+    byte carry = 0;
+    for (int i = 15; i >= 0; i--)
+    {
+        byte next = in[i] >> 7;
+        out[i] = (byte)((in[i] << 1) | carry);
+        carry = next;
+    }
+}
+
+// XorBlocks: XORs two 16-byte blocks (out = a xor b).
+static void XorBlocks(const byte a[16], const byte b[16], byte out[16])
+{
+    for (int i = 0; i < 16; i++)
+        out[i] = a[i] ^ b[i];
+}
+
+// DoubleBlock: the doubling of steps 2 and 3 of Section 6.1. The conditional
+// XOR with Rb is done with a mask, so the timing does not depend on the MSB.
+void DoubleBlock(const byte in[16], byte out[16])
+{
+    byte rb = (byte)(0x87 & (0 - (in[0] >> 7)));
+    LeftShiftBlock(in, out);
+    out[15] ^= rb;
+}
+
+// GenerateSubkeys from an already expanded key (Section 6.1 of NIST SP 800-38B).
+// AES has b = 128 for every key size, so the constant Rb is 0x87.
+static void GenerateSubkeys(const AES_Cipher& cipher, const AES_RoundKeys& roundKeys, byte K1[16], byte K2[16])
+{
+    byte L[16] = { 0 };
+    byte zeroBlock[16] = { 0 };
+    // Step 1: L = CIPHK(0^128). Through encryptBlocks, which is constant-time
+    // on every engine that has a constant-time kernel.
+    cipher.encryptBlocks(roundKeys, zeroBlock, L, 1);
+
+    // Step 2: K1 = L << 1, xor Rb if MSB(L) = 1.
+    DoubleBlock(L, K1);
+    // Step 3: K2 = K1 << 1, xor Rb if MSB(K1) = 1.
+    DoubleBlock(K1, K2);
+
+    SecureZero(L, sizeof(L));
+}
+
+// GenerateSubkeys: Implements the subkey generation (Section 6.1 of NIST SP 800-38B).
+template <size_t KeyBits>
+void GenerateSubkeys(const byte* key, byte K1[16], byte K2[16])
+{
+    const AES_Engine& engine = AES_GetEngine();
+    const AES_Cipher& cipher = engine.Cipher(AES_Params<KeyBits>::keySize);
+    CMAC_STATS_COUNT(SubkeyOnly, 1);
+    CMAC_STATS_BLOCKS(engine, 1);
+    AES_RoundKeys roundKeys;
+    CMAC_ExpandKey(cipher, key, roundKeys);
+    GenerateSubkeys(cipher, roundKeys, K1, K2);
+    SecureZero(&roundKeys, sizeof(roundKeys));
+}
+
+template void GenerateSubkeys<128>(const byte* key, byte K1[16], byte K2[16]);
+template void GenerateSubkeys<192>(const byte* key, byte K1[16], byte K2[16]);
+template void GenerateSubkeys<256>(const byte* key, byte K1[16], byte K2[16]);
+
+void GenerateSubkeys(const byte key[16], byte K1[16], byte K2[16])
+{
+    GenerateSubkeys<128>(key, K1, K2);
+}
+
+// FormatLastBlock: step 3 of Section 6.2. Formats the last block Mn (lastLen
+// bytes, 0 to 16): complete blocks are XORed with K1, partial ones padded and
+// XORed with K2.
+static void FormatLastBlock(const byte K1[16], const byte K2[16], const byte* last, size_t lastLen, byte M_last[16])
+{
+    memset(M_last, 0, 16);
+    if (lastLen == 16)
+    {
+        // If the last block is complete, set M_last = Mn xor K1.
+        memcpy(M_last, last, 16);
+        XorBlocks(M_last, K1, M_last);
+    }
+    else
+    {
+        // Otherwise, pad the last block: append '1' bit (0x80) then zeros,
+        // and set M_last = (Mn* || padding) + K2.
+        if (lastLen > 0)
+        {
+            memcpy(M_last, last, lastLen);
+        }
+        M_last[lastLen] = 0x80;
+        XorBlocks(M_last, K2, M_last);
+    }
+}
+
+// ProcessLastBlock: steps 3 and 6 of Section 6.2. Formats the last block and
+// computes Cn = CIPHK(Cn-1 + Mn) into X.
+static void ProcessLastBlock(const AES_Cipher& cipher, const AES_RoundKeys& roundKeys, const byte K1[16], const byte K2[16],
+                             const byte* last, size_t lastLen, byte X[16])
+{
+    byte M_last[16];
+    FormatLastBlock(K1, K2, last, lastLen, M_last);
+    cipher.cbcMac(roundKeys, X, M_last, 1);
+}
+
+// ComputeMac: steps 2-6 of Section 6.2 with precomputed round keys and subkeys.
+// Leaves the full 128-bit MAC in X.
+static void ComputeMac(const AES_Cipher& cipher, const AES_RoundKeys& roundKeys, const byte K1[16], const byte K2[16],
+                       const byte* message, size_t messageLen, byte X[16])
+{
+    // 2. Let n = ceil(messageLen / 128). If message is empty, set n = 1.
+    size_t n = (messageLen + 15) / 16;
+    if (messageLen == 0)
+    {
+        n = 1;
+    }
+
+    // 4. Initialize C0 = 0^128.
+    memset(X, 0, 16);
+
+    // 5. For i = 1 to n-1, compute Ci = CIPHK(Ci-1 + Mi).
+    cipher.cbcMac(roundKeys, X, message, n - 1);
+
+    // 3 and 6. Pad and process the last block.
+    ProcessLastBlock(cipher, roundKeys, K1, K2, message + (n - 1) * 16, messageLen - (n - 1) * 16, X);
+}
+
+// TruncateMac: If Tlen < 128, truncate the MAC to its Tlen most significant bits.
+// (If Tlen is not a multiple of 8, the last byte is masked appropriately.)
+static void TruncateMac(byte mac[16], int Tlen)
+{
+    int fullBytes = Tlen / 8;
+    int remBits = Tlen % 8;
+    if (Tlen < 128)
+    {
+        // Keep the partial byte (if any) and clear everything after it.
+        for (int i = fullBytes + (remBits != 0 ? 1 : 0); i < 16; i++)
+        {
+            mac[i] = 0;
+        }
+        if (remBits != 0)
+        {
+            mac[fullBytes] &= (0xFF << (8 - remBits));
+        }
+    }
+}
+
+// CMAC: Computes the CMAC of message M using key K.
+// This follows the steps in Section 6.2 of NIST SP 800-38B.
+template <size_t KeyBits>
+void CMAC(const byte* key, const byte* message, size_t messageLen, int Tlen, byte mac[16])
+{
+    CMAC_STATS_TIME(OneShot);
+    // 1. Expand the key and generate subkeys K1 and K2 (once per call).
+    CmacKey cmacKey(key, AES_Params<KeyBits>::keySize);
+    cmacKey.Mac(message, messageLen, Tlen, mac);
+}
+
+template void CMAC<128>(const byte* key, const byte* message, size_t messageLen, int Tlen, byte mac[16]);
+template void CMAC<192>(const byte* key, const byte* message, size_t messageLen, int Tlen, byte mac[16]);
+template void CMAC<256>(const byte* key, const byte* message, size_t messageLen, int Tlen, byte mac[16]);
+
+void CMAC(const byte key[16], const byte* message, size_t messageLen, int Tlen, byte mac[16])
+{
+    CMAC<128>(key, message, messageLen, Tlen, mac);
+}
+
+void CMAC(const byte key[16], const CmacSegment* segments, size_t nSegments, int Tlen, byte mac[16])
+{
+    CmacKey cmacKey(key);
+    cmacKey.Mac(segments, nSegments, Tlen, mac);
+}
+
+// ---------------------- CmacKey ----------------------
+
+CmacKey::CmacKey(const byte key[16])
+    : CmacKey(key, AES_KeySize::AES128)
+{
+}
+
+CmacKey::CmacKey(const byte* key, AES_KeySize keySize)
+    : engine(&AES_GetEngine()), cipher(&engine->Cipher(keySize))
+{
+    CMAC_STATS_TIME(KeySetup);
+    CMAC_STATS_COUNT(KeySetups, 1);
+    CMAC_STATS_BLOCKS(*engine, 1);
+    CMAC_ExpandKey(*cipher, key, roundKeys);
+    GenerateSubkeys(*cipher, roundKeys, K1, K2);
+}
+
+CmacKey::~CmacKey()
+{
+    SecureZero(&roundKeys, sizeof(roundKeys));
+    SecureZero(K1, sizeof(K1));
+    SecureZero(K2, sizeof(K2));
+}
+
+void CmacKey::Mac(const byte* message, size_t messageLen, int Tlen, byte mac[16]) const
+{
+    CMAC_STATS_TIME(Mac);
+    CMAC_STATS_COUNT(Macs, 1);
+    CMAC_STATS_COUNT(MacBytes, messageLen);
+    CMAC_STATS_BLOCKS(*engine, messageLen == 0 ? 1 : (messageLen + 15) / 16);
+    ComputeMac(*cipher, roundKeys, K1, K2, message, messageLen, mac);
+    TruncateMac(mac, Tlen);
+}
+
+// The segments go through CmacStream, whose Update() already chains full blocks
+// from the caller's buffer and holds back the last 1 to 16 bytes, which is what
+// makes a final partial block split across two segments come out right.
+void CmacKey::Mac(const CmacSegment* segments, size_t nSegments, int Tlen, byte mac[16]) const
+{
+    CmacStream stream(*this);
+    for (size_t i = 0; i < nSegments; i++)
+        stream.Update(segments[i].data, segments[i].len);
+    stream.Final(Tlen, mac);
+}
+
+bool CmacKey::Verify(const byte* message, size_t messageLen, const byte* mac, int Tlen) const
+{
+    if (Tlen < 1 || Tlen > 128)
+        return false;
+
+    byte expected[16];
+    Mac(message, messageLen, Tlen, expected);
+
+    // Accumulate the differences over all Tlen bits so the running time does
+    // not depend on where the first mismatch is.
+    int fullBytes = Tlen / 8;
+    int remBits = Tlen % 8;
+    byte diff = 0;
+    for (int i = 0; i < fullBytes; i++)
+        diff |= expected[i] ^ mac[i];
+    if (remBits != 0)
+        diff |= (expected[fullBytes] ^ mac[fullBytes]) & (byte)(0xFF << (8 - remBits));
+
+    return diff == 0;
+}
+
+// ---------------------- CmacStream ----------------------
+
+CmacStream::CmacStream(const CmacKey& key)
+    : key(&key)
+{
+    Init();
+}
+
+CmacStream::~CmacStream()
+{
+    SecureZero(X, sizeof(X));
+    SecureZero(buffer, sizeof(buffer));
+}
+
+void CmacStream::Init()
+{
+    memset(X, 0, 16);
+    bufferLen = 0;
+}
+
+void CmacStream::Update(const byte* data, size_t len)
+{
+    if (len == 0)
+        return;
+
+    const AES_Cipher& cipher = *key->cipher;
+    CMAC_STATS_COUNT(MacBytes, len);
+
+    // Top up the held-back block. It is only chained once more input follows,
+    // because until then it may still be the last block.
+    if (bufferLen > 0)
+    {
+        size_t take = 16 - bufferLen;
+        if (take > len)
+            take = len;
+        memcpy(buffer + bufferLen, data, take);
+        bufferLen += take;
+        data += take;
+        len -= take;
+        if (len == 0)
+            return;
+        cipher.cbcMac(key->roundKeys, X, buffer, 1);
+        CMAC_STATS_BLOCKS(*key->engine, 1);
+        bufferLen = 0;
+    }
+
+    // Chain full blocks straight from the caller's buffer, holding back the
+    // final 1 to 16 bytes.
+    size_t nBlocks = (len - 1) / 16;
+    cipher.cbcMac(key->roundKeys, X, data, nBlocks);
+    CMAC_STATS_BLOCKS(*key->engine, nBlocks);
+    data += nBlocks * 16;
+    len -= nBlocks * 16;
+
+    memcpy(buffer, data, len);
+    bufferLen = len;
+}
+
+void CmacStream::Final(int Tlen, byte mac[16])
+{
+    CMAC_STATS_COUNT(Macs, 1);
+    CMAC_STATS_BLOCKS(*key->engine, 1);
+    ProcessLastBlock(*key->cipher, key->roundKeys, key->K1, key->K2, buffer, bufferLen, X);
+    memcpy(mac, X, 16);
+    TruncateMac(mac, Tlen);
+    Init();
+}
+
+// ---------------------- CMAC Batch ----------------------
+//
+// Each lane runs one job: its message blocks M1..Mn-1 followed by the formatted
+// last block, which is just one more CBC step. All lanes advance in lockstep
+// until the shortest one finishes its current segment; finished lanes write
+// their tag and are refilled from the job list.
+
+struct CmacLane
+{
+    const CmacJob* job;
+    const byte* next;       // Next input block of the current segment.
+    size_t remaining;       // Blocks left in the current segment.
+    bool inLastBlock;       // Current segment is M_last.
+    byte X[16];
+    byte M_last[16];
+};
+
+// Starts job on lane: queues M1..Mn-1 (if any), then M_last.
+static void StartLane(CmacLane& lane, const CmacJob& job, const byte K1[16], const byte K2[16])
+{
+    size_t n = (job.messageLen + 15) / 16;
+    if (n == 0)
+        n = 1;
+
+    lane.job = &job;
+    memset(lane.X, 0, 16);
+    FormatLastBlock(K1, K2, job.message + (n - 1) * 16, job.messageLen - (n - 1) * 16, lane.M_last);
+    if (n > 1)
+    {
+        lane.next = job.message;
+        lane.remaining = n - 1;
+        lane.inLastBlock = false;
+    }
+    else
+    {
+        lane.next = lane.M_last;
+        lane.remaining = 1;
+        lane.inLastBlock = true;
+    }
+}
+
+void CMAC_Batch(const CmacJob* jobs, size_t nJobs)
+{
+    if (nJobs == 0)
+        return;
+
+    const AES_Engine& engine = *jobs[0].key->engine;
+    const AES_Cipher& cipher = *jobs[0].key->cipher;
+    size_t maxLanes = engine.lanes < AES_MAX_LANES ? engine.lanes : AES_MAX_LANES;
+    CMAC_STATS_COUNT(BatchCalls, 1);
+
+    CmacLane lanes[AES_MAX_LANES];
+    size_t active = 0;
+    size_t nextJob = 0;
+
+    const AES_RoundKeys* rk[AES_MAX_LANES];
+    byte* X[AES_MAX_LANES];
+    const byte* blocks[AES_MAX_LANES];
+
+    for (;;)
+    {
+        // Refill free lanes. Keys expanded for another engine or key size cannot
+        // share the lane kernel, so they take the single-message path.
+        while (active < maxLanes && nextJob < nJobs)
+        {
+            const CmacJob& job = jobs[nextJob++];
+            if (job.key->cipher != &cipher)
+            {
+                job.key->Mac(job.message, job.messageLen, job.Tlen, job.mac);
+                continue;
+            }
+            StartLane(lanes[active++], job, job.key->K1, job.key->K2);
+            CMAC_STATS_COUNT(Macs, 1);
+            CMAC_STATS_COUNT(MacBytes, job.messageLen);
+        }
+        if (active == 0)
+            break;
+
+        // Advance every lane until the shortest current segment ends.
+        size_t step = lanes[0].remaining;
+        for (size_t l = 1; l < active; l++)
+        {
+            if (lanes[l].remaining < step)
+                step = lanes[l].remaining;
+        }
+        for (size_t l = 0; l < active; l++)
+        {
+            rk[l] = &lanes[l].job->key->roundKeys;
+            X[l] = lanes[l].X;
+            blocks[l] = lanes[l].next;
+        }
+        cipher.cbcMacLanes(rk, X, blocks, step, active);
+        CMAC_STATS_COUNT(LaneSteps, 1);
+        CMAC_STATS_COUNT(LaneBlocks, step * active);
+        CMAC_STATS_COUNT(LaneSlots, step * maxLanes);
+        CMAC_STATS_BLOCKS(engine, step * active);
+
+        for (size_t l = 0; l < active; )
+        {
+            CmacLane& lane = lanes[l];
+            lane.next += step * 16;
+            lane.remaining -= step;
+            if (lane.remaining > 0)
+            {
+                l++;
+            }
+            else if (!lane.inLastBlock)
+            {
+                lane.next = lane.M_last;
+                lane.remaining = 1;
+                lane.inLastBlock = true;
+                l++;
+            }
+            else
+            {
+                memcpy(lane.job->mac, lane.X, 16);
+                TruncateMac(lane.job->mac, lane.job->Tlen);
+                SecureZero(lane.M_last, 16);
+                lanes[l] = lanes[--active];
+            }
+        }
+    }
+}
@@ -0,0 +1,135 @@
+//
+// AES-CMAC (NIST SP 800-38B, RFC 4493) with 128, 192 or 256-bit AES keys.
+//
+
+#pragma once
+
+#include "AES.h"
+
+// CMAC: Computes the CMAC of message M using the AES-128 key K.
+// Tlen is the desired output MAC length in bits (Tlen ≤ 128); the bytes of mac
+// beyond Tlen are zeroed.
+void CMAC(const byte key[16], const byte* message, size_t messageLen, int Tlen, byte mac[16]);
+
+// CMAC<KeyBits>: the same with a KeyBits-bit AES key (128, 192 or 256), e.g.
+// CMAC<256>(key, message, messageLen, 128, mac).
+template <size_t KeyBits>
+void CMAC(const byte* key, const byte* message, size_t messageLen, int Tlen, byte mac[16]);
+
+// GenerateSubkeys: derives the CMAC subkeys K1 and K2 from the AES-128 key K (Section 6.1).
+void GenerateSubkeys(const byte key[16], byte K1[16], byte K2[16]);
+
+template <size_t KeyBits>
+void GenerateSubkeys(const byte* key, byte K1[16], byte K2[16]);
+
+// DoubleBlock: multiplies a block by x in GF(2^128), out = (in << 1) xor
+// (MSB(in) ? Rb : 0), with Rb = 0x87. This is how K1 and K2 are derived, and
+// the dbl() of RFC 5297 S2V. in and out may be the same block.
+void DoubleBlock(const byte in[16], byte out[16]);
+
+// CmacSegment: one piece of a message given as a list of segments (like struct
+// iovec). The message is the concatenation of the segments in order; segments
+// may have any length, including zero.
+struct CmacSegment
+{
+    const byte* data;
+    size_t len;
+};
+
+// CMAC: the same for a message given as nSegments segments, e.g. a frame header
+// followed by its payload fragments. Produces the same tag as the concatenated
+// message without copying it into one buffer.
+void CMAC(const byte key[16], const CmacSegment* segments, size_t nSegments, int Tlen, byte mac[16]);
+
+// CmacKey: a CMAC key with its AES round keys and subkeys K1/K2 precomputed.
+//
+// Construction does all per-key work (one key expansion and one block
+// encryption); Mac() and Verify() then only process the message. The object is
+// immutable after construction, so one instance can be shared by any number of
+// threads. The schedule is tied to the AES engine active at construction.
+// Key material is wiped when the object is destroyed.
+class CmacKey
+{
+public:
+    // An AES-128 key.
+    explicit CmacKey(const byte key[16]);
+    // A key of keySize (16, 24 or 32 bytes).
+    CmacKey(const byte* key, AES_KeySize keySize);
+    ~CmacKey();
+
+    CmacKey(const CmacKey&) = default;
+    CmacKey& operator=(const CmacKey&) = default;
+
+    // Mac: computes the Tlen-bit MAC of message (same output as CMAC()).
+    void Mac(const byte* message, size_t messageLen, int Tlen, byte mac[16]) const;
+
+    // Mac: computes the Tlen-bit MAC of the concatenation of nSegments segments.
+    // Full blocks are read in place from each segment; only a block that spans
+    // a segment boundary is assembled in a 16-byte buffer.
+    void Mac(const CmacSegment* segments, size_t nSegments, int Tlen, byte mac[16]) const;
+
+    // Verify: recomputes the MAC and compares its Tlen most significant bits with
+    // mac in constant time. mac must hold at least (Tlen + 7) / 8 bytes.
+    bool Verify(const byte* message, size_t messageLen, const byte* mac, int Tlen) const;
+
+    AES_KeySize KeySize() const { return (AES_KeySize)cipher->keyBytes; }
+    // Engine: the AES engine the key was expanded for.
+    const AES_Engine& Engine() const { return *engine; }
+
+private:
+    friend class CmacStream;
+    friend void CMAC_Batch(const struct CmacJob* jobs, size_t nJobs);
+
+    const AES_Engine* engine;
+    const AES_Cipher* cipher;   // engine's functions for this key size.
+    AES_RoundKeys roundKeys;
+    byte K1[16];
+    byte K2[16];
+};
+
+// CmacStream: incremental CMAC over input supplied in arbitrary chunks.
+//
+//   CmacStream s(key);            // init
+//   s.Update(chunk, chunkLen);    // any number of times, any chunk sizes
+//   s.Final(Tlen, mac);           // same tag as key.Mac(whole message, ...)
+//
+// Only the last (possibly complete) block is buffered, since whether it is
+// XORed with K1 or padded and XORed with K2 is only known at Final(). Final()
+// resets the stream for the next message. The CmacKey must outlive the stream.
+class CmacStream
+{
+public:
+    explicit CmacStream(const CmacKey& key);
+    ~CmacStream();
+
+    void Init();
+    void Update(const byte* data, size_t len);
+    void Final(int Tlen, byte mac[16]);
+
+private:
+    const CmacKey* key;
+    byte X[16];          // Chaining value Ci.
+    byte buffer[16];     // Held-back last block.
+    size_t bufferLen;
+};
+
+// CmacJob: one message for CMAC_Batch. mac receives the Tlen-bit tag as CMAC() would.
+struct CmacJob
+{
+    const CmacKey* key;
+    const byte* message;
+    size_t messageLen;
+    int Tlen;
+    byte* mac;
+};
+
+// CMAC_Batch: computes the MACs of nJobs independent messages.
+//
+// CMAC is serial within one message, so a single chain leaves the AES unit idle
+// while each block waits for the previous one. The batch runs up to
+// AES_Engine::lanes messages side by side (8 with AES-NI, 4, 8 or 16 with the
+// bitsliced engines, 4 with T-table), each lane with its own key, length and
+// K1/K2 finalization, and refills a lane as soon as its message is done. Lanes
+// share the key size of the first job; jobs with another key size are
+// processed one at a time.
+void CMAC_Batch(const CmacJob* jobs, size_t nJobs);
@@ -0,0 +1,691 @@
+﻿//
+// Benchmark for the AES engines and CMAC.
+//
+// For every backend supported by the CPU it measures key expansion, single
+// block encryption, GenerateSubkeys and CMAC over message sizes from 0 bytes to
+// 1 MiB, in these modes:
+//   oneshot   CMAC() per message (includes the per-key work)
+//   single    CmacKey::Mac() per message, key prepared once
+//   batch     CMAC_Batch() over many messages with different keys
+//   parallel  CmacBatchService::Run() with --threads threads (if > 1), once
+//             per count when --threads is a list such as 1,2,4,8
+//
+// The kdf operation derives 32-byte keys with the SP 800-108 CMAC KDF: oneshot
+// calls CMAC() per PRF block, single calls CMAC_KDF() with the master key
+// prepared once, batch runs CMAC_KDF_Batch() over 1024 derivations.
+//
+// The keycache operation MACs 64-byte messages for 4096 keys, picked with a
+// skew towards low key IDs: oneshot calls CMAC() with the raw key, cached goes
+// through a CmacKeyCache with room for every key, and churn through one that
+// holds an eighth of them (its hit rate is printed on stderr).
+//
+// It also measures AES-CTR, AES-GCM and AES-SIV encryption (operations ctr,
+// gcm and siv) over 1 KiB, 16 KiB and 1 MiB messages.
+//
+// For one large object (--tree-size bytes, 64 MiB by default) it compares the
+// serial CMAC chain with CmacTreeKey over 1 MiB leaves, on one thread and on
+// each --threads count.
+//
+// Every measurement is repeated until it has run for --min-time-ms.
+// Cycles are TSC ticks (x86 only), so they track wall time at the TSC frequency
+// rather than core cycles under turbo.
+//
+// Usage: cmac_bench [--format=text|csv|json] [--min-time-ms=N] [--max-size=N]
+//                   [--threads=N[,N...]] [--backend=NAME] [--key-bits=128|192|256]
+//                   [--tree-size=N] [--stats]
+//
+// --stats prints the CMAC_Stats.h counters, summed over the whole run, as JSON
+// on stderr (all zero unless built with AESCMAC_INSTRUMENT).
+
+#include "AES_Modes.h"
+#include "AES_SIV.h"
+#include "CMAC.h"
+#include "CMAC_KDF.h"
+#include "CMAC_KeyCache.h"
+#include "CMAC_Parallel.h"
+#include "CMAC_Stats.h"
+#include "CMAC_Tree.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define BENCH_HAVE_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// ---------------------- Measurement ----------------------
+
+struct BenchOptions
+{
+    std::string format = "text";
+    double minTimeMs = 50;
+    size_t maxSize = 1 << 20;
+    std::vector<size_t> threads = { 0 };    // Thread counts for the parallel modes.
+    std::string backend;
+    AES_KeySize keySize = AES_KeySize::AES128;
+    size_t treeSize = 64 << 20;
+    bool stats = false;
+};
+
+struct BenchResult
+{
+    std::string backend;
+    size_t keyBits;
+    std::string operation;
+    std::string mode;
+    size_t bytes;            // Bytes processed per call.
+    size_t threads;
+    unsigned long long calls;
+    double nsPerCall;
+    double cyclesPerCall;    // NAN without a TSC.
+};
+
+// Keeps results alive so the compiler cannot drop the measured work.
+static volatile byte sink;
+
+static unsigned long long ReadCycles()
+{
+#ifdef BENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Measure: calls run(n) with n doubling until one run takes at least minTimeMs.
+// Each iteration of run() counts as callsPerIteration calls (the number of
+// messages in a batch, 1 otherwise).
+template <typename Run>
+static void Measure(const BenchOptions& options, Run run, size_t callsPerIteration, BenchResult& result)
+{
+    run(1); // Warm up caches and branch predictors.
+
+    for (unsigned long long n = 1; ; n *= 2)
+    {
+        auto start = std::chrono::steady_clock::now();
+        unsigned long long startCycles = ReadCycles();
+        run(n);
+        unsigned long long cycles = ReadCycles() - startCycles;
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        if (ns >= options.minTimeMs * 1e6 || n >= (1ull << 40))
+        {
+            result.calls = n * callsPerIteration;
+            result.nsPerCall = ns / (double)result.calls;
+#ifdef BENCH_HAVE_TSC
+            result.cyclesPerCall = (double)cycles / (double)result.calls;
+#else
+            (void)cycles;
+            result.cyclesPerCall = NAN;
+#endif
+            return;
+        }
+    }
+}
+
+// ---------------------- Benchmarks ----------------------
+
+static void FillPattern(byte* p, size_t len, unsigned seed)
+{
+    uint32_t x = seed * 2654435761u + 1;
+    for (size_t i = 0; i < len; i++)
+    {
+        x = x * 1103515245u + 12345u;
+        p[i] = (byte)(x >> 24);
+    }
+}
+
+// The key-size templates behind a run-time key size.
+static void GenerateSubkeysFor(AES_KeySize keySize, const byte* key, byte K1[16], byte K2[16])
+{
+    switch (keySize)
+    {
+    case AES_KeySize::AES128: GenerateSubkeys<128>(key, K1, K2); break;
+    case AES_KeySize::AES192: GenerateSubkeys<192>(key, K1, K2); break;
+    case AES_KeySize::AES256: GenerateSubkeys<256>(key, K1, K2); break;
+    }
+}
+
+static void CmacFor(AES_KeySize keySize, const byte* key, const byte* message, size_t messageLen, byte mac[16])
+{
+    switch (keySize)
+    {
+    case AES_KeySize::AES128: CMAC<128>(key, message, messageLen, 128, mac); break;
+    case AES_KeySize::AES192: CMAC<192>(key, message, messageLen, 128, mac); break;
+    case AES_KeySize::AES256: CMAC<256>(key, message, messageLen, 128, mac); break;
+    }
+}
+
+static void BenchPrimitives(const BenchOptions& options, const AES_Engine& engine, std::vector<BenchResult>& results)
+{
+    const AES_Cipher& cipher = engine.Cipher(options.keySize);
+    size_t keyBits = cipher.keyBytes * 8;
+    byte key[32];
+    FillPattern(key, sizeof(key), 1);
+    AES_RoundKeys rk;
+    cipher.expandKey(key, rk);
+
+    BenchResult r = { engine.name, keyBits, "key_expansion", "single", cipher.keyBytes, 1, 0, 0, 0 };
+    Measure(options, [&](unsigned long long n)
+        {
+            for (unsigned long long i = 0; i < n; i++)
+            {
+                key[0] = (byte)i;
+                cipher.expandKey(key, rk);
+            }
+            sink = rk.bytes[16 * cipher.rounds];
+        }, 1, r);
+    results.push_back(r);
+
+    // Each block depends on the previous one, so this is the latency of one call.
+    byte block[16] = { 0 };
+    r = { engine.name, keyBits, "encrypt_block", "single", 16, 1, 0, 0, 0 };
+    Measure(options, [&](unsigned long long n)
+        {
+            for (unsigned long long i = 0; i < n; i++)
+                cipher.encrypt(block, block, rk);
+            sink = block[0];
+        }, 1, r);
+    results.push_back(r);
+
+    byte K1[16], K2[16];
+    r = { engine.name, keyBits, "generate_subkeys", "single", cipher.keyBytes, 1, 0, 0, 0 };
+    Measure(options, [&](unsigned long long n)
+        {
+            for (unsigned long long i = 0; i < n; i++)
+            {
+                key[0] = (byte)i;
+                GenerateSubkeysFor(options.keySize, key, K1, K2);
+            }
+            sink = K2[15];
+        }, 1, r);
+    results.push_back(r);
+}
+
+static void BenchCmac(const BenchOptions& options, const AES_Engine& engine, std::vector<BenchResult>& results)
+{
+    static const size_t sizes[] = { 0, 16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576 };
+    const size_t nKeys = 16;
+    size_t keyBits = (size_t)options.keySize * 8;
+
+    byte rawKeys[nKeys][32];
+    std::vector<CmacKey> keys;
+    for (size_t k = 0; k < nKeys; k++)
+    {
+        FillPattern(rawKeys[k], 32, (unsigned)k + 100);
+        keys.emplace_back(rawKeys[k], options.keySize);
+    }
+
+    std::vector<std::unique_ptr<CmacBatchService>> services;
+    for (size_t threads : options.threads)
+        services.emplace_back(new CmacBatchService(threads));
+
+    for (size_t size : sizes)
+    {
+        if (size > options.maxSize)
+            break;
+
+        // Enough messages to keep every lane busy, about 1 MiB per batch.
+        size_t nJobs = (1 << 20) / (size > 1024 ? size : 1024);
+        if (nJobs < AES_MAX_LANES * 2)
+            nJobs = AES_MAX_LANES * 2;
+
+        std::vector<byte> data(size * nJobs + 1);
+        FillPattern(data.data(), data.size(), (unsigned)size);
+        std::vector<byte> macs(16 * nJobs);
+        std::vector<CmacJob> jobs(nJobs);
+        for (size_t j = 0; j < nJobs; j++)
+            jobs[j] = { &keys[j % nKeys], data.data() + j * size, size, 128, macs.data() + 16 * j };
+
+        byte mac[16];
+        BenchResult r = { engine.name, keyBits, "cmac", "oneshot", size, 1, 0, 0, 0 };
+        Measure(options, [&](unsigned long long n)
+            {
+                for (unsigned long long i = 0; i < n; i++)
+                    CmacFor(options.keySize, rawKeys[i % nKeys], data.data(), size, mac);
+                sink = mac[0];
+            }, 1, r);
+        results.push_back(r);
+
+        r = { engine.name, keyBits, "cmac", "single", size, 1, 0, 0, 0 };
+        Measure(options, [&](unsigned long long n)
+            {
+                for (unsigned long long i = 0; i < n; i++)
+                    keys[i % nKeys].Mac(data.data(), size, 128, mac);
+                sink = mac[0];
+            }, 1, r);
+        results.push_back(r);
+
+        r = { engine.name, keyBits, "cmac", "batch", size, 1, 0, 0, 0 };
+        Measure(options, [&](unsigned long long n)
+            {
+                for (unsigned long long i = 0; i < n; i++)
+                    CMAC_Batch(jobs.data(), nJobs);
+                sink = macs[0];
+            }, nJobs, r);
+        results.push_back(r);
+
+        for (const auto& service : services)
+        {
+            if (service->Threads() <= 1)
+                continue;
+            r = { engine.name, keyBits, "cmac", "parallel", size, service->Threads(), 0, 0, 0 };
+            Measure(options, [&](unsigned long long n)
+                {
+                    for (unsigned long long i = 0; i < n; i++)
+                        service->Run(jobs.data(), nJobs);
+                    sink = macs[0];
+                }, nJobs, r);
+            results.push_back(r);
+        }
+    }
+}
+
+static void BenchKdf(const BenchOptions& options, const AES_Engine& engine, std::vector<BenchResult>& results)
+{
+    const size_t nRequests = 1024;
+    const size_t outLen = 32;
+    size_t keyBits = (size_t)options.keySize * 8;
+
+    byte rawKey[32];
+    FillPattern(rawKey, sizeof(rawKey), 11);
+    CmacKey master(rawKey, options.keySize);
+
+    static const byte label[] = "session key";
+    std::vector<byte> contexts(32 * nRequests);
+    FillPattern(contexts.data(), contexts.size(), 12);
+    std::vector<KdfRequest> requests(nRequests);
+    for (size_t i = 0; i < nRequests; i++)
+        requests[i] = { label, sizeof(label) - 1, &contexts[32 * i], 32, outLen };
+    std::vector<byte> arena(outLen * nRequests);
+
+    // The PRF input of block i, formatted by hand for the CMAC() baseline.
+    byte input[4 + sizeof(label) + 32 + 4] = { 0 };
+    memcpy(input + 4, label, sizeof(label) - 1);
+    input[4 + sizeof(label) - 1] = 0x00;
+    input[sizeof(input) - 2] = (byte)((outLen * 8) >> 8);
+    input[sizeof(input) - 1] = (byte)(outLen * 8);
+
+    BenchResult r = { engine.name, keyBits, "kdf", "oneshot", outLen, 1, 0, 0, 0 };
+    Measure(options, [&](unsigned long long n)
+        {
+            for (unsigned long long i = 0; i < n; i++)
+            {
+                memcpy(input + 4 + sizeof(label), &contexts[32 * (i % nRequests)], 32);
+                for (byte block = 1; block <= 2; block++)
+                {
+                    input[3] = block;
+                    CmacFor(options.keySize, rawKey, input, sizeof(input), &arena[16 * (block - 1)]);
+                }
+            }
+            sink = arena[0];
+        }, 1, r);
+    results.push_back(r);
+
+    r = { engine.name, keyBits, "kdf", "single", outLen, 1, 0, 0, 0 };
+    Measure(options, [&](unsigned long long n)
+        {
+            for (unsigned long long i = 0; i < n; i++)
+            {
+                const KdfRequest& request = requests[i % nRequests];
+                CMAC_KDF(master, request.label, request.labelLen, request.context, request.contextLen, arena.data(), outLen);
+            }
+            sink = arena[0];
+        }, 1, r);
+    results.push_back(r);
+
+    r = { engine.name, keyBits, "kdf", "batch", outLen, 1, 0, 0, 0 };
+    Measure(options, [&](unsigned long long n)
+        {
+            for (unsigned long long i = 0; i < n; i++)
+                CMAC_KDF_Batch(master, requests.data(), nRequests, arena.data(), arena.size());
+            sink = arena[0];
+        }, nRequests, r);
+    results.push_back(r);
+}
+
+// The keys of the keycache benchmark, indexed by key ID.
+struct BenchKeyTable
+{
+    AES_KeySize keySize;
+    std::vector<byte> keys;     // 32 bytes per key.
+};
+
+static bool LoadBenchKey(void* context, uint64_t keyId, byte key[32], AES_KeySize& keySize)
+{
+    const BenchKeyTable& table = *static_cast<const BenchKeyTable*>(context);
+    if (keyId >= table.keys.size() / 32)
+        return false;
+    memcpy(key, &table.keys[32 * keyId], 32);
+    keySize = table.keySize;
+    return true;
+}
+
+static void BenchKeyCache(const BenchOptions& options, const AES_Engine& engine, std::vector<BenchResult>& results)
+{
+    const size_t nKeys = 4096;
+    const size_t nLookups = 1 << 16;
+    const size_t messageLen = 64;
+    size_t keyBits = (size_t)options.keySize * 8;
+
+    BenchKeyTable table = { options.keySize, std::vector<byte>(32 * nKeys) };
+    FillPattern(table.keys.data(), table.keys.size(), 13);
+    byte message[messageLen];
+    FillPattern(message, messageLen, 14);
+    byte mac[16];
+
+    // Key IDs with a cubic skew: about half of the lookups go to the lowest
+    // eighth of the keys.
+    std::vector<uint32_t> ids(nLookups);
+    uint32_t x = 12345;
+    for (size_t i = 0; i < nLookups; i++)
+    {
+        x = x * 1103515245u + 12345u;
+        double u = (double)(x >> 8) / (double)(1u << 24);
+        ids[i] = (uint32_t)(nKeys * u * u * u);
+    }
+
+    BenchResult r = { engine.name, keyBits, "keycache", "oneshot", messageLen, 1, 0, 0, 0 };
+    Measure(options, [&](unsigned long long n)
+        {
+            for (unsigned long long i = 0; i < n; i++)
+                CmacFor(options.keySize, &table.keys[32 * ids[i % nLookups]], message, messageLen, mac);
+            sink = mac[0];
+        }, 1, r);
+    results.push_back(r);
+
+    static const struct { const char* mode; size_t capacity; } caches[] = {
+        { "cached", 2 * nKeys }, { "churn", nKeys / 8 }
+    };
+    for (const auto& c : caches)
+    {
+        CmacKeyCache cache(c.capacity, LoadBenchKey, &table);
+        r = { engine.name, keyBits, "keycache", c.mode, messageLen, 1, 0, 0, 0 };
+        Measure(options, [&](unsigned long long n)
+            {
+                for (unsigned long long i = 0; i < n; i++)
+                    cache.Mac(ids[i % nLookups], message, messageLen, 128, mac);
+                sink = mac[0];
+            }, 1, r);
+        results.push_back(r);
+
+        CmacKeyCache::Stats stats = cache.GetStats();
+        fprintf(stderr, "  keycache %s: %.1f%% hits, %llu evictions\n", c.mode,
+            100.0 * (double)stats.hits / (double)(stats.hits + stats.misses), (unsigned long long)stats.evictions);
+    }
+}
+
+static void BenchModes(const BenchOptions& options, const AES_Engine& engine, std::vector<BenchResult>& results)
+{
+    static const size_t sizes[] = { 1024, 16384, 1048576 };
+    size_t keyBits = (size_t)options.keySize * 8;
+
+    byte rawKey[32];
+    FillPattern(rawKey, sizeof(rawKey), 9);
+    AesCtrKey ctr(rawKey, options.keySize);
+    AesGcmKey gcm(rawKey, options.keySize);
+    byte sivKey[64];
+    FillPattern(sivKey, sizeof(sivKey), 10);
+    AesSivKey siv(sivKey, options.keySize);
+    byte iv[12] = { 0 };
+
+    for (size_t size : sizes)
+    {
+        if (size > options.maxSize)
+            break;
+
+        std::vector<byte> data(size), out(size + 16);
+        FillPattern(data.data(), size, (unsigned)size);
+
+        BenchResult r = { engine.name, keyBits, "ctr", "single", size, 1, 0, 0, 0 };
+        Measure(options, [&](unsigned long long n)
+            {
+                byte counter[16] = { 0 };
+                for (unsigned long long i = 0; i < n; i++)
+                    ctr.Crypt(counter, data.data(), out.data(), size);
+                sink = out[0];
+            }, 1, r);
+        results.push_back(r);
+
+        byte tag[16];
+        r = { engine.name, keyBits, "gcm", "single", size, 1, 0, 0, 0 };
+        Measure(options, [&](unsigned long long n)
+            {
+                for (unsigned long long i = 0; i < n; i++)
+                    gcm.Encrypt(iv, sizeof(iv), nullptr, 0, data.data(), size, out.data(), tag);
+                sink = tag[0];
+            }, 1, r);
+        results.push_back(r);
+
+        CmacSegment ad = { iv, sizeof(iv) };
+        r = { engine.name, keyBits, "siv", "single", size, 1, 0, 0, 0 };
+        Measure(options, [&](unsigned long long n)
+            {
+                for (unsigned long long i = 0; i < n; i++)
+                    siv.Encrypt(&ad, 1, data.data(), size, out.data());
+                sink = out[0];
+            }, 1, r);
+        results.push_back(r);
+    }
+}
+
+static void BenchTree(const BenchOptions& options, const AES_Engine& engine, std::vector<BenchResult>& results)
+{
+    size_t size = options.treeSize;
+    size_t keyBits = (size_t)options.keySize * 8;
+    if (size == 0)
+        return;
+
+    byte rawKey[32];
+    FillPattern(rawKey, sizeof(rawKey), 7);
+    CmacKey key(rawKey, options.keySize);
+    CmacTreeKey treeKey(rawKey, options.keySize);
+
+    std::vector<byte> data(size);
+    FillPattern(data.data(), size, 8);
+
+    byte mac[16];
+    BenchResult r = { engine.name, keyBits, "cmac", "single", size, 1, 0, 0, 0 };
+    Measure(options, [&](unsigned long long n)
+        {
+            for (unsigned long long i = 0; i < n; i++)
+                key.Mac(data.data(), size, 128, mac);
+            sink = mac[0];
+        }, 1, r);
+    results.push_back(r);
+
+    r = { engine.name, keyBits, "cmac_tree", "single", size, 1, 0, 0, 0 };
+    Measure(options, [&](unsigned long long n)
+        {
+            for (unsigned long long i = 0; i < n; i++)
+                treeKey.Mac(data.data(), size, 128, mac);
+            sink = mac[0];
+        }, 1, r);
+    results.push_back(r);
+
+    for (size_t threads : options.threads)
+    {
+        CmacBatchService service(threads);
+        if (service.Threads() <= 1)
+            continue;
+        r = { engine.name, keyBits, "cmac_tree", "parallel", size, service.Threads(), 0, 0, 0 };
+        Measure(options, [&](unsigned long long n)
+            {
+                for (unsigned long long i = 0; i < n; i++)
+                    treeKey.Mac(service, data.data(), size, 128, mac);
+                sink = mac[0];
+            }, 1, r);
+        results.push_back(r);
+    }
+}
+
+// ---------------------- Output ----------------------
+
+static double CyclesPerByte(const BenchResult& r)
+{
+    return r.bytes == 0 ? NAN : r.cyclesPerCall / (double)r.bytes;
+}
+
+static double MegabytesPerSecond(const BenchResult& r)
+{
+    return r.bytes == 0 ? NAN : (double)r.bytes * 1e3 / r.nsPerCall;
+}
+
+// Formats a value, or the given placeholder if it is not a number.
+static std::string Number(double value, const char* missing)
+{
+    if (std::isnan(value))
+        return missing;
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", value);
+    return buffer;
+}
+
+static void PrintText(const std::vector<BenchResult>& results)
+{
+    printf("%-15s %4s %-17s %-9s %9s %4s %12s %12s %12s %10s\n",
+        "backend", "key", "operation", "mode", "bytes", "thr", "calls", "ns/call", "cycles/byte", "MB/s");
+    for (const BenchResult& r : results)
+    {
+        printf("%-15s %4zu %-17s %-9s %9zu %4zu %12llu %12.1f %12s %10s\n",
+            r.backend.c_str(), r.keyBits, r.operation.c_str(), r.mode.c_str(), r.bytes, r.threads, r.calls, r.nsPerCall,
+            Number(CyclesPerByte(r), "-").c_str(), Number(MegabytesPerSecond(r), "-").c_str());
+    }
+}
+
+static void PrintCsv(const std::vector<BenchResult>& results)
+{
+    printf("backend,key_bits,operation,mode,bytes,threads,calls,ns_per_call,cycles_per_call,cycles_per_byte,mb_per_s\n");
+    for (const BenchResult& r : results)
+    {
+        printf("%s,%zu,%s,%s,%zu,%zu,%llu,%.3f,%s,%s,%s\n",
+            r.backend.c_str(), r.keyBits, r.operation.c_str(), r.mode.c_str(), r.bytes, r.threads, r.calls, r.nsPerCall,
+            Number(r.cyclesPerCall, "").c_str(), Number(CyclesPerByte(r), "").c_str(), Number(MegabytesPerSecond(r), "").c_str());
+    }
+}
+
+static void PrintJson(const std::vector<BenchResult>& results)
+{
+    printf("{\n  \"cycle_counter\": \"%s\",\n  \"results\": [\n",
+#ifdef BENCH_HAVE_TSC
+        "tsc"
+#else
+        "none"
+#endif
+    );
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        printf("    {\"backend\": \"%s\", \"key_bits\": %zu, \"operation\": \"%s\", \"mode\": \"%s\", \"bytes\": %zu, \"threads\": %zu, "
+            "\"calls\": %llu, \"ns_per_call\": %.3f, \"cycles_per_call\": %s, \"cycles_per_byte\": %s, \"mb_per_s\": %s}%s\n",
+            r.backend.c_str(), r.keyBits, r.operation.c_str(), r.mode.c_str(), r.bytes, r.threads, r.calls, r.nsPerCall,
+            Number(r.cyclesPerCall, "null").c_str(), Number(CyclesPerByte(r), "null").c_str(),
+            Number(MegabytesPerSecond(r), "null").c_str(), i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+// ---------------------- Main ----------------------
+
+static bool ParseOptions(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "--format" && (value == "text" || value == "csv" || value == "json"))
+            options.format = value;
+        else if (name == "--min-time-ms" && !value.empty())
+            options.minTimeMs = atof(value.c_str());
+        else if (name == "--max-size" && !value.empty())
+            options.maxSize = (size_t)strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--threads" && !value.empty())
+        {
+            options.threads.clear();
+            for (size_t start = 0; start <= value.size(); )
+            {
+                size_t comma = value.find(',', start);
+                if (comma == std::string::npos)
+                    comma = value.size();
+                options.threads.push_back((size_t)strtoull(value.substr(start, comma - start).c_str(), nullptr, 10));
+                start = comma + 1;
+            }
+        }
+        else if (name == "--backend" && !value.empty())
+            options.backend = value;
+        else if (name == "--key-bits" && (value == "128" || value == "192" || value == "256"))
+            options.keySize = (AES_KeySize)(atoi(value.c_str()) / 8);
+        else if (name == "--tree-size" && !value.empty())
+            options.treeSize = (size_t)strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--stats")
+            options.stats = true;
+        else
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        fprintf(stderr,
+            "usage: %s [--format=text|csv|json] [--min-time-ms=N] [--max-size=N] [--threads=N[,N...]]\n"
+            "       [--backend=NAME] [--key-bits=128|192|256] [--tree-size=N] [--stats]\n"
+            "  --threads=0 (default) uses every hardware thread for the parallel mode;\n"
+            "  a list such as --threads=2,4,8 runs the parallel modes once per count\n"
+            "  --tree-size=0 skips the large-object CMAC-Tree comparison\n",
+            argv[0]);
+        return 2;
+    }
+
+    static const AES_Backend backends[] = {
+        AES_Backend::Reference, AES_Backend::TTable, AES_Backend::AESNI,
+        AES_Backend::Bitsliced, AES_Backend::BitslicedSSE2, AES_Backend::BitslicedAVX2,
+        AES_Backend::TTableBitsliced
+    };
+
+    std::vector<BenchResult> results;
+    for (AES_Backend backend : backends)
+    {
+        if (!AES_SelectBackend(backend))
+            continue;
+        const AES_Engine& engine = AES_GetEngine();
+        if (!options.backend.empty() && options.backend != engine.name)
+            continue;
+
+        fprintf(stderr, "benchmarking %s...\n", engine.name);
+        BenchPrimitives(options, engine, results);
+        BenchCmac(options, engine, results);
+        BenchKdf(options, engine, results);
+        BenchKeyCache(options, engine, results);
+        BenchModes(options, engine, results);
+        BenchTree(options, engine, results);
+    }
+
+    if (options.stats)
+        fputs(CMAC_StatsJson().c_str(), stderr);
+
+    if (options.format == "csv")
+        PrintCsv(results);
+    else if (options.format == "json")
+        PrintJson(results);
+    else
+        PrintText(results);
+    return 0;
+}
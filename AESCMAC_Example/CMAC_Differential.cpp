@@ -0,0 +1,319 @@
+﻿//
+// Differential test of the AES engines and every CMAC entry point against the
+// reference engine, on random keys, key sizes, message lengths, Tlen values and
+// chunkings. The SP 800-38B / RFC 4493 known answers are in CMAC_Tests.cpp;
+// this harness checks that the fast paths agree with the reference everywhere
+// else.
+//
+// Usage: cmac_differential [--iterations=N] [--seed=N] [--max-len=N]
+//
+// Each iteration builds a group of cases from pseudo-random bytes, computes
+// their tags with the reference engine, then for every other backend the CPU
+// supports checks:
+//   - AES_Cipher::encrypt and encryptBlocks against reference encryption
+//   - CMAC<KeyBits>(), CmacKey::Mac and CmacKey::Verify (also with a flipped
+//     tag bit, which must fail)
+//   - CmacStream fed in random chunks, and CmacKey::Mac over random segments
+//   - CMAC_Batch over the whole group, so lanes of different lengths and key
+//     sizes share the lane kernels
+// Exits with status 1, printing the failing case, on the first mismatch.
+//
+// Built with CMAC_DIFFERENTIAL_LIBFUZZER defined (CMake: -DAESCMAC_FUZZER=ON,
+// with clang) the same checks run as a libFuzzer target on the fuzzer's input
+// instead of the random driver.
+
+#include "CMAC.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const AES_Backend Backends[] = {
+    AES_Backend::TTable, AES_Backend::AESNI,
+    AES_Backend::Bitsliced, AES_Backend::BitslicedSSE2, AES_Backend::BitslicedAVX2,
+    AES_Backend::TTableBitsliced
+};
+
+// ---------------------- Cases ----------------------
+
+// xorshift64*: the chunk and segment boundaries of a case, and the random driver.
+struct Rng
+{
+    uint64_t state;
+
+    uint64_t Next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dull;
+    }
+
+    size_t Below(size_t n) { return n == 0 ? 0 : (size_t)(Next() % n); }
+};
+
+struct Case
+{
+    AES_KeySize keySize;
+    int Tlen;
+    uint64_t splitSeed;
+    byte key[32];
+    std::vector<byte> message;
+    byte expected[16];
+};
+
+// DecodeCase: a case from fuzzer bytes: key size, Tlen, split seed, key, then
+// the message. Missing header bytes read as zero.
+static Case DecodeCase(const byte* data, size_t size)
+{
+    byte header[2 + 8 + 32] = { 0 };
+    size_t headerLen = size < sizeof(header) ? size : sizeof(header);
+    memcpy(header, data, headerLen);
+
+    static const AES_KeySize keySizes[3] = { AES_KeySize::AES128, AES_KeySize::AES192, AES_KeySize::AES256 };
+    Case c;
+    c.keySize = keySizes[header[0] % 3];
+    c.Tlen = 1 + header[1] % 128;
+    c.splitSeed = 0;
+    for (int i = 0; i < 8; i++)
+        c.splitSeed = (c.splitSeed << 8) | header[2 + i];
+    c.splitSeed |= 1;
+    memcpy(c.key, header + 10, 32);
+    c.message.assign(data + headerLen, data + size);
+    return c;
+}
+
+// ---------------------- Checks ----------------------
+
+static void CmacFor(AES_KeySize keySize, const byte* key, const byte* message, size_t messageLen, int Tlen, byte mac[16])
+{
+    switch (keySize)
+    {
+    case AES_KeySize::AES128: CMAC<128>(key, message, messageLen, Tlen, mac); break;
+    case AES_KeySize::AES192: CMAC<192>(key, message, messageLen, Tlen, mac); break;
+    case AES_KeySize::AES256: CMAC<256>(key, message, messageLen, Tlen, mac); break;
+    }
+}
+
+static void Fail(const char* api, const Case& c, const byte* got)
+{
+    printf("FAIL %s %s AES-%d Tlen=%d len=%zu\n  key ", AES_BackendName(), api, (int)c.keySize * 8, c.Tlen, c.message.size());
+    for (size_t i = 0; i < (size_t)c.keySize; i++)
+        printf("%02x", c.key[i]);
+    printf("\n  msg ");
+    for (byte b : c.message)
+        printf("%02x", b);
+    printf("\n  got ");
+    for (int i = 0; i < 16; i++)
+        printf("%02x", got[i]);
+    printf("\n  ref ");
+    for (int i = 0; i < 16; i++)
+        printf("%02x", c.expected[i]);
+    printf("\n");
+    fflush(stdout);
+    abort();
+}
+
+static void CheckTag(const char* api, const Case& c, const byte* mac)
+{
+    if (memcmp(mac, c.expected, 16) != 0)
+        Fail(api, c, mac);
+}
+
+// Reference block encryptions of the case's full blocks (and of the zero block
+// if there are none), for the engine-level checks.
+static std::vector<byte> ReferenceBlocks(const Case& c)
+{
+    const AES_Cipher& cipher = AES_GetEngine().Cipher(c.keySize);
+    AES_RoundKeys rk;
+    cipher.expandKey(c.key, rk);
+    size_t nBlocks = c.message.size() / 16;
+    std::vector<byte> in(c.message.begin(), c.message.begin() + 16 * nBlocks);
+    if (nBlocks == 0)
+        in.assign(16, 0);
+    std::vector<byte> out(in.size());
+    for (size_t i = 0; i < in.size(); i += 16)
+        cipher.encrypt(&in[i], &out[i], rk);
+    return out;
+}
+
+static void CheckEngine(const Case& c, const std::vector<byte>& reference)
+{
+    const AES_Cipher& cipher = AES_GetEngine().Cipher(c.keySize);
+    AES_RoundKeys rk;
+    cipher.expandKey(c.key, rk);
+
+    std::vector<byte> in(reference.size(), 0);
+    if (c.message.size() >= 16)
+        memcpy(in.data(), c.message.data(), in.size());
+
+    byte block[16];
+    cipher.encrypt(in.data(), block, rk);
+    if (memcmp(block, reference.data(), 16) != 0)
+        Fail("AES_Cipher::encrypt", c, block);
+
+    std::vector<byte> out(in.size());
+    cipher.encryptBlocks(rk, in.data(), out.data(), in.size() / 16);
+    for (size_t i = 0; i < out.size(); i += 16)
+    {
+        if (memcmp(&out[i], &reference[i], 16) != 0)
+            Fail("AES_Cipher::encryptBlocks", c, &out[i]);
+    }
+}
+
+static void CheckCase(const Case& c, CmacKey& key)
+{
+    const byte* m = c.message.data();
+    size_t len = c.message.size();
+    byte mac[16];
+
+    CmacFor(c.keySize, c.key, m, len, c.Tlen, mac);
+    CheckTag("CMAC", c, mac);
+
+    key.Mac(m, len, c.Tlen, mac);
+    CheckTag("CmacKey::Mac", c, mac);
+    if (!key.Verify(m, len, c.expected, c.Tlen))
+        Fail("CmacKey::Verify", c, mac);
+    byte wrong[16];
+    memcpy(wrong, c.expected, 16);
+    wrong[(c.Tlen - 1) / 8] ^= (byte)(0x80 >> ((c.Tlen - 1) % 8));
+    if (key.Verify(m, len, wrong, c.Tlen))
+        Fail("CmacKey::Verify (flipped bit)", c, wrong);
+
+    Rng rng = { c.splitSeed };
+    CmacStream stream(key);
+    for (size_t done = 0; done < len; )
+    {
+        size_t chunk = 1 + rng.Below(rng.Below(2) ? 17 : len - done);
+        if (chunk > len - done)
+            chunk = len - done;
+        stream.Update(m + done, chunk);
+        done += chunk;
+    }
+    stream.Final(c.Tlen, mac);
+    CheckTag("CmacStream", c, mac);
+
+    CmacSegment segments[5];
+    size_t nSegments = 1 + rng.Below(5);
+    size_t offset = 0;
+    for (size_t i = 0; i < nSegments; i++)
+    {
+        size_t segmentLen = i + 1 == nSegments ? len - offset : rng.Below(len - offset + 1);
+        segments[i] = { m + offset, segmentLen };
+        offset += segmentLen;
+    }
+    key.Mac(segments, nSegments, c.Tlen, mac);
+    CheckTag("CmacKey::Mac(segments)", c, mac);
+}
+
+// RunGroup: checks every case on every backend, then restores the default
+// engine.
+static void RunGroup(std::vector<Case>& cases)
+{
+    const AES_Backend original = AES_GetEngine().backend;
+
+    AES_SelectBackend(AES_Backend::Reference);
+    std::vector<std::vector<byte>> referenceBlocks;
+    for (Case& c : cases)
+    {
+        CmacFor(c.keySize, c.key, c.message.data(), c.message.size(), c.Tlen, c.expected);
+        referenceBlocks.push_back(ReferenceBlocks(c));
+    }
+
+    for (AES_Backend backend : Backends)
+    {
+        if (!AES_SelectBackend(backend))
+            continue;
+
+        std::vector<CmacKey> keys;
+        keys.reserve(cases.size());
+        for (size_t i = 0; i < cases.size(); i++)
+        {
+            keys.emplace_back(cases[i].key, cases[i].keySize);
+            CheckEngine(cases[i], referenceBlocks[i]);
+            CheckCase(cases[i], keys[i]);
+        }
+
+        std::vector<byte> macs(16 * cases.size());
+        std::vector<CmacJob> jobs;
+        for (size_t i = 0; i < cases.size(); i++)
+            jobs.push_back({ &keys[i], cases[i].message.data(), cases[i].message.size(), cases[i].Tlen, &macs[16 * i] });
+        CMAC_Batch(jobs.data(), jobs.size());
+        for (size_t i = 0; i < cases.size(); i++)
+            CheckTag("CMAC_Batch", cases[i], &macs[16 * i]);
+    }
+
+    AES_SelectBackend(original);
+}
+
+// ---------------------- Drivers ----------------------
+
+#ifdef CMAC_DIFFERENTIAL_LIBFUZZER
+
+// The input is one case; two of its prefixes join it in the batch, so lanes
+// with the same key still end at different blocks.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    std::vector<Case> cases;
+    cases.push_back(DecodeCase(data, size));
+    for (size_t divisor = 2; divisor <= 3; divisor++)
+    {
+        cases.push_back(cases[0]);
+        cases.back().message.resize(cases[0].message.size() / divisor);
+    }
+    RunGroup(cases);
+    return 0;
+}
+
+#else
+
+int main(int argc, char** argv)
+{
+    unsigned long long iterations = 500, seed = 1;
+    size_t maxLen = 300;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 13, "--iterations=") == 0)
+            iterations = strtoull(arg.c_str() + 13, nullptr, 10);
+        else if (arg.compare(0, 7, "--seed=") == 0)
+            seed = strtoull(arg.c_str() + 7, nullptr, 10);
+        else if (arg.compare(0, 10, "--max-len=") == 0)
+            maxLen = (size_t)strtoull(arg.c_str() + 10, nullptr, 10);
+        else
+        {
+            fprintf(stderr, "usage: %s [--iterations=N] [--seed=N] [--max-len=N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Rng rng = { seed * 0x9e3779b97f4a7c15ull + 1 };
+    std::vector<byte> input;
+    size_t nCases = 0;
+    for (unsigned long long it = 0; it < iterations; it++)
+    {
+        // Mostly short messages around block boundaries, where the padding and
+        // K1/K2 choice happen, with occasional long ones.
+        std::vector<Case> cases(1 + rng.Below(12));
+        for (Case& c : cases)
+        {
+            size_t len = 16 * rng.Below(5) + rng.Below(3);
+            len = len > 0 ? len - 1 : 0;
+            if (rng.Below(8) == 0 || len > maxLen)
+                len = rng.Below(maxLen + 1);
+            input.resize(42 + len);
+            for (byte& b : input)
+                b = (byte)rng.Next();
+            c = DecodeCase(input.data(), input.size());
+        }
+        RunGroup(cases);
+        nCases += cases.size();
+    }
+
+    printf("%zu cases agree with the reference engine\n", nCases);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,132 @@
+﻿//
+// SP 800-108 counter-mode KDF with AES-CMAC. See CMAC_KDF.h for the definition.
+//
+// CMAC_KDF_Batch works in groups: the PRF inputs of as many blocks as fit in
+// the scratch buffer are formatted one after another, then CMAC_Batch MACs the
+// whole group. Full output blocks are written straight into the arena; only a
+// final partial block goes through a temporary.
+
+#include "CMAC_KDF.h"
+
+#include <cstring>
+
+// Scratch space for the PRF inputs of one group.
+static const size_t KDF_SCRATCH_BYTES = 4096;
+
+// PRF blocks per group; a few times the widest engine, so lanes are refilled
+// from the same CMAC_Batch call.
+static const size_t KDF_GROUP_BLOCKS = 4 * AES_MAX_LANES;
+
+static void PutU32BE(byte* p, uint32_t v)
+{
+    p[0] = (byte)(v >> 24);
+    p[1] = (byte)(v >> 16);
+    p[2] = (byte)(v >> 8);
+    p[3] = (byte)v;
+}
+
+// Length of the PRF input [i]_32 || Label || 0x00 || Context || [L]_32.
+static size_t PrfInputLen(const KdfRequest& request)
+{
+    return 4 + request.labelLen + 1 + request.contextLen + 4;
+}
+
+// FormatPrfInput: writes the PRF input of block i (from 1) of request to p.
+static void FormatPrfInput(const KdfRequest& request, uint32_t i, byte* p)
+{
+    PutU32BE(p, i);
+    p += 4;
+    if (request.labelLen > 0)
+        memcpy(p, request.label, request.labelLen);
+    p += request.labelLen;
+    *p++ = 0x00;
+    if (request.contextLen > 0)
+        memcpy(p, request.context, request.contextLen);
+    p += request.contextLen;
+    PutU32BE(p, (uint32_t)(request.outLen * 8));
+}
+
+bool CMAC_KDF(const CmacKey& key, const byte* label, size_t labelLen, const byte* context, size_t contextLen,
+              byte* out, size_t outLen)
+{
+    KdfRequest request = { label, labelLen, context, contextLen, outLen };
+    return CMAC_KDF_Batch(key, &request, 1, out, outLen) != 0;
+}
+
+size_t CMAC_KDF_Batch(const CmacKey& key, const KdfRequest* requests, size_t nRequests, byte* arena, size_t arenaLen)
+{
+    // [L]_32 and the 32-bit counter would silently wrap above the maximum.
+    size_t total = 0;
+    for (size_t r = 0; r < nRequests; r++)
+    {
+        size_t outLen = requests[r].outLen;
+        if (outLen == 0 || outLen > CMAC_KDF_MAX_OUT_LEN || outLen > arenaLen - total)
+            return 0;
+        total += outLen;
+    }
+
+    byte scratch[KDF_SCRATCH_BYTES];
+    byte tails[KDF_GROUP_BLOCKS][16];
+    byte* tailOut[KDF_GROUP_BLOCKS];
+    size_t tailLen[KDF_GROUP_BLOCKS];
+    CmacJob jobs[KDF_GROUP_BLOCKS];
+    size_t nJobs = 0, nTails = 0, used = 0;
+
+    auto flush = [&]()
+    {
+        if (nJobs == 0)
+            return;
+        CMAC_Batch(jobs, nJobs);
+        for (size_t t = 0; t < nTails; t++)
+            memcpy(tailOut[t], tails[t], tailLen[t]);
+        SecureZero(tails, nTails * sizeof(tails[0]));
+        nJobs = nTails = used = 0;
+    };
+
+    byte* out = arena;
+    for (size_t r = 0; r < nRequests; r++)
+    {
+        const KdfRequest& request = requests[r];
+        size_t inputLen = PrfInputLen(request);
+        size_t nBlocks = (request.outLen + 15) / 16;
+        for (size_t i = 0; i < nBlocks; i++)
+        {
+            byte* dst = out + 16 * i;
+            size_t len = request.outLen - 16 * i < 16 ? request.outLen - 16 * i : 16;
+
+            // An input too large for the scratch buffer is MACed in place from
+            // its parts.
+            if (inputLen > KDF_SCRATCH_BYTES)
+            {
+                byte counter[4], zero = 0x00, L[4], block[16];
+                PutU32BE(counter, (uint32_t)(i + 1));
+                PutU32BE(L, (uint32_t)(request.outLen * 8));
+                CmacSegment input[5] = {
+                    { counter, 4 }, { request.label, request.labelLen }, { &zero, 1 },
+                    { request.context, request.contextLen }, { L, 4 }
+                };
+                key.Mac(input, 5, 128, block);
+                memcpy(dst, block, len);
+                SecureZero(block, sizeof(block));
+                continue;
+            }
+
+            if (nJobs == KDF_GROUP_BLOCKS || used + inputLen > KDF_SCRATCH_BYTES)
+                flush();
+
+            byte* mac = dst;
+            if (len < 16)
+            {
+                mac = tails[nTails];
+                tailOut[nTails] = dst;
+                tailLen[nTails++] = len;
+            }
+            FormatPrfInput(request, (uint32_t)(i + 1), scratch + used);
+            jobs[nJobs++] = { &key, scratch + used, inputLen, 128, mac };
+            used += inputLen;
+        }
+        out += request.outLen;
+    }
+    flush();
+    return total;
+}
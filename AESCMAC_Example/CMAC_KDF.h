@@ -0,0 +1,44 @@
+//
+// Key derivation with AES-CMAC as the PRF: NIST SP 800-108, KDF in counter mode.
+//
+
+#pragma once
+
+#include "CMAC.h"
+
+// For a derived key of L bits (n = ceil(L / 128) PRF blocks), SP 800-108
+// Section 5.1 with r = 32:
+//   K(i) = CMAC(KI, [i]_32 || Label || 0x00 || Context || [L]_32),  i = 1 .. n
+//   KO   = the first L bits of K(1) || ... || K(n)
+// where [x]_32 is x as a 32-bit big-endian integer. So L must be at least 1
+// and below 2^32: outLen from 1 to 2^29 - 1 bytes.
+static const size_t CMAC_KDF_MAX_OUT_LEN = ((size_t)1 << 29) - 1;
+
+// CMAC_KDF: derives outLen bytes into out from the master key key. Returns
+// false, writing nothing, if outLen is 0 or above CMAC_KDF_MAX_OUT_LEN.
+bool CMAC_KDF(const CmacKey& key, const byte* label, size_t labelLen, const byte* context, size_t contextLen,
+              byte* out, size_t outLen);
+
+// KdfRequest: one derivation for CMAC_KDF_Batch.
+struct KdfRequest
+{
+    const byte* label;
+    size_t labelLen;
+    const byte* context;
+    size_t contextLen;
+    size_t outLen;      // Bytes of key material to derive.
+};
+
+// CMAC_KDF_Batch: runs nRequests derivations under one master key.
+//
+// The master key is expanded once (in its CmacKey), and the PRF blocks of all
+// requests are computed as independent messages through CMAC_Batch, so the
+// interleaved lanes stay busy even though each derivation is only one or two
+// short CMACs. The PRF inputs are assembled in a fixed stack buffer and the
+// derived keys are written back to back into arena: request i starts where
+// request i - 1 ended. Nothing is allocated.
+//
+// Returns the number of bytes written (the sum of all outLen), or 0, writing
+// nothing, if that exceeds arenaLen or a request's outLen is 0 or above
+// CMAC_KDF_MAX_OUT_LEN.
+size_t CMAC_KDF_Batch(const CmacKey& key, const KdfRequest* requests, size_t nRequests, byte* arena, size_t arenaLen);
@@ -0,0 +1,164 @@
+﻿//
+// Sharded LRU cache of CmacKeys. See CMAC_KeyCache.h.
+//
+
+#include "CMAC_KeyCache.h"
+
+#include <cstring>
+#include <iterator>
+
+static const size_t DEFAULT_SHARDS = 16;
+
+// MixKeyId: the splitmix64 finalizer, so sequential IDs land on different
+// shards.
+static uint64_t MixKeyId(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+CmacKeyCache::CmacKeyCache(size_t capacity, CmacKeyLoader loader, void* context, size_t nShards)
+    : loader(loader), context(context)
+{
+    if (capacity == 0)
+        capacity = 1;
+    if (nShards == 0)
+        nShards = DEFAULT_SHARDS;
+    if (nShards > capacity)
+        nShards = capacity;
+    // A power of two, so the shard is picked with a mask.
+    while ((nShards & (nShards - 1)) != 0)
+        nShards &= nShards - 1;
+    shardCapacity = capacity / nShards;
+
+    for (size_t i = 0; i < nShards; i++)
+    {
+        shards.emplace_back(new Shard);
+        shards.back()->index.reserve(shardCapacity);
+    }
+}
+
+CmacKeyCache::Shard& CmacKeyCache::ShardFor(uint64_t keyId)
+{
+    return *shards[MixKeyId(keyId) & (shards.size() - 1)];
+}
+
+std::shared_ptr<const CmacKey> CmacKeyCache::Acquire(uint64_t keyId)
+{
+    Shard& shard = ShardFor(keyId);
+    uint64_t epoch;
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto found = shard.index.find(keyId);
+        if (found != shard.index.end())
+        {
+            shard.hits++;
+            if (found->second != shard.lru.begin())
+                shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            return found->second->key;
+        }
+        shard.misses++;
+        epoch = shard.epoch;
+    }
+
+    // Load and expand without the lock, so a slow loader only delays this key.
+    byte rawKey[32];
+    AES_KeySize keySize = AES_KeySize::AES128;
+    bool loaded = loader(context, keyId, rawKey, keySize);
+    std::shared_ptr<const CmacKey> key;
+    if (loaded)
+        key = std::make_shared<const CmacKey>(rawKey, keySize);
+    SecureZero(rawKey, sizeof(rawKey));
+    if (!loaded)
+        return nullptr;
+
+    std::list<Entry> evicted;
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+
+        // An Invalidate() or Clear() during the load may have been meant for
+        // the key just read; it is used for this call but not cached.
+        if (shard.epoch != epoch)
+            return key;
+
+        // Another thread may have loaded the same key meanwhile; keep theirs.
+        auto found = shard.index.find(keyId);
+        if (found != shard.index.end())
+            return found->second->key;
+
+        if (shard.lru.size() >= shardCapacity)
+        {
+            evicted.splice(evicted.begin(), shard.lru, std::prev(shard.lru.end()));
+            shard.index.erase(evicted.front().keyId);
+            shard.evictions++;
+        }
+        shard.lru.push_front({ keyId, key });
+        shard.index[keyId] = shard.lru.begin();
+    }
+    // The evicted key, if nobody else holds it, is wiped here, after the lock
+    // is released.
+    return key;
+}
+
+bool CmacKeyCache::Mac(uint64_t keyId, const byte* message, size_t messageLen, int Tlen, byte mac[16])
+{
+    std::shared_ptr<const CmacKey> key = Acquire(keyId);
+    if (!key)
+        return false;
+    key->Mac(message, messageLen, Tlen, mac);
+    return true;
+}
+
+bool CmacKeyCache::Verify(uint64_t keyId, const byte* message, size_t messageLen, const byte* mac, int Tlen)
+{
+    std::shared_ptr<const CmacKey> key = Acquire(keyId);
+    return key && key->Verify(message, messageLen, mac, Tlen);
+}
+
+void CmacKeyCache::Invalidate(uint64_t keyId)
+{
+    Shard& shard = ShardFor(keyId);
+    std::list<Entry> dropped;
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        // Counted even if keyId is not cached, since it may be loading.
+        shard.epoch++;
+        auto found = shard.index.find(keyId);
+        if (found == shard.index.end())
+            return;
+        dropped.splice(dropped.begin(), shard.lru, found->second);
+        shard.index.erase(found);
+    }
+}
+
+void CmacKeyCache::Clear()
+{
+    for (auto& shard : shards)
+    {
+        std::list<Entry> dropped;
+        {
+            std::lock_guard<std::mutex> guard(shard->lock);
+            shard->epoch++;
+            dropped.swap(shard->lru);
+            shard->index.clear();
+        }
+    }
+}
+
+CmacKeyCache::Stats CmacKeyCache::GetStats() const
+{
+    Stats stats = { 0, 0, 0, 0 };
+    for (const auto& shard : shards)
+    {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        stats.hits += shard->hits;
+        stats.misses += shard->misses;
+        stats.evictions += shard->evictions;
+        stats.size += shard->lru.size();
+    }
+    return stats;
+}
@@ -0,0 +1,101 @@
+//
+// Bounded cache of expanded CMAC keys, looked up by key ID.
+//
+
+#pragma once
+
+#include "CMAC.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// CmacKeyLoader: writes the key bytes of keyId to key and its size to keySize.
+// Returns false if there is no such key. Called without any cache lock held,
+// possibly from several threads at once.
+typedef bool (*CmacKeyLoader)(void* context, uint64_t keyId, byte key[32], AES_KeySize& keySize);
+
+// CmacKeyCache: an LRU cache from key ID to CmacKey (round keys and K1/K2), for
+// servers that MAC with many keys and see the same ones again and again.
+//
+//   CmacKeyCache cache(10000, LoadTenantKey, &tenants);
+//   cache.Mac(tenantId, message, len, 128, mac);    // expands the key once
+//
+// The cache holds at most capacity keys, about 300 bytes each. IDs are spread
+// over shards by a hash, each shard with its own lock, LRU list and share of
+// the capacity, so threads working on different keys rarely contend. Lookups
+// take the shard lock only for the hash lookup and the move to the front of
+// the list; the MAC itself runs without any lock. A miss calls the loader and
+// expands the key outside the lock as well.
+//
+// An evicted or invalidated key is wiped (by ~CmacKey) as soon as the last
+// reference returned by Acquire() is released; the raw key bytes from the
+// loader are wiped right after expansion. Keys are expanded for the AES engine active when they
+// are loaded; Clear() the cache after switching backends.
+class CmacKeyCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;     // Keys dropped to make room (not Invalidate/Clear).
+        size_t size;            // Keys currently cached.
+    };
+
+    // nShards = 0 picks 16 (fewer if capacity is small).
+    CmacKeyCache(size_t capacity, CmacKeyLoader loader, void* context, size_t nShards = 0);
+
+    CmacKeyCache(const CmacKeyCache&) = delete;
+    CmacKeyCache& operator=(const CmacKeyCache&) = delete;
+
+    // Acquire: the key for keyId, loading it on a miss. Returns null if the
+    // loader does not know keyId. The key stays valid while the reference is
+    // held, even if it is evicted meanwhile.
+    std::shared_ptr<const CmacKey> Acquire(uint64_t keyId);
+
+    // Mac / Verify: as CmacKey::Mac / Verify with the key for keyId. Return
+    // false if the key cannot be loaded (Mac then leaves mac untouched).
+    bool Mac(uint64_t keyId, const byte* message, size_t messageLen, int Tlen, byte mac[16]);
+    bool Verify(uint64_t keyId, const byte* message, size_t messageLen, const byte* mac, int Tlen);
+
+    // Invalidate: drops keyId, e.g. after the key was rotated. A load of keyId
+    // already under way when Invalidate() is called is not cached, since it
+    // may have read the old key; its caller still gets that key.
+    void Invalidate(uint64_t keyId);
+    // Clear: drops every key. Counters are kept.
+    void Clear();
+
+    Stats GetStats() const;
+    // Capacity: the capacity passed in, rounded down to a multiple of the
+    // shard count.
+    size_t Capacity() const { return shardCapacity * shards.size(); }
+
+private:
+    struct Entry
+    {
+        uint64_t keyId;
+        std::shared_ptr<const CmacKey> key;
+    };
+
+    struct Shard
+    {
+        mutable std::mutex lock;
+        std::list<Entry> lru;       // Most recently used first.
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t epoch = 0;         // Bumped by Invalidate() and Clear().
+    };
+
+    Shard& ShardFor(uint64_t keyId);
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t shardCapacity;
+    CmacKeyLoader loader;
+    void* context;
+};
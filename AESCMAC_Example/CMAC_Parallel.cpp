@@ -0,0 +1,180 @@
+﻿//
+// CmacBatchService: CMAC_Batch spread over a work-stealing thread pool.
+//
+// Run() sorts a copy of the jobs by key size (CMAC_Batch lanes must share it),
+// then by length, longest first, and cuts it into tasks of consecutive jobs.
+// Sorting keeps the messages of one task close in length, so the lanes of
+// CMAC_Batch finish together, and puts the long messages at the front of
+// every queue. Tasks are dealt round-robin to the
+// per-thread queues; a thread that empties its own queue steals the largest
+// remaining task of another.
+
+#include "CMAC_Parallel.h"
+
+#include <algorithm>
+
+// Lower bound on the work in one task, so that queue traffic stays negligible
+// next to the MAC computation.
+static const size_t MIN_TASK_BLOCKS = 1024;
+
+// Target number of tasks per thread, leaving room to rebalance.
+static const size_t TASKS_PER_THREAD = 8;
+
+// Cost of a job in AES block encryptions (an empty message still takes one).
+static size_t JobBlocks(const CmacJob& job)
+{
+    return job.messageLen / 16 + 1;
+}
+
+CmacBatchService::CmacBatchService(size_t nThreads)
+{
+    if (nThreads == 0)
+        nThreads = std::thread::hardware_concurrency();
+    if (nThreads == 0)
+        nThreads = 1;
+
+    for (size_t i = 0; i < nThreads; i++)
+        queues.emplace_back(new WorkQueue);
+
+    // Thread 0 is the caller of Run().
+    for (size_t i = 1; i < nThreads; i++)
+        workers.emplace_back(&CmacBatchService::WorkerMain, this, i);
+}
+
+CmacBatchService::~CmacBatchService()
+{
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stopping = true;
+    }
+    startSignal.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void CmacBatchService::Run(const CmacJob* jobs, size_t nJobs)
+{
+    if (nJobs == 0)
+        return;
+    if (queues.size() == 1)
+    {
+        CMAC_Batch(jobs, nJobs);
+        return;
+    }
+
+    sorted.assign(jobs, jobs + nJobs);
+    std::sort(sorted.begin(), sorted.end(), [](const CmacJob& a, const CmacJob& b)
+        {
+            if (a.key->KeySize() != b.key->KeySize())
+                return a.key->KeySize() < b.key->KeySize();
+            return a.messageLen > b.messageLen;
+        });
+
+    size_t totalBlocks = 0;
+    for (const CmacJob& job : sorted)
+        totalBlocks += JobBlocks(job);
+    size_t taskBlocks = totalBlocks / (queues.size() * TASKS_PER_THREAD);
+    if (taskBlocks < MIN_TASK_BLOCKS)
+        taskBlocks = MIN_TASK_BLOCKS;
+
+    // The workers are idle between batches, but a late one may still be
+    // scanning the queues, so they are only touched under their locks.
+    for (auto& queue : queues)
+    {
+        std::lock_guard<std::mutex> guard(queue->lock);
+        queue->tasks.clear();
+        queue->head = 0;
+    }
+
+    // Cut the sorted jobs into tasks of about taskBlocks blocks. A task always
+    // gets enough messages to fill the lanes of the engine it runs on, the one
+    // its first key was expanded for (as in CMAC_Batch): a long message alone
+    // in a task would leave the multi-lane kernel running a single chain.
+    tasks.clear();
+    for (size_t first = 0; first < nJobs; )
+    {
+        size_t minCount = sorted[first].key->Engine().lanes;
+        size_t count = 0;
+        size_t blocks = 0;
+        while (first + count < nJobs && (count < minCount || blocks + JobBlocks(sorted[first + count]) <= taskBlocks))
+            blocks += JobBlocks(sorted[first + count++]);
+        tasks.push_back({ first, count });
+        first += count;
+    }
+
+    // The count must be in place before the first task is queued: a worker
+    // still draining after the previous batch can take and finish a task at
+    // once, and its decrement would be lost if the store came later.
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        pendingTasks.store(tasks.size());
+    }
+
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        WorkQueue& queue = *queues[i % queues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(tasks[i]);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        generation++;
+    }
+    startSignal.notify_all();
+
+    Drain(0);
+
+    std::unique_lock<std::mutex> lock(stateLock);
+    doneSignal.wait(lock, [this] { return pendingTasks.load() == 0; });
+}
+
+void CmacBatchService::WorkerMain(size_t self)
+{
+    unsigned long long seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(stateLock);
+            startSignal.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        Drain(self);
+    }
+}
+
+// Drain: runs tasks from the own queue, then from the others, until all are empty.
+void CmacBatchService::Drain(size_t self)
+{
+    size_t nQueues = queues.size();
+    for (;;)
+    {
+        Task task;
+        bool found = false;
+        for (size_t i = 0; i < nQueues && !found; i++)
+            found = TakeTask((self + i) % nQueues, task);
+        if (!found)
+            return;
+
+        CMAC_Batch(&sorted[task.first], task.count);
+
+        if (pendingTasks.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            doneSignal.notify_all();
+        }
+    }
+}
+
+// TakeTask: removes the largest task left in queue victim.
+bool CmacBatchService::TakeTask(size_t victim, Task& task)
+{
+    WorkQueue& queue = *queues[victim];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.head == queue.tasks.size())
+        return false;
+    task = queue.tasks[queue.head++];
+    return true;
+}
@@ -0,0 +1,80 @@
+//
+// Multithreaded CMAC over batches of independent messages.
+//
+
+#pragma once
+
+#include "CMAC.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// CmacBatchService: a pool of worker threads that computes the tags of a batch of
+// CmacJobs in parallel.
+//
+//   CmacBatchService service;         // one worker per hardware thread
+//   service.Run(jobs, nJobs);         // blocks until every job's mac is written
+//
+// Per-key work is reused through CmacKey, so jobs sharing a key share its round
+// keys and subkeys. The batch is cut into tasks of roughly equal size in bytes
+// (largest messages first) and spread over per-worker queues; an idle worker
+// steals from the others, so a few long messages do not leave the rest of the
+// pool waiting. Within a task the messages go through CMAC_Batch, which keeps
+// the multi-lane AES kernel busy. A single message is still processed by one
+// thread, since its CBC chain is serial.
+//
+// Run() allocates nothing per job: its buffers grow to the largest batch seen
+// and are reused. Run() must not be called from two threads at once.
+class CmacBatchService
+{
+public:
+    // nThreads = 0 uses std::thread::hardware_concurrency(). The calling thread
+    // takes part in Run(), so nThreads - 1 workers are started.
+    explicit CmacBatchService(size_t nThreads = 0);
+    ~CmacBatchService();
+
+    CmacBatchService(const CmacBatchService&) = delete;
+    CmacBatchService& operator=(const CmacBatchService&) = delete;
+
+    size_t Threads() const { return queues.size(); }
+
+    // Run: computes the MAC of every job, as CMAC_Batch(jobs, nJobs) would.
+    void Run(const CmacJob* jobs, size_t nJobs);
+
+private:
+    // A run of consecutive jobs in sorted[].
+    struct Task
+    {
+        size_t first;
+        size_t count;
+    };
+
+    // Tasks of one worker, largest first. The owner and thieves both take from
+    // the front, so the largest remaining task is always started next.
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::vector<Task> tasks;
+        size_t head = 0;
+    };
+
+    void WorkerMain(size_t self);
+    void Drain(size_t self);
+    bool TakeTask(size_t victim, Task& task);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::vector<CmacJob> sorted;
+    std::vector<Task> tasks;
+
+    std::mutex stateLock;
+    std::condition_variable startSignal;
+    std::condition_variable doneSignal;
+    unsigned long long generation = 0;
+    bool stopping = false;
+    std::atomic<size_t> pendingTasks{ 0 };
+};
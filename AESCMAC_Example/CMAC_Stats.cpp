@@ -0,0 +1,319 @@
+﻿//
+// Per-thread CMAC counters and latency histograms. See CMAC_Stats.h.
+//
+// Each thread counts into its own block of relaxed atomics, registered in a
+// global list on first use. Only the owning thread writes it, with a plain load
+// and store rather than a locked add, so counting costs about as much as a
+// non-atomic increment; the atomics only make concurrent snapshots well
+// defined. When a thread exits its counts are folded into a shared total.
+
+#include "CMAC_Stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define CMAC_STATS_HAVE_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+static const size_t N_COUNTERS = (size_t)CmacCounter::Count;
+static const size_t N_BACKENDS = (size_t)AES_Backend::TTableBitsliced + 1;
+static const size_t N_TIMERS = (size_t)CmacTimer::Count;
+
+static const char* const CounterNames[N_COUNTERS] = {
+    "key_setups", "subkey_only", "key_expansions", "macs", "mac_bytes", "blocks",
+    "batch_calls", "lane_steps", "lane_blocks", "lane_slots"
+};
+static const char* const BackendNames[N_BACKENDS] = {
+    "reference", "ttable", "aesni", "bitsliced", "bitsliced-sse2", "bitsliced-avx2", "ttable+bitsliced"
+};
+static const char* const TimerNames[N_TIMERS] = { "key_setup", "mac", "oneshot", "expand" };
+
+// ---------------------- Per-Thread Counters ----------------------
+
+#ifdef AESCMAC_INSTRUMENT
+
+struct AtomicHistogram
+{
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> buckets[CMAC_STATS_BUCKETS];
+};
+
+struct ThreadStats
+{
+    bool registered;
+    uint32_t untilSample[N_TIMERS];     // Calls to skip before the next timed one.
+    std::atomic<uint64_t> counters[N_COUNTERS];
+    std::atomic<uint64_t> blocks[N_BACKENDS];
+    AtomicHistogram timers[N_TIMERS];
+};
+
+// Owner-only increment: no other thread writes v (except a reset).
+static void Bump(std::atomic<uint64_t>& v, uint64_t n)
+{
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static void AddInto(CmacStatsSnapshot& total, const ThreadStats& stats)
+{
+    for (size_t i = 0; i < N_COUNTERS; i++)
+        total.counters[i] += stats.counters[i].load(std::memory_order_relaxed);
+    for (size_t i = 0; i < N_BACKENDS; i++)
+        total.blocksByBackend[i] += stats.blocks[i].load(std::memory_order_relaxed);
+    for (size_t t = 0; t < N_TIMERS; t++)
+    {
+        total.timers[t].count += stats.timers[t].count.load(std::memory_order_relaxed);
+        total.timers[t].sum += stats.timers[t].sum.load(std::memory_order_relaxed);
+        for (size_t b = 0; b < CMAC_STATS_BUCKETS; b++)
+            total.timers[t].buckets[b] += stats.timers[t].buckets[b].load(std::memory_order_relaxed);
+    }
+}
+
+static void AddInto(CmacStatsSnapshot& total, const CmacStatsSnapshot& part)
+{
+    for (size_t i = 0; i < N_COUNTERS; i++)
+        total.counters[i] += part.counters[i];
+    for (size_t i = 0; i < N_BACKENDS; i++)
+        total.blocksByBackend[i] += part.blocksByBackend[i];
+    for (size_t t = 0; t < N_TIMERS; t++)
+    {
+        total.timers[t].count += part.timers[t].count;
+        total.timers[t].sum += part.timers[t].sum;
+        for (size_t b = 0; b < CMAC_STATS_BUCKETS; b++)
+            total.timers[t].buckets[b] += part.timers[t].buckets[b];
+    }
+}
+
+static void Clear(ThreadStats& stats)
+{
+    for (auto& v : stats.counters)
+        v.store(0, std::memory_order_relaxed);
+    for (auto& v : stats.blocks)
+        v.store(0, std::memory_order_relaxed);
+    for (auto& timer : stats.timers)
+    {
+        timer.count.store(0, std::memory_order_relaxed);
+        timer.sum.store(0, std::memory_order_relaxed);
+        for (auto& v : timer.buckets)
+            v.store(0, std::memory_order_relaxed);
+    }
+}
+
+// The live threads, and the sum of those that have exited.
+struct StatsRegistry
+{
+    std::mutex lock;
+    std::vector<ThreadStats*> live;
+    CmacStatsSnapshot retired;
+};
+
+// Constructed on first use, so it outlives every thread's ThreadStatsHolder.
+static StatsRegistry& Registry()
+{
+    static StatsRegistry registry = {};
+    return registry;
+}
+
+// Zero-initialized without a constructor, so the hooks reach it without a
+// thread_local initialization guard; the holder below registers it on first
+// use and folds it into the total when the thread exits.
+static thread_local ThreadStats localStats;
+
+static std::atomic<uint32_t> samplePeriod{ 1 };
+
+struct ThreadStatsHolder
+{
+    ThreadStatsHolder()
+    {
+        localStats.registered = true;
+        StatsRegistry& registry = Registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.live.push_back(&localStats);
+    }
+
+    ~ThreadStatsHolder()
+    {
+        StatsRegistry& registry = Registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        AddInto(registry.retired, localStats);
+        for (size_t i = 0; i < registry.live.size(); i++)
+        {
+            if (registry.live[i] == &localStats)
+            {
+                registry.live[i] = registry.live.back();
+                registry.live.pop_back();
+                break;
+            }
+        }
+    }
+};
+
+static ThreadStats& LocalStats()
+{
+    if (!localStats.registered)
+    {
+        thread_local ThreadStatsHolder holder;
+        (void)holder;
+    }
+    return localStats;
+}
+
+void CMAC_StatsAdd(CmacCounter counter, uint64_t n)
+{
+    Bump(LocalStats().counters[(size_t)counter], n);
+}
+
+void CMAC_StatsAddBlocks(AES_Backend backend, uint64_t nBlocks)
+{
+    ThreadStats& stats = LocalStats();
+    Bump(stats.counters[(size_t)CmacCounter::Blocks], nBlocks);
+    Bump(stats.blocks[(size_t)backend], nBlocks);
+}
+
+void CMAC_StatsRecord(CmacTimer timer, uint64_t ticks)
+{
+    AtomicHistogram& histogram = LocalStats().timers[(size_t)timer];
+    size_t bucket = 0;
+    while (bucket < CMAC_STATS_BUCKETS - 1 && (ticks >> bucket) != 0)
+        bucket++;
+    Bump(histogram.count, 1);
+    Bump(histogram.sum, ticks);
+    Bump(histogram.buckets[bucket], 1);
+}
+
+uint64_t CMAC_StatsTimerStart(CmacTimer timer)
+{
+    uint32_t& untilSample = LocalStats().untilSample[(size_t)timer];
+    if (untilSample != 0)
+    {
+        untilSample--;
+        return 0;
+    }
+    untilSample = samplePeriod.load(std::memory_order_relaxed) - 1;
+    uint64_t ticks = CMAC_StatsTicks();
+    return ticks != 0 ? ticks : 1;
+}
+
+uint64_t CMAC_StatsTicks()
+{
+#ifdef CMAC_STATS_HAVE_TSC
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+#endif // AESCMAC_INSTRUMENT
+
+// ---------------------- Snapshots ----------------------
+
+void CMAC_StatsSnapshot(CmacStatsSnapshot& snapshot)
+{
+    memset(&snapshot, 0, sizeof(snapshot));
+#ifdef AESCMAC_INSTRUMENT
+    snapshot.enabled = true;
+    StatsRegistry& registry = Registry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    AddInto(snapshot, registry.retired);
+    for (const ThreadStats* stats : registry.live)
+        AddInto(snapshot, *stats);
+#endif
+}
+
+void CMAC_StatsSetSamplePeriod(uint32_t period)
+{
+#ifdef AESCMAC_INSTRUMENT
+    samplePeriod.store(period == 0 ? 1 : period, std::memory_order_relaxed);
+#else
+    (void)period;
+#endif
+}
+
+void CMAC_StatsReset()
+{
+#ifdef AESCMAC_INSTRUMENT
+    StatsRegistry& registry = Registry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    registry.retired = {};
+    for (ThreadStats* stats : registry.live)
+        Clear(*stats);
+#endif
+}
+
+// Percentile: the upper bound of the bucket holding the p-th fraction of the
+// samples.
+static uint64_t Percentile(const CmacHistogram& histogram, double p)
+{
+    if (histogram.count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p * (double)histogram.count);
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < CMAC_STATS_BUCKETS; b++)
+    {
+        seen += histogram.buckets[b];
+        if (seen >= rank)
+            return b == 0 ? 0 : (1ull << b) - 1;
+    }
+    return ~0ull;
+}
+
+std::string CMAC_StatsJson()
+{
+    CmacStatsSnapshot snapshot;
+    CMAC_StatsSnapshot(snapshot);
+
+    std::string json;
+    char text[128];
+    auto append = [&](const char* format, auto... args)
+    {
+        snprintf(text, sizeof(text), format, args...);
+        json += text;
+    };
+
+    append("{\"enabled\": %s, \"backend\": \"%s\", \"ticks\": \"%s\",\n", snapshot.enabled ? "true" : "false",
+        AES_BackendName(),
+#ifdef CMAC_STATS_HAVE_TSC
+        "tsc"
+#else
+        "ns"
+#endif
+        );
+
+    json += " \"counters\": {";
+    for (size_t i = 0; i < N_COUNTERS; i++)
+        append("%s\"%s\": %llu", i == 0 ? "" : ", ", CounterNames[i], (unsigned long long)snapshot.counters[i]);
+    json += "},\n \"blocks_by_backend\": {";
+    for (size_t i = 0; i < N_BACKENDS; i++)
+        append("%s\"%s\": %llu", i == 0 ? "" : ", ", BackendNames[i], (unsigned long long)snapshot.blocksByBackend[i]);
+    json += "},\n \"timers\": {";
+    for (size_t t = 0; t < N_TIMERS; t++)
+    {
+        const CmacHistogram& h = snapshot.timers[t];
+        append("%s\n  \"%s\": {\"count\": %llu, ", t == 0 ? "" : ",", TimerNames[t], (unsigned long long)h.count);
+        append("\"mean\": %.1f, ", h.count == 0 ? 0.0 : (double)h.sum / (double)h.count);
+        append("\"p50\": %llu, \"p99\": %llu, \"buckets\": [",
+            (unsigned long long)Percentile(h, 0.50), (unsigned long long)Percentile(h, 0.99));
+        // Trailing empty buckets are left out.
+        size_t used = CMAC_STATS_BUCKETS;
+        while (used > 0 && h.buckets[used - 1] == 0)
+            used--;
+        for (size_t b = 0; b < used; b++)
+            append("%s%llu", b == 0 ? "" : ", ", (unsigned long long)h.buckets[b]);
+        json += "]}";
+    }
+    json += "\n }\n}\n";
+    return json;
+}
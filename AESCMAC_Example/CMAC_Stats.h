@@ -0,0 +1,127 @@
+//
+// Optional instrumentation of the CMAC layer: event counters and latency
+// histograms, kept per thread and merged on demand.
+//
+// Build with AESCMAC_INSTRUMENT defined (CMake: -DAESCMAC_INSTRUMENT=ON) to
+// enable it. Without it the hooks below expand to nothing and the snapshot
+// functions report enabled = false with every count zero.
+//
+
+#pragma once
+
+#include "AES.h"
+
+#include <cstdint>
+#include <string>
+
+// Counted events.
+enum class CmacCounter
+{
+    KeySetups,          // CmacKey constructions: key expansion plus K1/K2.
+    SubkeyOnly,         // GenerateSubkeys() calls (expansion plus K1/K2, key discarded).
+    KeyExpansions,      // AES key expansions: CMAC keys, GenerateSubkeys(), CTR, GCM and SIV keys.
+    Macs,               // Messages MACed (CmacKey::Mac, CmacStream::Final, CMAC_Batch jobs).
+    MacBytes,           // Message bytes MACed.
+    Blocks,             // AES block encryptions issued by the CMAC layer and by CTR, GCM and SIV.
+    BatchCalls,         // CMAC_Batch calls.
+    LaneSteps,          // cbcMacLanes calls made by CMAC_Batch.
+    LaneBlocks,         // Blocks those calls processed, over all lanes.
+    LaneSlots,          // Blocks they could have processed with every lane busy.
+    Count
+};
+
+// Timed operations; each has a histogram of TSC ticks (wall-clock ns where
+// there is no TSC) in power-of-two buckets. Only one call in the sample period
+// (CMAC_StatsSetSamplePeriod) is timed; the counters above count every call.
+enum class CmacTimer
+{
+    KeySetup,           // CmacKey construction.
+    Mac,                // CmacKey::Mac over a message, key already set up.
+    OneShot,            // CMAC() with a raw key: KeySetup + Mac + wiping.
+    Expand,             // One AES key expansion (part of KeySetup for CMAC keys).
+    Count
+};
+
+const size_t CMAC_STATS_BUCKETS = 64;
+
+struct CmacHistogram
+{
+    uint64_t count;                         // Timed (sampled) calls.
+    uint64_t sum;                           // Total ticks.
+    uint64_t buckets[CMAC_STATS_BUCKETS];   // buckets[i]: ticks in [2^(i-1), 2^i), buckets[0]: 0 ticks.
+};
+
+struct CmacStatsSnapshot
+{
+    bool enabled;
+    uint64_t counters[(size_t)CmacCounter::Count];
+    uint64_t blocksByBackend[(size_t)AES_Backend::TTableBitsliced + 1];   // Blocks, by the engine that ran them.
+    CmacHistogram timers[(size_t)CmacTimer::Count];
+};
+
+// CMAC_StatsSnapshot: sums the counters of every thread, live or exited.
+// Threads keep counting while the snapshot is taken, so it is consistent per
+// counter, not across counters.
+void CMAC_StatsSnapshot(CmacStatsSnapshot& snapshot);
+
+// CMAC_StatsJson: the snapshot as a JSON object, with the mean and the
+// bucket-bound 50th and 99th percentiles of each timer.
+std::string CMAC_StatsJson();
+
+// CMAC_StatsSetSamplePeriod: times one call in period per thread and timer
+// (1, the default, times every call). Reading the TSC twice costs tens of ns
+// on some virtual machines, which matters next to a 64-byte MAC.
+void CMAC_StatsSetSamplePeriod(uint32_t period);
+
+// CMAC_StatsReset: zeroes every counter. Counts made by other threads while
+// the reset runs may survive it.
+void CMAC_StatsReset();
+
+// ---------------------- Hooks ----------------------
+
+#ifdef AESCMAC_INSTRUMENT
+
+void CMAC_StatsAdd(CmacCounter counter, uint64_t n);
+void CMAC_StatsAddBlocks(AES_Backend backend, uint64_t nBlocks);
+void CMAC_StatsRecord(CmacTimer timer, uint64_t ticks);
+uint64_t CMAC_StatsTicks();
+// The start time of a sampled call, or 0 if this call is not timed.
+uint64_t CMAC_StatsTimerStart(CmacTimer timer);
+
+// Records the ticks from construction to destruction under timer, for the
+// calls picked by the sample period.
+class CmacScopedTimer
+{
+public:
+    explicit CmacScopedTimer(CmacTimer timer) : timer(timer), start(CMAC_StatsTimerStart(timer)) {}
+    ~CmacScopedTimer()
+    {
+        if (start != 0)
+            CMAC_StatsRecord(timer, CMAC_StatsTicks() - start);
+    }
+
+private:
+    CmacTimer timer;
+    uint64_t start;
+};
+
+#define CMAC_STATS_COUNT(counter, n) CMAC_StatsAdd(CmacCounter::counter, (uint64_t)(n))
+#define CMAC_STATS_BLOCKS(engine, n) CMAC_StatsAddBlocks((engine).backend, (uint64_t)(n))
+#define CMAC_STATS_TIME(timer) CmacScopedTimer cmacStatsTimer_##timer(CmacTimer::timer)
+
+#else
+
+#define CMAC_STATS_COUNT(counter, n) ((void)0)
+#define CMAC_STATS_BLOCKS(engine, n) ((void)0)
+#define CMAC_STATS_TIME(timer) ((void)0)
+
+#endif
+
+// CMAC_ExpandKey: cipher.expandKey(key, rk), counted as KeyExpansions and
+// timed as Expand. Every key expansion of the library goes through it.
+inline void CMAC_ExpandKey(const AES_Cipher& cipher, const byte* key, AES_RoundKeys& rk)
+{
+    CMAC_STATS_TIME(Expand);
+    CMAC_STATS_COUNT(KeyExpansions, 1);
+    cipher.expandKey(key, rk);
+}
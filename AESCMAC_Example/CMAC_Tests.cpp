@@ -0,0 +1,618 @@
+﻿//
+// Known-answer tests: the CMAC examples of NIST SP 800-38B (Appendix D) for
+// AES-128, AES-192 and AES-256, run on every AES backend the CPU supports and
+// through every CMAC entry point (CMAC, CmacKey, CmacStream, CMAC_Batch and
+// the segmented CmacKey::Mac). CMAC_KDF_Batch and CmacTreeKey are checked
+// against rebuilds of their constructions from plain CMAC calls, the tree on
+// one thread and on several. CmacBatchService is run repeatedly over jobs of
+// mixed key sizes and checked against CMAC(). CmacKeyCache is checked for
+// tags, LRU order and counters, under concurrent use, and for an Invalidate()
+// racing a load. With AESCMAC_INSTRUMENT the CMAC_Stats counters are checked
+// against a known sequence of CMAC, CTR, GCM and SIV calls.
+//
+// Exits with status 1 if any tag differs.
+
+#include "AES_Modes.h"
+#include "AES_SIV.h"
+#include "CMAC.h"
+#include "CMAC_KDF.h"
+#include "CMAC_KeyCache.h"
+#include "CMAC_Stats.h"
+#include "CMAC_Tree.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// ---------------------- Test Vectors ----------------------
+
+// The example message; the tests use its first 0, 16, 40 and 64 bytes.
+static const byte Message[64] = {
+    0x6b,0xc1,0xbe,0xe2,0x2e,0x40,0x9f,0x96,0xe9,0x3d,0x7e,0x11,0x73,0x93,0x17,0x2a,
+    0xae,0x2d,0x8a,0x57,0x1e,0x03,0xac,0x9c,0x9e,0xb7,0x6f,0xac,0x45,0xaf,0x8e,0x51,
+    0x30,0xc8,0x1c,0x46,0xa3,0x5c,0xe4,0x11,0xe5,0xfb,0xc1,0x19,0x1a,0x0a,0x52,0xef,
+    0xf6,0x9f,0x24,0x45,0xdf,0x4f,0x9b,0x17,0xad,0x2b,0x41,0x7b,0xe6,0x6c,0x37,0x10
+};
+
+static const size_t MessageLens[4] = { 0, 16, 40, 64 };
+
+struct CmacVector
+{
+    AES_KeySize keySize;
+    byte key[32];
+    byte tags[4][16];   // One tag per entry of MessageLens.
+};
+
+static const CmacVector Vectors[] = {
+    {
+        AES_KeySize::AES128,
+        { 0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c },
+        {
+            { 0xbb,0x1d,0x69,0x29,0xe9,0x59,0x37,0x28,0x7f,0xa3,0x7d,0x12,0x9b,0x75,0x67,0x46 },
+            { 0x07,0x0a,0x16,0xb4,0x6b,0x4d,0x41,0x44,0xf7,0x9b,0xdd,0x9d,0xd0,0x4a,0x28,0x7c },
+            { 0xdf,0xa6,0x67,0x47,0xde,0x9a,0xe6,0x30,0x30,0xca,0x32,0x61,0x14,0x97,0xc8,0x27 },
+            { 0x51,0xf0,0xbe,0xbf,0x7e,0x3b,0x9d,0x92,0xfc,0x49,0x74,0x17,0x79,0x36,0x3c,0xfe }
+        }
+    },
+    {
+        AES_KeySize::AES192,
+        { 0x8e,0x73,0xb0,0xf7,0xda,0x0e,0x64,0x52,0xc8,0x10,0xf3,0x2b,0x80,0x90,0x79,0xe5,
+          0x62,0xf8,0xea,0xd2,0x52,0x2c,0x6b,0x7b },
+        {
+            { 0xd1,0x7d,0xdf,0x46,0xad,0xaa,0xcd,0xe5,0x31,0xca,0xc4,0x83,0xde,0x7a,0x93,0x67 },
+            { 0x9e,0x99,0xa7,0xbf,0x31,0xe7,0x10,0x90,0x06,0x62,0xf6,0x5e,0x61,0x7c,0x51,0x84 },
+            { 0x8a,0x1d,0xe5,0xbe,0x2e,0xb3,0x1a,0xad,0x08,0x9a,0x82,0xe6,0xee,0x90,0x8b,0x0e },
+            { 0xa1,0xd5,0xdf,0x0e,0xed,0x79,0x0f,0x79,0x4d,0x77,0x58,0x96,0x59,0xf3,0x9a,0x11 }
+        }
+    },
+    {
+        AES_KeySize::AES256,
+        { 0x60,0x3d,0xeb,0x10,0x15,0xca,0x71,0xbe,0x2b,0x73,0xae,0xf0,0x85,0x7d,0x77,0x81,
+          0x1f,0x35,0x2c,0x07,0x3b,0x61,0x08,0xd7,0x2d,0x98,0x10,0xa3,0x09,0x14,0xdf,0xf4 },
+        {
+            { 0x02,0x89,0x62,0xf6,0x1b,0x7b,0xf8,0x9e,0xfc,0x6b,0x55,0x1f,0x46,0x67,0xd9,0x83 },
+            { 0x28,0xa7,0x02,0x3f,0x45,0x2e,0x8f,0x82,0xbd,0x4b,0xf2,0x8d,0x8c,0x37,0xc3,0x5c },
+            { 0xaa,0xf3,0xd8,0xf1,0xde,0x56,0x40,0xc2,0x32,0xf5,0xb1,0x69,0xb9,0xc9,0x11,0xe6 },
+            { 0xe1,0x99,0x21,0x90,0x54,0x9f,0x6e,0xd5,0x69,0x6a,0x2c,0x05,0x6c,0x31,0x54,0x10 }
+        }
+    }
+};
+
+// ---------------------- Checks ----------------------
+
+static int failures = 0;
+
+static void Check(const char* backend, const char* api, const CmacVector& v, size_t len, const byte* mac, const byte* expected)
+{
+    if (memcmp(mac, expected, 16) == 0)
+        return;
+    failures++;
+    printf("FAIL %s %s AES-%d Mlen=%zu: got ", backend, api, (int)v.keySize * 8, len * 8);
+    for (int i = 0; i < 16; i++)
+        printf("%02x", mac[i]);
+    printf("\n");
+}
+
+// The template entry point for a run-time key size.
+static void CmacFor(AES_KeySize keySize, const byte* key, const byte* message, size_t messageLen, byte mac[16])
+{
+    switch (keySize)
+    {
+    case AES_KeySize::AES128: CMAC<128>(key, message, messageLen, 128, mac); break;
+    case AES_KeySize::AES192: CMAC<192>(key, message, messageLen, 128, mac); break;
+    case AES_KeySize::AES256: CMAC<256>(key, message, messageLen, 128, mac); break;
+    }
+}
+
+static void TestBackend(const char* backend)
+{
+    for (const CmacVector& v : Vectors)
+    {
+        CmacKey key(v.key, v.keySize);
+        byte macs[4][16];
+        CmacJob jobs[4];
+
+        for (int t = 0; t < 4; t++)
+        {
+            size_t len = MessageLens[t];
+            byte mac[16];
+
+            CmacFor(v.keySize, v.key, Message, len, mac);
+            Check(backend, "CMAC", v, len, mac, v.tags[t]);
+
+            key.Mac(Message, len, 128, mac);
+            Check(backend, "CmacKey::Mac", v, len, mac, v.tags[t]);
+            if (!key.Verify(Message, len, v.tags[t], 128))
+            {
+                failures++;
+                printf("FAIL %s CmacKey::Verify AES-%d Mlen=%zu\n", backend, (int)v.keySize * 8, len * 8);
+            }
+
+            // Feed the message one byte at a time.
+            CmacStream stream(key);
+            for (size_t i = 0; i < len; i++)
+                stream.Update(Message + i, 1);
+            stream.Final(128, mac);
+            Check(backend, "CmacStream", v, len, mac, v.tags[t]);
+
+            // Three segments at every pair of split points, so block boundaries
+            // (including the final partial block) fall inside and between them.
+            for (size_t a = 0; a <= len; a++)
+            {
+                for (size_t b = a; b <= len; b++)
+                {
+                    CmacSegment segments[3] = { { Message, a }, { Message + a, b - a }, { Message + b, len - b } };
+                    key.Mac(segments, 3, 128, mac);
+                    Check(backend, "CmacKey::Mac(segments)", v, len, mac, v.tags[t]);
+                }
+            }
+
+            jobs[t] = { &key, Message, len, 128, macs[t] };
+        }
+
+        CMAC_Batch(jobs, 4);
+        for (int t = 0; t < 4; t++)
+            Check(backend, "CMAC_Batch", v, MessageLens[t], macs[t], v.tags[t]);
+    }
+}
+
+// ---------------------- KDF ----------------------
+
+// KdfReference: SP 800-108 counter mode with one CMAC() call per PRF block.
+static void KdfReference(const CmacVector& v, const KdfRequest& request, byte* out)
+{
+    std::vector<byte> input(4 + request.labelLen + 1 + request.contextLen + 4);
+    size_t L = request.outLen * 8;
+    for (size_t i = 0; 16 * i < request.outLen; i++)
+    {
+        byte* p = input.data();
+        p[0] = 0; p[1] = 0; p[2] = (byte)((i + 1) >> 8); p[3] = (byte)(i + 1);
+        memcpy(p + 4, request.label, request.labelLen);
+        p[4 + request.labelLen] = 0x00;
+        memcpy(p + 5 + request.labelLen, request.context, request.contextLen);
+        p = input.data() + input.size() - 4;
+        p[0] = (byte)(L >> 24); p[1] = (byte)(L >> 16); p[2] = (byte)(L >> 8); p[3] = (byte)L;
+
+        byte block[16];
+        CmacFor(v.keySize, v.key, input.data(), input.size(), block);
+        size_t n = request.outLen - 16 * i < 16 ? request.outLen - 16 * i : 16;
+        memcpy(out + 16 * i, block, n);
+    }
+}
+
+static void TestKdf(const char* backend)
+{
+    static const size_t outLens[] = { 1, 16, 17, 24, 32, 40, 64, 100 };
+    std::vector<byte> text(6000);
+    for (size_t i = 0; i < text.size(); i++)
+        text[i] = (byte)(i * 17 + 3);
+
+    for (const CmacVector& v : Vectors)
+    {
+        CmacKey key(v.key, v.keySize);
+
+        // Enough requests for several CMAC_Batch groups, plus one whose PRF
+        // input does not fit the scratch buffer.
+        std::vector<KdfRequest> requests;
+        size_t total = 0;
+        for (size_t r = 0; r < 150; r++)
+        {
+            KdfRequest request = { text.data() + r, r % 23, text.data() + 1000 + r, (r * 7) % 41, outLens[r % 8] };
+            if (r == 75)
+                request.labelLen = 5000;
+            requests.push_back(request);
+            total += request.outLen;
+        }
+
+        std::vector<byte> arena(total), expected(total);
+        size_t written = CMAC_KDF_Batch(key, requests.data(), requests.size(), arena.data(), arena.size());
+        size_t offset = 0;
+        for (const KdfRequest& request : requests)
+        {
+            KdfReference(v, request, &expected[offset]);
+            offset += request.outLen;
+        }
+        if (written != total || arena != expected)
+        {
+            failures++;
+            printf("FAIL %s CMAC_KDF_Batch AES-%d\n", backend, (int)v.keySize * 8);
+        }
+
+        byte out[40];
+        bool derived = CMAC_KDF(key, requests[5].label, requests[5].labelLen, requests[5].context,
+                                requests[5].contextLen, out, 40);
+        KdfRequest single = requests[5];
+        single.outLen = 40;
+        std::vector<byte> reference(40);
+        KdfReference(v, single, reference.data());
+        if (!derived || memcmp(out, reference.data(), 40) != 0)
+        {
+            failures++;
+            printf("FAIL %s CMAC_KDF AES-%d\n", backend, (int)v.keySize * 8);
+        }
+
+        if (CMAC_KDF_Batch(key, requests.data(), requests.size(), arena.data(), total - 1) != 0)
+        {
+            failures++;
+            printf("FAIL %s CMAC_KDF_Batch accepted a short arena\n", backend);
+        }
+
+        // L = 8 * outLen must fit [L]_32: outLen 0 and 2^29 are refused before
+        // anything is written, so the arena can stay small.
+        KdfRequest bad = requests[0];
+        for (size_t outLen : { (size_t)0, CMAC_KDF_MAX_OUT_LEN + 1 })
+        {
+            bad.outLen = outLen;
+            std::vector<KdfRequest> withBad = requests;
+            withBad[3] = bad;
+            byte before = arena[0];
+            if (CMAC_KDF_Batch(key, withBad.data(), withBad.size(), arena.data(), (size_t)-1) != 0 ||
+                CMAC_KDF(key, bad.label, bad.labelLen, bad.context, bad.contextLen, out, outLen) || arena[0] != before)
+            {
+                failures++;
+                printf("FAIL %s CMAC_KDF accepted outLen=%zu\n", backend, outLen);
+            }
+        }
+    }
+}
+
+// ---------------------- Key Cache ----------------------
+
+// Key IDs 0-2 are the test vectors; any other ID below 1000 gets a generated
+// AES-128 key, and IDs from 1000 do not exist.
+static bool LoadTestKey(void* context, uint64_t keyId, byte key[32], AES_KeySize& keySize)
+{
+    (void)context;
+    if (keyId < 3)
+    {
+        memcpy(key, Vectors[keyId].key, 32);
+        keySize = Vectors[keyId].keySize;
+        return true;
+    }
+    if (keyId >= 1000)
+        return false;
+    for (int i = 0; i < 16; i++)
+        key[i] = (byte)(keyId * 13 + i);
+    keySize = AES_KeySize::AES128;
+    return true;
+}
+
+// A loader that stops inside the load until told to go on, so a test can
+// rotate the key while it runs. The key bytes are derived from version.
+struct SlowKeySource
+{
+    std::atomic<int> version{ 0 };
+    std::atomic<bool> loading{ false };
+    std::atomic<bool> proceed{ false };
+};
+
+static bool LoadSlowKey(void* context, uint64_t keyId, byte key[32], AES_KeySize& keySize)
+{
+    SlowKeySource& source = *static_cast<SlowKeySource*>(context);
+    int version = source.version.load();
+    source.loading = true;
+    while (!source.proceed)
+        std::this_thread::yield();
+    for (int i = 0; i < 16; i++)
+        key[i] = (byte)(keyId + version * 31 + i);
+    keySize = AES_KeySize::AES128;
+    return true;
+}
+
+// An Invalidate() that lands while the old key is being loaded must not be
+// undone by the load putting the old key into the cache.
+static void TestKeyCacheRotation(const char* backend)
+{
+    SlowKeySource source;
+    CmacKeyCache cache(4, LoadSlowKey, &source, 1);
+
+    std::thread reader([&]() { cache.Acquire(7); });
+    while (!source.loading)
+        std::this_thread::yield();
+    source.version = 1;
+    cache.Invalidate(7);
+    source.proceed = true;
+    reader.join();
+
+    byte key[32], expected[16], mac[16];
+    AES_KeySize keySize;
+    LoadSlowKey(&source, 7, key, keySize);
+    CmacFor(keySize, key, Message, 40, expected);
+    if (!cache.Mac(7, Message, 40, 128, mac) || memcmp(mac, expected, 16) != 0 || cache.GetStats().misses != 2)
+    {
+        failures++;
+        printf("FAIL %s CmacKeyCache kept a key invalidated during its load\n", backend);
+    }
+}
+
+static void TestKeyCache(const char* backend)
+{
+    TestKeyCacheRotation(backend);
+
+    // One shard of four keys, so the LRU order is fully predictable.
+    CmacKeyCache cache(4, LoadTestKey, nullptr, 1);
+    for (int round = 0; round < 2; round++)
+    {
+        for (uint64_t id = 0; id < 3; id++)
+        {
+            const CmacVector& v = Vectors[id];
+            byte mac[16];
+            if (!cache.Mac(id, Message, 64, 128, mac))
+                memset(mac, 0, sizeof(mac));
+            Check(backend, "CmacKeyCache::Mac", v, 64, mac, v.tags[3]);
+        }
+    }
+
+    // Key 10 fills the cache, 11 evicts the least recently used key (0).
+    cache.Acquire(10);
+    cache.Acquire(1);
+    cache.Acquire(11);
+    CmacKeyCache::Stats stats = cache.GetStats();
+    bool ok = stats.hits == 4 && stats.misses == 5 && stats.evictions == 1 && stats.size == 4;
+    cache.Acquire(1);
+    ok = ok && cache.GetStats().hits == 5;
+    cache.Acquire(0);
+    ok = ok && cache.GetStats().misses == 6;
+
+    ok = ok && !cache.Acquire(1000) && !cache.Mac(1001, Message, 16, 128, nullptr);
+    cache.Invalidate(1);
+    ok = ok && cache.GetStats().size == 3;
+    cache.Clear();
+    ok = ok && cache.GetStats().size == 0;
+    if (!ok)
+    {
+        failures++;
+        printf("FAIL %s CmacKeyCache LRU/counters\n", backend);
+    }
+
+    // Several threads over more keys than fit, so hits, misses and evictions
+    // race with each other.
+    CmacKeyCache shared(16, LoadTestKey, nullptr, 4);
+    int threadFailures[4] = { 0 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&, t]()
+            {
+                for (unsigned i = 0; i < 2000; i++)
+                {
+                    uint64_t id = 3 + (i * 7 + t) % 40;
+                    byte key[32], expected[16], mac[16];
+                    AES_KeySize keySize;
+                    LoadTestKey(nullptr, id, key, keySize);
+                    CmacFor(keySize, key, Message, 40, expected);
+                    if (!shared.Mac(id, Message, 40, 128, mac) || memcmp(mac, expected, 16) != 0)
+                        threadFailures[t]++;
+                }
+            });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    stats = shared.GetStats();
+    if (threadFailures[0] + threadFailures[1] + threadFailures[2] + threadFailures[3] != 0 ||
+        stats.hits + stats.misses != 8000 || stats.size > 16)
+    {
+        failures++;
+        printf("FAIL %s CmacKeyCache concurrent\n", backend);
+    }
+}
+
+// ---------------------- Instrumentation ----------------------
+
+static void TestStats(const char* backend)
+{
+    CmacStatsSnapshot s;
+    CMAC_StatsReset();
+    CMAC_StatsSnapshot(s);
+#ifndef AESCMAC_INSTRUMENT
+    if (s.enabled || s.counters[(size_t)CmacCounter::Macs] != 0 ||
+        CMAC_StatsJson().find("\"enabled\": false") == std::string::npos)
+    {
+        failures++;
+        printf("FAIL %s CMAC_Stats reports data without AESCMAC_INSTRUMENT\n", backend);
+    }
+#else
+    const CmacVector& v = Vectors[0];
+    byte mac[16];
+    CmacFor(v.keySize, v.key, Message, 64, mac);   // 1 setup, 1 + 4 blocks
+    CmacKey key(v.key, v.keySize);                  // 1 setup, 1 block
+    CmacStream stream(key);
+    stream.Update(Message, 40);                     // 2 blocks, 8 held back
+    stream.Final(128, mac);                         // 1 block
+    CmacJob jobs[3] = { { &key, Message, 0, 128, mac }, { &key, Message, 16, 128, mac }, { &key, Message, 64, 128, mac } };
+    CMAC_Batch(jobs, 3);                            // 1 + 1 + 4 blocks
+
+    // Counts from another thread survive its exit.
+    std::thread([&]() { byte K1[16], K2[16]; GenerateSubkeys(v.key, K1, K2); }).join();
+
+    CMAC_StatsSnapshot(s);
+    const uint64_t* c = s.counters;
+    bool ok = s.enabled &&
+        c[(size_t)CmacCounter::KeySetups] == 2 && c[(size_t)CmacCounter::SubkeyOnly] == 1 &&
+        c[(size_t)CmacCounter::KeyExpansions] == 3 && s.timers[(size_t)CmacTimer::Expand].count == 3 &&
+        c[(size_t)CmacCounter::Macs] == 5 && c[(size_t)CmacCounter::MacBytes] == 64 + 40 + 80 &&
+        c[(size_t)CmacCounter::Blocks] == 16 && c[(size_t)CmacCounter::BatchCalls] == 1 &&
+        c[(size_t)CmacCounter::LaneBlocks] == 6 &&
+        c[(size_t)CmacCounter::LaneSlots] >= c[(size_t)CmacCounter::LaneBlocks] &&
+        s.blocksByBackend[(size_t)AES_GetEngine().backend] == 16 &&
+        s.timers[(size_t)CmacTimer::KeySetup].count == 2 && s.timers[(size_t)CmacTimer::OneShot].count == 1 &&
+        s.timers[(size_t)CmacTimer::Mac].count == 1;
+    if (!ok)
+    {
+        failures++;
+        printf("FAIL %s CMAC_Stats counters:\n%s", backend, CMAC_StatsJson().c_str());
+    }
+
+    // CTR, GCM and SIV count their key expansions and AES blocks too.
+    CMAC_StatsReset();
+    byte counter[16] = { 0 }, out[16 + 40], tag[16];
+    AesCtrKey ctr(v.key, v.keySize);                // 1 expansion
+    ctr.Crypt(counter, Message, out, 40);           // 3 blocks
+    AesGcmKey gcm(v.key, v.keySize);                // 1 expansion, 1 block (H)
+    gcm.Encrypt(Message, 12, nullptr, 0, Message, 40, out, tag);   // 3 blocks + E(J0)
+    CMAC_StatsSnapshot(s);
+    ok = c[(size_t)CmacCounter::KeyExpansions] == 2 && s.timers[(size_t)CmacTimer::Expand].count == 2 &&
+        c[(size_t)CmacCounter::Blocks] == 8 && s.blocksByBackend[(size_t)AES_GetEngine().backend] == 8;
+
+    // SIV: a CMAC key and a CTR key; S2V over the empty AD list and 40 bytes
+    // of plaintext is 1 + 3 CMAC blocks, CTR 3 more.
+    CMAC_StatsReset();
+    byte sivKey[64];
+    memcpy(sivKey, v.key, (size_t)v.keySize);
+    memcpy(sivKey + (size_t)v.keySize, v.key, (size_t)v.keySize);
+    AesSivKey siv(sivKey, v.keySize);               // 2 expansions, 1 block (L)
+    siv.Encrypt(nullptr, 0, Message, 40, out);
+    CMAC_StatsSnapshot(s);
+    ok = ok && c[(size_t)CmacCounter::KeyExpansions] == 2 && c[(size_t)CmacCounter::Blocks] == 1 + 4 + 3;
+    if (!ok)
+    {
+        failures++;
+        printf("FAIL %s CMAC_Stats counters of CTR, GCM or SIV:\n%s", backend, CMAC_StatsJson().c_str());
+    }
+#endif
+}
+
+// ---------------------- Batch Service ----------------------
+
+// Repeated Run() calls over jobs of all three key sizes, so the key-size sort,
+// the task cutting and the hand-over between batches are all exercised.
+static void TestBatchService(const char* backend)
+{
+    std::vector<byte> message(1000);
+    for (size_t i = 0; i < message.size(); i++)
+        message[i] = (byte)(i * 7 + (i >> 5));
+
+    CmacKey keys[3] = {
+        CmacKey(Vectors[0].key, Vectors[0].keySize),
+        CmacKey(Vectors[1].key, Vectors[1].keySize),
+        CmacKey(Vectors[2].key, Vectors[2].keySize)
+    };
+
+    const size_t nJobs = 100;
+    std::vector<byte> expected(16 * nJobs), macs(16 * nJobs);
+    std::vector<CmacJob> jobs(nJobs);
+    for (size_t j = 0; j < nJobs; j++)
+    {
+        const CmacVector& v = Vectors[j % 3];
+        size_t len = (j * 37) % message.size();
+        CmacFor(v.keySize, v.key, message.data(), len, &expected[16 * j]);
+        jobs[j] = { &keys[j % 3], message.data(), len, 128, &macs[16 * j] };
+    }
+
+    for (size_t threads = 2; threads <= 16; threads *= 2)
+    {
+        CmacBatchService service(threads);
+        for (int round = 0; round < 100; round++)
+        {
+            memset(macs.data(), 0, macs.size());
+            service.Run(jobs.data(), nJobs);
+            for (size_t j = 0; j < nJobs; j++)
+                Check(backend, "CmacBatchService::Run", Vectors[j % 3], jobs[j].messageLen, &macs[16 * j], &expected[16 * j]);
+        }
+    }
+}
+
+// ---------------------- CMAC-Tree ----------------------
+
+// TreeMacReference: the CMAC-Tree tag computed step by step as CMAC_Tree.h
+// defines it, with one CMAC() call per PRF output, leaf and root.
+static void TreeMacReference(const CmacVector& v, size_t leafSize, const byte* message, size_t len, byte mac[16])
+{
+    static const char* labels[2] = { "CMAC-Tree leaf", "CMAC-Tree root" };
+    size_t keyBits = (size_t)v.keySize * 8;
+
+    byte keys[2][32];
+    for (int k = 0; k < 2; k++)
+    {
+        for (size_t i = 0; i * 128 < keyBits; i++)
+        {
+            // [i]_32 || Label || 0x00 || [L]_32
+            byte input[23] = { 0, 0, 0, (byte)(i + 1) };
+            memcpy(input + 4, labels[k], 14);
+            input[18] = 0x00;
+            input[19] = 0;
+            input[20] = 0;
+            input[21] = (byte)(keyBits >> 8);
+            input[22] = (byte)keyBits;
+            CmacFor(v.keySize, v.key, input, sizeof(input), keys[k] + 16 * i);
+        }
+    }
+
+    size_t nLeaves = len == 0 ? 1 : (len + leafSize - 1) / leafSize;
+    std::vector<byte> root(16 + 16 * nLeaves, 0);
+    for (int i = 0; i < 8; i++)
+    {
+        root[7 - i] = (byte)((unsigned long long)leafSize >> (8 * i));
+        root[15 - i] = (byte)((unsigned long long)len >> (8 * i));
+    }
+    for (size_t i = 0; i < nLeaves; i++)
+    {
+        size_t offset = i * leafSize;
+        size_t leafLen = len - offset < leafSize ? len - offset : leafSize;
+        CmacFor(v.keySize, keys[0], message + offset, leafLen, &root[16 + 16 * i]);
+    }
+    CmacFor(v.keySize, keys[1], root.data(), root.size(), mac);
+}
+
+static void TestTree(const char* backend)
+{
+    const size_t leafSize = 4096;
+    static const size_t lengths[] = { 0, 1, leafSize, leafSize + 1, 5 * leafSize + 7, 37 * leafSize };
+
+    std::vector<byte> message(37 * leafSize);
+    for (size_t i = 0; i < message.size(); i++)
+        message[i] = (byte)(i * 31 + (i >> 8));
+
+    for (const CmacVector& v : Vectors)
+    {
+        CmacTreeKey key(v.key, v.keySize, leafSize);
+        for (size_t len : lengths)
+        {
+            byte expected[16], mac[16];
+            TreeMacReference(v, leafSize, message.data(), len, expected);
+
+            key.Mac(message.data(), len, 128, mac);
+            Check(backend, "CmacTreeKey::Mac", v, len, mac, expected);
+
+            // The tag must not depend on the thread count.
+            for (size_t threads = 2; threads <= 4; threads++)
+            {
+                CmacBatchService service(threads);
+                key.Mac(service, message.data(), len, 128, mac);
+                Check(backend, "CmacTreeKey::Mac(service)", v, len, mac, expected);
+            }
+        }
+    }
+}
+
+int main()
+{
+    static const AES_Backend backends[] = {
+        AES_Backend::Reference, AES_Backend::TTable, AES_Backend::AESNI,
+        AES_Backend::Bitsliced, AES_Backend::BitslicedSSE2, AES_Backend::BitslicedAVX2,
+        AES_Backend::TTableBitsliced
+    };
+
+    for (AES_Backend backend : backends)
+    {
+        if (!AES_SelectBackend(backend))
+            continue;
+        printf("testing %s\n", AES_BackendName());
+        TestBackend(AES_BackendName());
+        TestKdf(AES_BackendName());
+        TestKeyCache(AES_BackendName());
+        TestStats(AES_BackendName());
+        TestBatchService(AES_BackendName());
+        TestTree(AES_BackendName());
+    }
+
+    if (failures != 0)
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
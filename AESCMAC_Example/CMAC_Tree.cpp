@@ -0,0 +1,81 @@
+﻿//
+// CMAC-Tree (see CMAC_Tree.h for the construction).
+//
+// The leaf tags are collected in one buffer that is then the tail of the root
+// message, so the root CMAC is two segments: the 16-byte header and the tags.
+
+#include "CMAC_Tree.h"
+#include "CMAC_KDF.h"
+
+#include <cstring>
+#include <vector>
+
+static const char LeafLabel[] = "CMAC-Tree leaf";
+static const char RootLabel[] = "CMAC-Tree root";
+
+// StoreBigEndian: writes the low n bytes of value, most significant first.
+static void StoreBigEndian(unsigned long long value, byte* out, int n)
+{
+    for (int i = n - 1; i >= 0; i--)
+    {
+        out[i] = (byte)value;
+        value >>= 8;
+    }
+}
+
+// DeriveKey: a key of the same size as key for the given label (empty context).
+static CmacKey DeriveKey(const CmacKey& key, const char* label)
+{
+    byte derived[32];
+    CMAC_KDF(key, (const byte*)label, strlen(label), nullptr, 0, derived, (size_t)key.KeySize());
+    CmacKey result(derived, key.KeySize());
+    SecureZero(derived, sizeof(derived));
+    return result;
+}
+
+CmacTreeKey::CmacTreeKey(const byte* key, AES_KeySize keySize, size_t leafSize)
+    : CmacTreeKey(CmacKey(key, keySize), leafSize)
+{
+}
+
+CmacTreeKey::CmacTreeKey(const CmacKey& key, size_t leafSize)
+    : leafKey(DeriveKey(key, LeafLabel)),
+      rootKey(DeriveKey(key, RootLabel)),
+      leafSize(leafSize != 0 ? leafSize : DEFAULT_LEAF_SIZE)
+{
+}
+
+void CmacTreeKey::Mac(const byte* message, size_t messageLen, int Tlen, byte mac[16]) const
+{
+    MacLeaves(nullptr, message, messageLen, Tlen, mac);
+}
+
+void CmacTreeKey::Mac(CmacBatchService& service, const byte* message, size_t messageLen, int Tlen, byte mac[16]) const
+{
+    MacLeaves(&service, message, messageLen, Tlen, mac);
+}
+
+void CmacTreeKey::MacLeaves(CmacBatchService* service, const byte* message, size_t messageLen, int Tlen, byte mac[16]) const
+{
+    size_t nLeaves = messageLen == 0 ? 1 : (messageLen - 1) / leafSize + 1;
+
+    std::vector<byte> tags(16 * nLeaves);
+    std::vector<CmacJob> jobs(nLeaves);
+    for (size_t i = 0; i < nLeaves; i++)
+    {
+        size_t offset = i * leafSize;
+        size_t len = messageLen - offset < leafSize ? messageLen - offset : leafSize;
+        jobs[i] = { &leafKey, message + offset, len, 128, &tags[16 * i] };
+    }
+
+    if (service != nullptr)
+        service->Run(jobs.data(), nLeaves);
+    else
+        CMAC_Batch(jobs.data(), nLeaves);
+
+    byte header[16];
+    StoreBigEndian(leafSize, header, 8);
+    StoreBigEndian(messageLen, header + 8, 8);
+    CmacSegment root[2] = { { header, 16 }, { tags.data(), tags.size() } };
+    rootKey.Mac(root, 2, Tlen, mac);
+}
@@ -0,0 +1,57 @@
+//
+// CMAC-Tree: a parallelizable MAC for large objects built from AES-CMAC.
+//
+
+#pragma once
+
+#include "CMAC.h"
+#include "CMAC_Parallel.h"
+
+// CmacTreeKey: a MAC over a two-level tree of CMACs, so that one large object
+// can be hashed on every core. A plain CMAC of the object is a single CBC chain
+// and never runs on more than one.
+//
+// With K the key and L its length in bits:
+//
+//  1. Derive two keys with the SP 800-108 counter-mode KDF (CMAC_KDF):
+//       KDF(K, Label) = first L bits of K(1) || K(2), where
+//       K(i) = CMAC(K, [i]_32 || Label || 0x00 || [L]_32)
+//     Kleaf = KDF(K, "CMAC-Tree leaf"), Kroot = KDF(K, "CMAC-Tree root").
+//  2. Cut the message M into leaves of leafSize bytes; the last leaf may be
+//     shorter, and an empty M is one empty leaf. Ti = CMAC(Kleaf, leaf i).
+//  3. T = CMAC(Kroot, [leafSize]_64 || [len(M)]_64 || T0 || ... || Tn-1),
+//     truncated to Tlen bits.
+//
+// [x]_n is x as an n-bit big-endian integer and the labels are ASCII without a
+// terminator. The tag depends only on the key, leafSize and the message, never
+// on the number of threads. The separate keys keep leaf tags from being
+// confused with root tags; the root binds the leaf order and the total length.
+//
+// The leaves are independent CMACs, so they go through CMAC_Batch (one thread)
+// or CmacBatchService::Run (all threads); only the root, 16 bytes per leaf,
+// is serial.
+class CmacTreeKey
+{
+public:
+    static const size_t DEFAULT_LEAF_SIZE = 1 << 20;
+
+    // A key of keySize (16, 24 or 32 bytes). leafSize = 0 uses DEFAULT_LEAF_SIZE.
+    CmacTreeKey(const byte* key, AES_KeySize keySize, size_t leafSize = DEFAULT_LEAF_SIZE);
+
+    // Mac: computes the Tlen-bit tag of message on the calling thread.
+    void Mac(const byte* message, size_t messageLen, int Tlen, byte mac[16]) const;
+
+    // Mac: the same, with the leaves spread over service's threads.
+    void Mac(CmacBatchService& service, const byte* message, size_t messageLen, int Tlen, byte mac[16]) const;
+
+    size_t LeafSize() const { return leafSize; }
+
+private:
+    CmacTreeKey(const CmacKey& key, size_t leafSize);
+
+    void MacLeaves(CmacBatchService* service, const byte* message, size_t messageLen, int Tlen, byte mac[16]) const;
+
+    CmacKey leafKey;
+    CmacKey rootKey;
+    size_t leafSize;
+};
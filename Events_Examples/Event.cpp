@@ -0,0 +1,228 @@
+// Event.cpp : futex / WaitOnAddress event. See Event.h.
+//
+#include "Event.h"
+#include "WaitSet.h"
+
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#else
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EVENT_CPU_RELAX() _mm_pause()
+#elif defined(__aarch64__)
+#define EVENT_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define EVENT_CPU_RELAX() ((void)0)
+#endif
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "the kernel waits on the atomic's own storage");
+
+namespace
+{
+    const unsigned SPIN_ROUNDS = 200;
+
+    // Sleeps while *word == expected, for at most timeoutMs (EVENT_INFINITE:
+    // no limit). Returns false on timeout; may also return early for no
+    // reason, so callers re-check the word.
+    bool WaitOnWord(std::atomic<uint32_t>& word, uint32_t expected, uint32_t timeoutMs)
+    {
+#ifdef _WIN32
+        if (WaitOnAddress(&word, &expected, sizeof(expected), timeoutMs))
+            return true;
+        return GetLastError() != ERROR_TIMEOUT;
+#else
+        timespec timeout;
+        timespec* limit = nullptr;
+        if (timeoutMs != EVENT_INFINITE)
+        {
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+            limit = &timeout;
+        }
+        long rc = syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, expected, limit, nullptr, 0);
+        return !(rc != 0 && errno == ETIMEDOUT);
+#endif
+    }
+
+    void WakeOne(std::atomic<uint32_t>& word)
+    {
+#ifdef _WIN32
+        WakeByAddressSingle(&word);
+#else
+        syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+    }
+
+    void WakeAll(std::atomic<uint32_t>& word)
+    {
+#ifdef _WIN32
+        WakeByAddressAll(&word);
+#else
+        syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+}
+
+Event::Event(EventReset reset, bool initialState, unsigned spinCount)
+    : state(initialState ? SIGNALED : 0), reset(reset), spinCount(spinCount)
+{
+    if (spinCount == DEFAULT_SPIN)
+        this->spinCount = std::thread::hardware_concurrency() > 1 ? SPIN_ROUNDS : 0;
+}
+
+Event::~Event()
+{
+    std::lock_guard<std::mutex> guard(observerLock);
+    for (const Observer& observer : observers)
+        observer.set->Forget(observer.index);
+}
+
+void Event::Set()
+{
+    uint32_t previous = state.fetch_or(SIGNALED, std::memory_order_acq_rel);
+    // Already signaled: whoever set it first has woken a waiter if there was one.
+    if ((previous & SIGNALED) != 0)
+        return;
+    if ((previous & OBSERVED) != 0)
+        NotifyObservers();
+    if (previous < WAITER)
+        return;
+    if (reset == EventReset::Auto)
+        WakeOne(state);
+    else
+        WakeAll(state);
+}
+
+void Event::AddObserver(WaitSet* set, size_t index)
+{
+    std::lock_guard<std::mutex> guard(observerLock);
+    observers.push_back(Observer{ set, index });
+    state.fetch_or(OBSERVED, std::memory_order_acq_rel);
+    // A Set() before the OBSERVED bit went in did not notify; catch it here.
+    if (IsSet())
+        set->Notify(index);
+}
+
+void Event::RemoveObserver(WaitSet* set, size_t index)
+{
+    std::lock_guard<std::mutex> guard(observerLock);
+    for (size_t i = 0; i < observers.size(); i++)
+    {
+        if (observers[i].set == set && observers[i].index == index)
+        {
+            observers[i] = observers.back();
+            observers.pop_back();
+            break;
+        }
+    }
+    if (observers.empty())
+        state.fetch_and(~OBSERVED, std::memory_order_acq_rel);
+}
+
+void Event::NotifyObservers()
+{
+    // Holding the lock keeps a WaitSet from unregistering (and going away)
+    // while it is being notified.
+    std::lock_guard<std::mutex> guard(observerLock);
+    for (const Observer& observer : observers)
+        observer.set->Notify(observer.index);
+}
+
+void Event::Reset()
+{
+    state.fetch_and(~SIGNALED, std::memory_order_acq_rel);
+}
+
+bool Event::TryAcquire(uint32_t& observed)
+{
+    uint32_t s = state.load(std::memory_order_acquire);
+    for (;;)
+    {
+        observed = s;
+        if ((s & SIGNALED) == 0)
+            return false;
+        if (reset == EventReset::Manual)
+            return true;
+        if (state.compare_exchange_weak(s, s & ~SIGNALED, std::memory_order_acquire, std::memory_order_acquire))
+            return true;
+    }
+}
+
+bool Event::TryWait()
+{
+    uint32_t observed;
+    return TryAcquire(observed);
+}
+
+bool Event::Wait(uint32_t timeoutMs)
+{
+    uint32_t s;
+    if (TryAcquire(s))
+        return true;
+    if (timeoutMs == 0)
+        return false;
+    for (unsigned i = 0; i < spinCount; i++)
+    {
+        EVENT_CPU_RELAX();
+        if (TryAcquire(s))
+            return true;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    // Park: register as a waiter so that Set() knows to wake someone. Set's
+    // fetch_or and this fetch_add are ordered on the same word, so either Set
+    // sees the waiter or the loop below sees the signal.
+    state.fetch_add(WAITER, std::memory_order_acq_rel);
+    bool timedOut = false;
+    s = state.load(std::memory_order_acquire);
+    for (;;)
+    {
+        if ((s & SIGNALED) != 0)
+        {
+            // Take the signal (auto-reset) and leave the waiter count in one step.
+            uint32_t next = (reset == EventReset::Auto ? s & ~SIGNALED : s) - WAITER;
+            if (state.compare_exchange_weak(s, next, std::memory_order_acquire, std::memory_order_acquire))
+                return true;
+            continue;
+        }
+        if (timedOut)
+        {
+            // Leave without the signal. If a Set() lands in between, the CAS
+            // fails and the signal is taken above instead: a Set() that woke
+            // this waiter must not be lost while others are still parked.
+            if (state.compare_exchange_weak(s, s - WAITER, std::memory_order_acquire, std::memory_order_acquire))
+                return false;
+            continue;
+        }
+
+        uint32_t remaining = EVENT_INFINITE;
+        if (timeoutMs != EVENT_INFINITE)
+        {
+            auto now = Clock::now();
+            if (now >= deadline)
+            {
+                timedOut = true;
+                continue;
+            }
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+            remaining = left >= (long long)EVENT_INFINITE ? EVENT_INFINITE - 1 : (uint32_t)left;
+        }
+        if (!WaitOnWord(state, s, remaining) && timeoutMs != EVENT_INFINITE && Clock::now() >= deadline)
+            timedOut = true;
+        s = state.load(std::memory_order_acquire);
+    }
+}
@@ -0,0 +1,92 @@
+// Event.h : portable event object with the semantics of a Win32 event
+// (CreateEvent / SetEvent / ResetEvent / WaitForSingleObject), built on one
+// atomic word and the operating system's wait-on-address primitive: futex on
+// Linux, WaitOnAddress / WakeByAddress on Windows.
+//
+// The word holds the signaled bit and the number of parked waiters, so
+//   - Set() on an event nobody waits for is one atomic OR, no system call;
+//   - Wait() on a signaled event is one compare-and-swap, no system call;
+//   - only a Set() that finds parked waiters calls into the kernel to wake them.
+// A waiter that finds the event clear spins for a bounded number of rounds
+// before it parks, which catches a Set() that is about to happen on another
+// core without a sleep / wake round trip.
+//
+// An event can also be registered with WaitSets (WaitSet.h); Set() then tells
+// each of them which of its objects became signaled.
+//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class WaitSet;
+
+#define EVENT_INFINITE 0xFFFFFFFFu
+
+enum class EventReset
+{
+    Auto,       // Wait() consumes the signal; Set() releases one waiter (CreateEvent(.., FALSE, ..)).
+    Manual      // The event stays signaled until Reset(); Set() releases every waiter.
+};
+
+class Event
+{
+public:
+    // spinCount: rounds to spin before parking. DEFAULT_SPIN picks 0 on a
+    // single processor, where spinning cannot help, and a few hundred
+    // pause instructions otherwise.
+    static const unsigned DEFAULT_SPIN = 0xFFFFFFFFu;
+
+    explicit Event(EventReset reset = EventReset::Auto, bool initialState = false, unsigned spinCount = DEFAULT_SPIN);
+    // Leaves the WaitSets the event is registered with.
+    ~Event();
+
+    Event(const Event&) = delete;
+    Event& operator=(const Event&) = delete;
+
+    // Set: signals the event (SetEvent). Setting a signaled event does nothing.
+    void Set();
+    // Reset: clears the signal (ResetEvent).
+    void Reset();
+    // Wait: waits until the event is signaled or timeoutMs milliseconds have
+    // passed (WaitForSingleObject). Returns false on timeout. An auto-reset
+    // event is cleared by the Wait() that returns true.
+    bool Wait(uint32_t timeoutMs = EVENT_INFINITE);
+    // TryWait: Wait(0) without reading the clock.
+    bool TryWait();
+
+    bool IsSet() const { return (state.load(std::memory_order_acquire) & SIGNALED) != 0; }
+    EventReset ResetMode() const { return reset; }
+
+private:
+    friend class WaitSet;
+
+    static const uint32_t SIGNALED = 1;
+    static const uint32_t OBSERVED = 2;    // Registered with a WaitSet.
+    static const uint32_t WAITER = 4;      // Added to the word per parked waiter.
+
+    struct Observer
+    {
+        WaitSet* set;
+        size_t index;
+    };
+
+    // Takes the signal if it is there (auto-reset clears it); never blocks.
+    bool TryAcquire(uint32_t& observed);
+
+    // Called by WaitSet. AddObserver notifies right away if the event is
+    // already signaled.
+    void AddObserver(WaitSet* set, size_t index);
+    void RemoveObserver(WaitSet* set, size_t index);
+    void NotifyObservers();
+
+    std::atomic<uint32_t> state;
+    EventReset reset;
+    unsigned spinCount;
+
+    std::mutex observerLock;
+    std::vector<Observer> observers;
+};
@@ -0,0 +1,228 @@
+// EventTests.cpp : behavior tests for Event (Event.h).
+//
+//   auto-reset    one Set() releases exactly one of several parked waiters
+//   manual-reset  one Set() releases every waiter; the signal stays until Reset()
+//   timeouts      Wait(ms) on a clear event returns false after about ms
+//   set vs. timeout
+//                 waiters with timeouts of 0..2 ms race a setter that sets the
+//                 event again only once it is clear: every Set() must be taken
+//                 by exactly one Wait(), including a Set() that lands while a
+//                 timed-out waiter leaves (the compare-and-swap in Event::Wait)
+// Each runs with spinning (the default) and without (spinCount 0), so both the
+// spin and the parking paths are covered.
+//
+// Exits with status 1 if any check fails.
+//
+#include "Event.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    int failures = 0;
+
+    double ElapsedMs(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // Waits up to limitMs for count to reach expected.
+    bool WaitForCount(const std::atomic<int>& count, int expected, int limitMs)
+    {
+        for (int ms = 0; count.load() < expected && ms < limitMs; ms++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return count.load() >= expected;
+    }
+
+    void TestAutoReset(unsigned spin)
+    {
+        const int nWaiters = 4;
+        Event event(EventReset::Auto, false, spin);
+        std::atomic<int> released(0);
+        std::vector<std::thread> waiters;
+        for (int i = 0; i < nWaiters; i++)
+        {
+            waiters.emplace_back([&]()
+                {
+                    if (event.Wait())
+                        released++;
+                });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        for (int i = 1; i <= nWaiters; i++)
+        {
+            event.Set();
+            WaitForCount(released, i, 5000);
+            // Give a wrongly woken second waiter time to show up.
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            if (released.load() != i || event.IsSet())
+            {
+                failures++;
+                printf("FAIL auto-reset spin=%u: Set() %d released %d waiters, signaled %d\n", spin, i, released.load(),
+                       (int)event.IsSet());
+                break;
+            }
+        }
+        for (int i = released.load(); i < nWaiters; i++)
+            event.Set();
+        for (std::thread& waiter : waiters)
+            waiter.join();
+
+        // A signal set before anyone waits is taken by exactly one Wait().
+        Event initial(EventReset::Auto, true, spin);
+        if (!initial.TryWait() || initial.TryWait() || initial.IsSet())
+        {
+            failures++;
+            printf("FAIL auto-reset spin=%u: an initially signaled event was not taken exactly once\n", spin);
+        }
+    }
+
+    void TestManualReset(unsigned spin)
+    {
+        const int nWaiters = 8;
+        Event event(EventReset::Manual, false, spin);
+        std::atomic<int> released(0);
+        std::vector<std::thread> waiters;
+        for (int i = 0; i < nWaiters; i++)
+        {
+            waiters.emplace_back([&]()
+                {
+                    if (event.Wait())
+                        released++;
+                });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        event.Set();
+        if (!WaitForCount(released, nWaiters, 5000) || !event.IsSet() || !event.Wait(0))
+        {
+            failures++;
+            printf("FAIL manual-reset spin=%u: Set() released %d of %d waiters\n", spin, released.load(), nWaiters);
+            for (int i = 0; i < nWaiters; i++)
+                event.Set();
+        }
+        for (std::thread& waiter : waiters)
+            waiter.join();
+
+        event.Reset();
+        if (event.IsSet() || event.TryWait())
+        {
+            failures++;
+            printf("FAIL manual-reset spin=%u: Reset() did not clear the signal\n", spin);
+        }
+    }
+
+    void TestTimeouts(unsigned spin)
+    {
+        for (EventReset reset : { EventReset::Auto, EventReset::Manual })
+        {
+            Event event(reset, false, spin);
+            auto start = Clock::now();
+            bool zero = event.Wait(0) || event.TryWait();
+            double zeroMs = ElapsedMs(start);
+            start = Clock::now();
+            bool timed = event.Wait(50);
+            double timedMs = ElapsedMs(start);
+            if (zero || zeroMs > 1000 || timed || timedMs < 49)
+            {
+                failures++;
+                printf("FAIL timeouts spin=%u %s: Wait(0) %d after %.1f ms, Wait(50) %d after %.1f ms\n", spin,
+                       reset == EventReset::Auto ? "auto" : "manual", (int)zero, zeroMs, (int)timed, timedMs);
+            }
+
+            // A Set() during a timed wait ends it with true.
+            std::thread setter([&]()
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    event.Set();
+                });
+            bool woken = event.Wait(5000);
+            setter.join();
+            if (!woken)
+            {
+                failures++;
+                printf("FAIL timeouts spin=%u: Set() during Wait(5000) was missed\n", spin);
+            }
+        }
+    }
+
+    void TestSetVersusTimeout(unsigned spin)
+    {
+        const int nWaiters = 4, nSets = 20000;
+        Event event(EventReset::Auto, false, spin);
+        std::atomic<int> taken(0), exited(0);
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> waiters;
+        for (int k = 0; k < nWaiters; k++)
+        {
+            waiters.emplace_back([&, k]()
+                {
+                    // Mostly short timeouts, so waiters keep timing out while
+                    // the setter runs; every third wait is infinite.
+                    uint32_t random = 2463534242u + k;
+                    while (!stop.load())
+                    {
+                        random = random * 1103515245u + 12345u;
+                        uint32_t pick = (random >> 16) % 3;
+                        if (event.Wait(pick == 0 ? EVENT_INFINITE : pick - 1))
+                            taken++;
+                    }
+                    exited++;
+                });
+        }
+
+        // Set again only once the previous signal has been taken, so each
+        // Set() is exactly one signal.
+        for (int i = 0; i < nSets; i++)
+        {
+            while (event.IsSet())
+                std::this_thread::yield();
+            event.Set();
+        }
+        bool complete = WaitForCount(taken, nSets, 10000);
+        int count = taken.load();
+        stop = true;
+        // Setting a signaled auto-reset event does nothing, so keep setting
+        // until every waiter has seen stop.
+        while (exited.load() < nWaiters)
+        {
+            event.Set();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (std::thread& waiter : waiters)
+            waiter.join();
+        if (!complete || count != nSets)
+        {
+            failures++;
+            printf("FAIL set vs. timeout spin=%u: %d sets, %d taken\n", spin, nSets, count);
+        }
+    }
+}
+
+int main()
+{
+    printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    for (unsigned spin : { Event::DEFAULT_SPIN, 0u })
+    {
+        printf("spin %s\n", spin == 0 ? "0" : "default");
+        TestAutoReset(spin);
+        TestManualReset(spin);
+        TestTimeouts(spin);
+        TestSetVersusTimeout(spin);
+    }
+
+    if (failures != 0)
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
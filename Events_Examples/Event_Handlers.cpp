@@ -1,11 +1,19 @@
 // Event_Handlers.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
+// Windows: Win32 event and thread handles. Linux: the same program on the
+// portable Event (Event.h), with threads whose handles are waited on through
+// a WaitSet (WaitSet.h).
+//
 
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 #include <iostream>
 
 using namespace std;
 
+#ifdef _WIN32
+
 HANDLE hEvent;
 
 DWORD WINAPI Thread1(LPVOID lpParam)
@@ -53,6 +61,45 @@ int main()
     return 0;
 }
 
+#else
+
+#include "Event.h"
+#include "WaitSet.h"
+
+// Auto-reset and initially clear, like CreateEvent(NULL, FALSE, FALSE, ...).
+Event hEvent(EventReset::Auto, false);
+
+void Thread1()
+{
+    hEvent.Wait(EVENT_INFINITE);
+    cout << "Thread 1 Running" << endl;
+}
+
+void Thread2()
+{
+    cout << "Thread 2 Running" << endl;
+    hEvent.Set();
+}
+
+int main()
+{
+    cout << "\t\t ------- EVENT HANDLER EXAMPLE ------- " << endl;
+    cout << endl;
+
+    SignalingThread hThread1(Thread1);
+    SignalingThread hThread2(Thread2);
+
+    // wait until both thread handles are on signaled state
+    WaitSet threads;
+    threads.Add(hThread1.Handle());
+    threads.Add(hThread2.Handle());
+    threads.WaitAll(EVENT_INFINITE);
+
+    return 0;
+}
+
+#endif
+
 // Run program: Ctrl + F5 or Debug > Start Without Debugging menu
 // Debug program: F5 or Debug > Start Debugging menu
 
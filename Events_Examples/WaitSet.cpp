@@ -0,0 +1,225 @@
+// WaitSet.cpp : ready list fed by Event::Set. See WaitSet.h.
+//
+#include "WaitSet.h"
+
+#include <chrono>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Milliseconds left until deadline, for Event::Wait; 0 once it has passed.
+    uint32_t Remaining(uint32_t timeoutMs, Clock::time_point deadline)
+    {
+        if (timeoutMs == EVENT_INFINITE)
+            return EVENT_INFINITE;
+        auto now = Clock::now();
+        if (now >= deadline)
+            return 0;
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        return left >= (long long)EVENT_INFINITE ? EVENT_INFINITE - 1 : (uint32_t)left;
+    }
+}
+
+WaitSet::WaitSet()
+    : wake(EventReset::Auto, false)
+{
+}
+
+WaitSet::~WaitSet()
+{
+    // Unregister without holding the lock: Event::Set calls Notify with the
+    // event's lock held, so the order is always event, then set.
+    std::vector<std::pair<Event*, size_t>> registeredEvents;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].event != nullptr)
+                registeredEvents.push_back(std::make_pair(entries[i].event, i));
+        }
+    }
+    for (const auto& registration : registeredEvents)
+        registration.first->RemoveObserver(this, registration.second);
+}
+
+size_t WaitSet::Add(Event& event)
+{
+    size_t index;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        index = entries.size();
+        entries.push_back(Entry());
+        entries.back().event = &event;
+        registered++;
+    }
+    event.AddObserver(this, index);
+    return index;
+}
+
+Event* WaitSet::Detach(size_t index)
+{
+    if (index >= entries.size() || entries[index].event == nullptr)
+        return nullptr;
+    Entry& entry = entries[index];
+    Event* event = entry.event;
+    entry.event = nullptr;          // Notify ignores the entry from now on.
+    if (entry.done)
+        nDone--;
+    entry.done = false;
+    registered--;
+    return event;
+}
+
+void WaitSet::Remove(size_t index)
+{
+    Event* event;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        event = Detach(index);
+    }
+    if (event == nullptr)
+        return;
+    event->RemoveObserver(this, index);
+    // A WaitAll may have been waiting for this one too: let it count again.
+    wake.Set();
+}
+
+void WaitSet::Forget(size_t index)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Detach(index);
+    }
+    wake.Set();
+}
+
+size_t WaitSet::Size() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return registered;
+}
+
+size_t WaitSet::Pending() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return registered - nDone;
+}
+
+void WaitSet::Notify(size_t index)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (index >= entries.size())
+            return;
+        Entry& entry = entries[index];
+        if (entry.event == nullptr || entry.queued)
+            return;
+        entry.queued = true;
+        ready.push_back(index);
+        // WaitAll needs every pending object; waking it for each one would
+        // cost a sleep / wake round trip per signal. Each pending object is
+        // queued once, so the list reaches wakeAt by the time the last one
+        // arrives (stale entries only make it reach it sooner).
+        if (ready.size() < wakeAt)
+            return;
+    }
+    wake.Set();
+}
+
+size_t WaitSet::TakeReady()
+{
+    while (!ready.empty())
+    {
+        size_t index = ready.front();
+        ready.pop_front();
+        Entry& entry = entries[index];
+        entry.queued = false;
+        // Someone else may have taken the signal (or reset the event) since
+        // it was queued; the next Set() queues it again.
+        if (entry.event == nullptr || !entry.event->TryWait())
+            continue;
+        // A manual-reset event stays signaled but will not be Set() again
+        // until it is reset: keep it in the list, behind the others.
+        if (entry.event->ResetMode() == EventReset::Manual)
+        {
+            entry.queued = true;
+            ready.push_back(index);
+        }
+        return index;
+    }
+    return WAIT_SET_TIMEOUT;
+}
+
+size_t WaitSet::WaitAny(uint32_t timeoutMs)
+{
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            wakeAt = 1;
+            size_t index = TakeReady();
+            if (index != WAIT_SET_TIMEOUT)
+                return index;
+        }
+        // Notify sets `wake` after queueing, so a signal that arrives after
+        // the check above is not missed.
+        uint32_t remaining = Remaining(timeoutMs, deadline);
+        if (remaining == 0 || !wake.Wait(remaining))
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return TakeReady();
+        }
+    }
+}
+
+bool WaitSet::WaitAll(uint32_t timeoutMs)
+{
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            while (!ready.empty())
+            {
+                size_t index = ready.front();
+                ready.pop_front();
+                Entry& entry = entries[index];
+                entry.queued = false;
+                // An object already counted keeps any new signal for the next round.
+                if (entry.event == nullptr || entry.done || !entry.event->TryWait())
+                    continue;
+                entry.done = true;
+                nDone++;
+            }
+            if (nDone == registered)
+            {
+                // Next round. Objects signaled again meanwhile were skipped
+                // above and will not be Set() again while signaled: queue them.
+                for (size_t index = 0; index < entries.size(); index++)
+                {
+                    Entry& entry = entries[index];
+                    entry.done = false;
+                    if (entry.event != nullptr && !entry.queued && entry.event->IsSet())
+                    {
+                        entry.queued = true;
+                        ready.push_back(index);
+                    }
+                }
+                nDone = 0;
+                wakeAt = 1;
+                return true;
+            }
+            wakeAt = registered - nDone;
+        }
+        uint32_t remaining = Remaining(timeoutMs, deadline);
+        if (remaining == 0)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            wakeAt = 1;
+            return false;
+        }
+        wake.Wait(remaining);
+    }
+}
@@ -0,0 +1,128 @@
+// WaitSet.h : WaitForMultipleObjects over any number of events and threads,
+// with a wake-up cost that does not depend on how many are registered.
+//
+// Each registered Event keeps a pointer back to the set. When the event goes
+// from clear to signaled, Set() appends the object's index to the set's ready
+// list and sets the set's own Event, so a waiter is woken with the one index
+// that changed instead of scanning every object. Registering, waking and
+// consuming an object are all O(1); nothing is polled.
+//
+// Thread handles are SignalingThreads: a std::thread with a manual-reset
+// Event that is set when its function returns, like a Win32 thread handle.
+//
+// Semantics that differ from WaitForMultipleObjects:
+//   - there is no limit of 64 objects;
+//   - WaitAny returns objects in the order they were signaled, not the lowest
+//     index (a manual-reset object that stays signaled goes to the back of the
+//     list, so one busy object cannot starve the others);
+//   - WaitAll is not atomic: it takes each auto-reset signal as it arrives and
+//     remembers it, also across calls that time out, and returns once every
+//     object has been signaled. That is what waiting for a batch of completions
+//     needs; acquiring N events at once would cost O(N) locks per attempt.
+//
+// An event that is destroyed leaves the sets it is registered with. A WaitSet
+// is waited on by one thread at a time.
+//
+#pragma once
+
+#include "Event.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define WAIT_SET_TIMEOUT ((size_t)-1)
+
+class WaitSet
+{
+public:
+    WaitSet();
+    ~WaitSet();
+
+    WaitSet(const WaitSet&) = delete;
+    WaitSet& operator=(const WaitSet&) = delete;
+
+    // Add: registers event and returns its index (indices are not reused).
+    size_t Add(Event& event);
+    // Remove: unregisters the object at index; a pending WaitAll no longer
+    // waits for it.
+    void Remove(size_t index);
+    // Size: objects registered now.
+    size_t Size() const;
+
+    // WaitAny: the index of a signaled object, whose signal it takes (for an
+    // auto-reset event), or WAIT_SET_TIMEOUT.
+    size_t WaitAny(uint32_t timeoutMs = EVENT_INFINITE);
+    // WaitAll: true once every registered object has been signaled since the
+    // last WaitAll that returned true; false on timeout. See above.
+    bool WaitAll(uint32_t timeoutMs = EVENT_INFINITE);
+    // Pending: objects a WaitAll is still waiting for.
+    size_t Pending() const;
+
+private:
+    friend class Event;
+
+    struct Entry
+    {
+        Event* event = nullptr;     // nullptr once removed.
+        bool queued = false;        // In ready.
+        bool done = false;          // Seen signaled by WaitAll.
+    };
+
+    // Notify: called by Event::Set (with the event's observer lock held).
+    void Notify(size_t index);
+    // Forget: called by ~Event (with the event's observer lock held).
+    void Forget(size_t index);
+    // Detach: clears entry index and its counts; requires lock. Returns the
+    // event it held, or nullptr.
+    Event* Detach(size_t index);
+    // Takes the next ready object that is still signaled; requires lock.
+    // Returns WAIT_SET_TIMEOUT if none.
+    size_t TakeReady();
+
+    mutable std::mutex lock;
+    std::vector<Entry> entries;
+    std::deque<size_t> ready;
+    size_t registered = 0;
+    size_t nDone = 0;
+    size_t wakeAt = 1;              // Set `wake` once ready has this many entries.
+    Event wake;
+};
+
+// SignalingThread: runs function(args...) on a new thread; Handle() is set
+// when it returns. The destructor joins.
+class SignalingThread
+{
+public:
+    template <typename Function, typename... Args>
+    explicit SignalingThread(Function&& function, Args&&... args)
+        : done(EventReset::Manual, false)
+    {
+        thread = std::thread([this](typename std::decay<Function>::type f, typename std::decay<Args>::type... a)
+            {
+                f(std::move(a)...);
+                done.Set();
+            }, std::forward<Function>(function), std::forward<Args>(args)...);
+    }
+
+    ~SignalingThread()
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+
+    SignalingThread(const SignalingThread&) = delete;
+    SignalingThread& operator=(const SignalingThread&) = delete;
+
+    Event& Handle() { return done; }
+    void Join() { thread.join(); }
+
+private:
+    Event done;
+    std::thread thread;
+};
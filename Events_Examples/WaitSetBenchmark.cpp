@@ -0,0 +1,181 @@
+// WaitSetBenchmark.cpp : cost of a wake-up against the number of registered
+// events, WaitSet (WaitSet.h) versus the naive port of WaitForMultipleObjects
+// that polls every event.
+//
+//   wait-any  a setter thread signals one random event out of N and waits for
+//            an acknowledgement; the waiter finds which one and acknowledges.
+//            Time per round trip.
+//   wait-all  the setter signals all N events in random order; the waiter
+//            returns once all are in. Time per event.
+//
+#include "WaitSet.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Small xorshift, so both sides agree on the order without sharing it.
+    uint32_t Next(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    std::vector<std::unique_ptr<Event>> MakeEvents(size_t n)
+    {
+        std::vector<std::unique_ptr<Event>> events;
+        for (size_t i = 0; i < n; i++)
+            events.emplace_back(new Event(EventReset::Auto, false));
+        return events;
+    }
+
+    // The naive port: sweep the events until one is signaled, yield between sweeps.
+    size_t PollAny(std::vector<std::unique_ptr<Event>>& events)
+    {
+        for (;;)
+        {
+            for (size_t i = 0; i < events.size(); i++)
+            {
+                if (events[i]->TryWait())
+                    return i;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    double WaitAnyRoundTrip(size_t n, long rounds, bool poll)
+    {
+        std::vector<std::unique_ptr<Event>> events = MakeEvents(n);
+        WaitSet set;
+        if (!poll)
+        {
+            for (auto& event : events)
+                set.Add(*event);
+        }
+        Event ack;
+
+        auto start = Clock::now();
+        std::thread setter([&]()
+            {
+                uint32_t random = 2463534242u;
+                for (long r = 0; r < rounds; r++)
+                {
+                    events[Next(random) % n]->Set();
+                    ack.Wait();
+                }
+            });
+        uint32_t random = 2463534242u;
+        bool ok = true;
+        for (long r = 0; r < rounds; r++)
+        {
+            size_t index = poll ? PollAny(events) : set.WaitAny();
+            ok = ok && index == Next(random) % n;
+            ack.Set();
+        }
+        setter.join();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (!ok)
+            printf("wait-any returned the wrong event\n");
+        return seconds * 1e9 / rounds;
+    }
+
+    double WaitAllPerEvent(size_t n, long rounds, bool poll)
+    {
+        std::vector<std::unique_ptr<Event>> events = MakeEvents(n);
+        WaitSet set;
+        if (!poll)
+        {
+            for (auto& event : events)
+                set.Add(*event);
+        }
+        Event ack;
+
+        auto start = Clock::now();
+        std::thread setter([&]()
+            {
+                uint32_t random = 88172645u;
+                for (long r = 0; r < rounds; r++)
+                {
+                    // Random order: a permutation by stepping with an odd stride.
+                    size_t stride = (Next(random) % n) | 1;
+                    while (n % stride == 0 && stride > 1)
+                        stride -= 2;
+                    for (size_t i = 0, k = 0; i < n; i++, k = (k + stride) % n)
+                        events[k]->Set();
+                    ack.Wait();
+                }
+            });
+        std::vector<bool> seen(n);
+        for (long r = 0; r < rounds; r++)
+        {
+            if (poll)
+            {
+                // Sweep until every event has been seen once.
+                std::fill(seen.begin(), seen.end(), false);
+                size_t nSeen = 0;
+                while (nSeen < n)
+                {
+                    for (size_t i = 0; i < n; i++)
+                    {
+                        if (!seen[i] && events[i]->TryWait())
+                        {
+                            seen[i] = true;
+                            nSeen++;
+                        }
+                    }
+                    if (nSeen < n)
+                        std::this_thread::yield();
+                }
+            }
+            else
+            {
+                set.WaitAll();
+            }
+            ack.Set();
+        }
+        setter.join();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return seconds * 1e9 / ((double)rounds * n);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    long rounds = 2000;
+    size_t maxEvents = 65536;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--rounds=", 9) == 0)
+            rounds = atol(argv[i] + 9);
+        else if (strncmp(argv[i], "--max-events=", 13) == 0)
+            maxEvents = (size_t)strtoull(argv[i] + 13, nullptr, 10);
+        else
+        {
+            fprintf(stderr, "usage: %s [--rounds=N] [--max-events=N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%u hardware threads, %ld rounds\n", std::thread::hardware_concurrency(), rounds);
+    printf("%8s  %16s %16s  %16s %16s\n", "events", "any: WaitSet", "any: poll", "all: WaitSet/ev", "all: poll/ev");
+    for (size_t n = 16; n <= maxEvents; n *= 16)
+    {
+        double anySet = WaitAnyRoundTrip(n, rounds, false);
+        double anyPoll = WaitAnyRoundTrip(n, rounds, true);
+        long allRounds = rounds * 16 / (long)n > 0 ? rounds * 16 / (long)n : 1;
+        double allSet = WaitAllPerEvent(n, allRounds, false);
+        double allPoll = WaitAllPerEvent(n, allRounds, true);
+        printf("%8zu  %13.0f ns %13.0f ns  %13.1f ns %13.1f ns\n", n, anySet, anyPoll, allSet, allPoll);
+    }
+    return 0;
+}
@@ -0,0 +1,386 @@
+// WaitSetTests.cpp : stress tests for WaitSet (WaitSet.h).
+//
+//   timeouts      WaitAny / WaitAll with nothing signaled return after about
+//                 the timeout, and at once with a timeout of 0
+//   wait-any      1000 auto-reset events set by 4 threads: every index comes
+//                 back exactly once per round, and nothing is left over
+//   wait-all      200 SignalingThreads: WaitAll returns once all have ended
+//   remove        Remove() of the last unsignaled object releases a WaitAll
+//   lost wake-up  rounds of WaitAll and WaitAny over a mix of manual- and
+//                 auto-reset events set by 4 threads, against the wakeAt
+//                 batching in Notify and the requeueing in TakeReady
+//   lock order    Set / Reset, Add / Remove, ~Event and ~WaitSet on different
+//                 threads at once; Set() takes the event's lock, then the
+//                 set's, and nothing may take them the other way round
+// A test that hangs is reported as a failure after a watchdog timeout.
+//
+// Exits with status 1 if any check fails.
+//
+#include "WaitSet.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    int failures = 0;
+
+    uint32_t Next(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    double ElapsedMs(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // Runs test on its own thread and fails (ending the process, since a
+    // deadlocked thread cannot be joined) if it takes longer than limitMs.
+    template <typename Test>
+    void RunWithWatchdog(const char* name, uint32_t limitMs, Test test)
+    {
+        printf("%s\n", name);
+        fflush(stdout);
+        Event finished(EventReset::Manual);
+        std::thread runner([&]()
+            {
+                test();
+                finished.Set();
+            });
+        if (!finished.Wait(limitMs))
+        {
+            printf("FAIL %s did not finish within %u ms (deadlock or lost wake-up)\n", name, limitMs);
+            fflush(stdout);
+            std::_Exit(1);
+        }
+        runner.join();
+    }
+
+    void TestTimeouts()
+    {
+        Event a, b(EventReset::Manual);
+        WaitSet set;
+        set.Add(a);
+        set.Add(b);
+
+        auto start = Clock::now();
+        if (set.WaitAny(0) != WAIT_SET_TIMEOUT || set.WaitAll(0) || ElapsedMs(start) > 1000)
+        {
+            failures++;
+            printf("FAIL a timeout of 0 did not return at once with nothing signaled\n");
+        }
+
+        start = Clock::now();
+        size_t index = set.WaitAny(50);
+        double anyMs = ElapsedMs(start);
+        start = Clock::now();
+        bool all = set.WaitAll(50);
+        double allMs = ElapsedMs(start);
+        if (index != WAIT_SET_TIMEOUT || all || anyMs < 49 || allMs < 49)
+        {
+            failures++;
+            printf("FAIL 50 ms timeout: WaitAny %zu after %.1f ms, WaitAll %d after %.1f ms\n", index, anyMs, (int)all,
+                   allMs);
+        }
+
+        // Half of a WaitAll is kept across a timeout.
+        a.Set();
+        if (set.WaitAll(10) || set.Pending() != 1)
+        {
+            failures++;
+            printf("FAIL WaitAll with one of two objects signaled: pending %zu\n", set.Pending());
+        }
+        b.Set();
+        if (!set.WaitAll(1000) || a.IsSet())
+        {
+            failures++;
+            printf("FAIL WaitAll did not complete after the second object was signaled\n");
+        }
+    }
+
+    void TestWaitAny()
+    {
+        const size_t n = 1000;
+        const int nSetters = 4, rounds = 20;
+        std::vector<std::unique_ptr<Event>> events;
+        WaitSet set;
+        for (size_t i = 0; i < n; i++)
+        {
+            events.emplace_back(new Event(EventReset::Auto));
+            set.Add(*events.back());
+        }
+
+        for (int r = 0; r < rounds; r++)
+        {
+            std::vector<std::thread> setters;
+            for (int t = 0; t < nSetters; t++)
+            {
+                setters.emplace_back([&, t]()
+                    {
+                        for (size_t i = t; i < n; i += nSetters)
+                            events[i]->Set();
+                    });
+            }
+            std::vector<int> seen(n, 0);
+            size_t got = 0;
+            while (got < n)
+            {
+                size_t index = set.WaitAny(5000);
+                if (index == WAIT_SET_TIMEOUT || index >= n)
+                    break;
+                if (seen[index]++ == 0)
+                    got++;
+                else
+                {
+                    failures++;
+                    printf("FAIL wait-any round %d returned %zu twice\n", r, index);
+                }
+            }
+            for (std::thread& setter : setters)
+                setter.join();
+            if (got != n)
+            {
+                failures++;
+                printf("FAIL wait-any round %d: %zu of %zu events returned\n", r, got, n);
+                return;
+            }
+            if (set.WaitAny(0) != WAIT_SET_TIMEOUT)
+            {
+                failures++;
+                printf("FAIL wait-any round %d: a signal was returned twice\n", r);
+            }
+        }
+    }
+
+    void TestWaitAllThreads()
+    {
+        const size_t n = 200;
+        std::atomic<size_t> finished(0);
+        std::vector<std::unique_ptr<SignalingThread>> threads;
+        WaitSet set;
+        for (size_t i = 0; i < n; i++)
+        {
+            threads.emplace_back(new SignalingThread([&finished](size_t k)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(k % 7 * 100));
+                    finished++;
+                }, i));
+            set.Add(threads.back()->Handle());
+        }
+        if (!set.WaitAll(10000) || finished.load() != n)
+        {
+            failures++;
+            printf("FAIL WaitAll over %zu threads: %zu finished, %zu pending\n", n, finished.load(), set.Pending());
+        }
+    }
+
+    void TestRemoveDuringWaitAll()
+    {
+        const size_t n = 10;
+        std::vector<std::unique_ptr<Event>> events;
+        WaitSet set;
+        for (size_t i = 0; i < n; i++)
+        {
+            events.emplace_back(new Event(EventReset::Auto));
+            set.Add(*events.back());
+        }
+        for (size_t i = 0; i + 1 < n; i++)
+            events[i]->Set();
+
+        // The last event is never set; removing it must release the WaitAll
+        // already blocked on it.
+        std::thread remover([&]()
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                set.Remove(n - 1);
+            });
+        bool all = set.WaitAll(5000);
+        remover.join();
+        if (!all || set.Size() != n - 1)
+        {
+            failures++;
+            printf("FAIL Remove during WaitAll: WaitAll %d, size %zu\n", (int)all, set.Size());
+        }
+    }
+
+    void TestLostWakeup()
+    {
+        const int n = 300, nSetters = 4, rounds = 200;
+        std::vector<std::unique_ptr<Event>> events;
+        WaitSet set;
+        for (int i = 0; i < n; i++)
+        {
+            events.emplace_back(new Event(i % 3 == 0 ? EventReset::Manual : EventReset::Auto));
+            set.Add(*events.back());
+        }
+
+        std::atomic<int> round(-1), setDone(0);
+        std::vector<std::thread> setters;
+        for (int t = 0; t < nSetters; t++)
+        {
+            setters.emplace_back([&, t]()
+                {
+                    for (int last = -1;;)
+                    {
+                        int r;
+                        while ((r = round.load()) == last)
+                            std::this_thread::yield();
+                        if (r == rounds)
+                            return;
+                        last = r;
+                        for (int i = t; i < n; i += nSetters)
+                            events[i]->Set();
+                        setDone++;
+                    }
+                });
+        }
+
+        for (int r = 0; r < rounds && failures == 0; r++)
+        {
+            setDone = 0;
+            round = r;
+            if (r % 2 == 0)
+            {
+                if (!set.WaitAll(5000))
+                {
+                    failures++;
+                    printf("FAIL lost wake-up: WaitAll round %d timed out with %zu pending\n", r, set.Pending());
+                }
+            }
+            else
+            {
+                std::vector<bool> seen(n, false);
+                int got = 0;
+                while (got < n)
+                {
+                    size_t index = set.WaitAny(5000);
+                    if (index == WAIT_SET_TIMEOUT)
+                    {
+                        failures++;
+                        printf("FAIL lost wake-up: WaitAny round %d timed out after %d of %d\n", r, got, n);
+                        break;
+                    }
+                    if (!seen[index])
+                    {
+                        seen[index] = true;
+                        got++;
+                    }
+                }
+            }
+            while (setDone.load() < nSetters)
+                std::this_thread::yield();
+
+            // Start the next round with every event clear and nothing queued.
+            for (int i = 0; i < n; i++)
+            {
+                if (i % 3 == 0)
+                    events[i]->Reset();
+                else
+                    events[i]->TryWait();
+            }
+            while (set.WaitAny(0) != WAIT_SET_TIMEOUT)
+            {
+            }
+            set.WaitAll(0);
+        }
+        round = rounds;
+        for (std::thread& setter : setters)
+            setter.join();
+    }
+
+    void TestLockOrder()
+    {
+        const int n = 64;
+        const auto duration = std::chrono::milliseconds(500);
+        std::vector<std::unique_ptr<Event>> events;
+        for (int i = 0; i < n; i++)
+            events.emplace_back(new Event(i % 2 == 0 ? EventReset::Manual : EventReset::Auto));
+        WaitSet shared;
+        for (auto& event : events)
+            shared.Add(*event);
+
+        const Clock::time_point end = Clock::now() + duration;
+        std::vector<std::thread> threads;
+        // Set / Reset the shared events: event lock, then set lock.
+        for (int t = 0; t < 2; t++)
+        {
+            threads.emplace_back([&, t]()
+                {
+                    uint32_t random = 2463534242u + t;
+                    while (Clock::now() < end)
+                    {
+                        Event& event = *events[Next(random) % n];
+                        if (Next(random) % 4 == 0)
+                            event.Reset();
+                        else
+                            event.Set();
+                    }
+                });
+        }
+        // Short-lived sets over the shared events: Add, Remove and ~WaitSet.
+        threads.emplace_back([&]()
+            {
+                uint32_t random = 88172645u;
+                while (Clock::now() < end)
+                {
+                    WaitSet set;
+                    for (auto& event : events)
+                        set.Add(*event);
+                    set.WaitAny(0);
+                    for (int k = 0; k < n / 2; k++)
+                        set.Remove(Next(random) % n);
+                }
+            });
+        // Short-lived events in the shared set: Add, Set and ~Event (Forget).
+        threads.emplace_back([&]()
+            {
+                while (Clock::now() < end)
+                {
+                    Event temporary(EventReset::Auto);
+                    shared.Add(temporary);
+                    temporary.Set();
+                }
+            });
+        // The one waiter of the shared set.
+        threads.emplace_back([&]()
+            {
+                while (Clock::now() < end)
+                {
+                    shared.WaitAny(1);
+                    shared.WaitAll(0);
+                }
+            });
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+}
+
+int main()
+{
+    printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    RunWithWatchdog("timeouts", 20000, TestTimeouts);
+    RunWithWatchdog("wait-any: 1000 events, 4 setters", 60000, TestWaitAny);
+    RunWithWatchdog("wait-all: 200 threads", 30000, TestWaitAllThreads);
+    RunWithWatchdog("remove during wait-all", 20000, TestRemoveDuringWaitAll);
+    RunWithWatchdog("lost wake-up: wait-all / wait-any rounds", 120000, TestLostWakeup);
+    RunWithWatchdog("lock order: set, reset, add, remove, destroy", 30000, TestLockOrder);
+
+    if (failures != 0)
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,256 @@
+// ArenaBenchmark.cpp : page faults and throughput of a fresh buffer per chunk
+// versus recycled ChunkArena buffers (Linux).
+//
+// Every mode processes --total-gb of data in --chunk-mb chunks: fill the chunk
+// (pread from --file, or memset when there is none), then sum its words.
+//   commit         mmap + munmap per chunk, like the VirtualAlloc(MEM_COMMIT) /
+//                  VirtualFree(MEM_RELEASE) loop of the Windows example
+//   arena-4k       ChunkArena, 4 KiB pages
+//   arena-thp      ChunkArena, transparent huge pages
+//   arena-hugetlb  ChunkArena, MAP_HUGETLB (falls back to thp; needs
+//                  echo N > /proc/sys/vm/nr_hugepages)
+// Faults are counted with getrusage; the arena's own setup (mapping and
+// pre-faulting) is reported apart from the steady state.
+//
+#include "ChunkArena.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Faults
+    {
+        long minor = 0;
+        long major = 0;
+    };
+
+    Faults ReadFaults()
+    {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        Faults faults;
+        faults.minor = usage.ru_minflt;
+        faults.major = usage.ru_majflt;
+        return faults;
+    }
+
+    struct Workload
+    {
+        size_t chunkSize = 64u << 20;
+        uint64_t totalBytes = 4ull << 30;
+        int fd = -1;                    // Source file, or -1 to memset.
+        uint64_t fileSize = 0;
+    };
+
+    // Fills buffer with chunk number `chunk`, wrapping around the file.
+    bool Fill(const Workload& work, unsigned char* buffer, uint64_t chunk)
+    {
+        if (work.fd < 0)
+        {
+            memset(buffer, (int)(chunk & 0xff), work.chunkSize);
+            return true;
+        }
+        uint64_t nFileChunks = work.fileSize / work.chunkSize;
+        uint64_t offset = (chunk % nFileChunks) * work.chunkSize;
+        size_t filled = 0;
+        while (filled < work.chunkSize)
+        {
+            ssize_t n = pread(work.fd, buffer + filled, work.chunkSize - filled, (off_t)(offset + filled));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            filled += (size_t)n;
+        }
+        return true;
+    }
+
+    uint64_t Checksum(const unsigned char* data, size_t size)
+    {
+        uint64_t sum = 0;
+        for (size_t i = 0; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            sum += word;
+        }
+        return sum;
+    }
+
+    struct Result
+    {
+        double seconds = 0;
+        Faults faults;                  // During the chunk loop.
+        Faults setupFaults;             // Creating the arena.
+        double setupSeconds = 0;
+        uint64_t checksum = 0;
+        std::string pageKind;
+    };
+
+    bool RunCommit(const Workload& work, Result& result)
+    {
+        uint64_t nChunks = work.totalBytes / work.chunkSize;
+        Faults before = ReadFaults();
+        auto start = Clock::now();
+        for (uint64_t chunk = 0; chunk < nChunks; chunk++)
+        {
+            void* p = mmap(nullptr, work.chunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+                return false;
+            unsigned char* buffer = static_cast<unsigned char*>(p);
+            bool filled = Fill(work, buffer, chunk);
+            if (filled)
+                result.checksum += Checksum(buffer, work.chunkSize);
+            munmap(p, work.chunkSize);
+            if (!filled)
+                return false;
+        }
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        Faults after = ReadFaults();
+        result.faults.minor = after.minor - before.minor;
+        result.faults.major = after.major - before.major;
+        result.pageKind = "4k";
+        return true;
+    }
+
+    bool RunArena(const Workload& work, HugePages hugePages, bool prefault, Result& result)
+    {
+        uint64_t nChunks = work.totalBytes / work.chunkSize;
+        Faults before = ReadFaults();
+        auto setupStart = Clock::now();
+        ChunkArenaOptions options;
+        options.bufferSize = work.chunkSize;
+        options.count = 2;
+        options.hugePages = hugePages;
+        options.prefault = prefault;
+        std::unique_ptr<ChunkArena> arena = ChunkArena::Create(options);
+        if (arena == nullptr)
+            return false;
+        result.setupSeconds = std::chrono::duration<double>(Clock::now() - setupStart).count();
+        Faults afterSetup = ReadFaults();
+        result.setupFaults.minor = afterSetup.minor - before.minor;
+        result.setupFaults.major = afterSetup.major - before.major;
+        result.pageKind = arena->PageKind();
+
+        auto start = Clock::now();
+        for (uint64_t chunk = 0; chunk < nChunks; chunk++)
+        {
+            unsigned char* buffer = arena->Acquire();
+            bool filled = Fill(work, buffer, chunk);
+            if (filled)
+                result.checksum += Checksum(buffer, work.chunkSize);
+            arena->Release(buffer);
+            if (!filled)
+                return false;
+        }
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        Faults after = ReadFaults();
+        result.faults.minor = after.minor - afterSetup.minor;
+        result.faults.major = after.major - afterSetup.major;
+        return true;
+    }
+
+    int Usage(const char* program)
+    {
+        std::cerr << "usage: " << program << " [--chunk-mb=N] [--total-gb=N] [--file=PATH] [--no-prefault]"
+                  << " [--mode=commit|arena-4k|arena-thp|arena-hugetlb]\n";
+        return 2;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Workload work;
+    std::string path;
+    std::string only;
+    bool prefault = true;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 11, "--chunk-mb=") == 0)
+            work.chunkSize = (size_t)std::strtoull(arg.c_str() + 11, nullptr, 10) << 20;
+        else if (arg.compare(0, 11, "--total-gb=") == 0)
+            work.totalBytes = (uint64_t)(std::strtod(arg.c_str() + 11, nullptr) * (1ull << 30));
+        else if (arg.compare(0, 7, "--file=") == 0)
+            path = arg.substr(7);
+        else if (arg.compare(0, 7, "--mode=") == 0)
+            only = arg.substr(7);
+        else if (arg == "--no-prefault")
+            prefault = false;
+        else
+            return Usage(argv[0]);
+    }
+    if (work.chunkSize == 0 || work.totalBytes < work.chunkSize)
+        return Usage(argv[0]);
+
+    if (!path.empty())
+    {
+        work.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (work.fd < 0)
+        {
+            std::cerr << "Failed to open " << path << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        work.fileSize = (uint64_t)lseek(work.fd, 0, SEEK_END);
+        if (work.fileSize < work.chunkSize)
+        {
+            std::cerr << path << " is smaller than one chunk" << std::endl;
+            return 1;
+        }
+    }
+
+    struct Mode
+    {
+        const char* name;
+        bool arena;
+        HugePages hugePages;
+    };
+    const Mode modes[] = {
+        { "commit", false, HugePages::None },
+        { "arena-4k", true, HugePages::None },
+        { "arena-thp", true, HugePages::Transparent },
+        { "arena-hugetlb", true, HugePages::Explicit },
+    };
+
+    uint64_t nChunks = work.totalBytes / work.chunkSize;
+    double gb = (double)(nChunks * work.chunkSize) / (1ull << 30);
+    std::cout << nChunks << " chunks of " << (work.chunkSize >> 20) << " MiB (" << gb << " GiB), fill: "
+              << (path.empty() ? std::string("memset") : "pread " + path) << (prefault ? "" : ", no prefault") << "\n";
+    std::cout << "mode            pages     GB/s   minor/GB   major/GB   setup minor  setup ms\n";
+
+    for (const Mode& mode : modes)
+    {
+        if (!only.empty() && only != mode.name)
+            continue;
+        Result result;
+        bool ok = mode.arena ? RunArena(work, mode.hugePages, prefault, result) : RunCommit(work, result);
+        if (!ok)
+        {
+            std::cerr << mode.name << " failed: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        char line[160];
+        snprintf(line, sizeof(line), "%-15s %-8s %6.2f %10.0f %10.0f %13ld %9.1f", mode.name, result.pageKind.c_str(),
+                 gb * (1ull << 30) / result.seconds / 1e9, result.faults.minor / gb, result.faults.major / gb,
+                 result.setupFaults.minor, result.setupSeconds * 1e3);
+        std::cout << line << "  (checksum " << std::hex << result.checksum << std::dec << ")\n";
+    }
+
+    if (work.fd >= 0)
+        close(work.fd);
+    return 0;
+}
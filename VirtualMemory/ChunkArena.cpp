@@ -0,0 +1,116 @@
+// ChunkArena.cpp : recycled chunk buffers on huge pages (Linux). See ChunkArena.h.
+//
+#include "ChunkArena.h"
+
+#include <cerrno>
+#include <cstdint>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+    const size_t HUGE_PAGE_SIZE = 2u << 20;
+
+    size_t RoundUp(size_t n, size_t multiple)
+    {
+        return (n + multiple - 1) / multiple * multiple;
+    }
+
+    // Maps size bytes of anonymous memory aligned to HUGE_PAGE_SIZE, so that
+    // every 2 MiB of it can be a transparent huge page.
+    void* MapAligned(size_t size)
+    {
+        size_t padded = size + HUGE_PAGE_SIZE;
+        void* p = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return nullptr;
+        uintptr_t start = (uintptr_t)p;
+        uintptr_t aligned = RoundUp(start, HUGE_PAGE_SIZE);
+        if (aligned > start)
+            munmap(p, aligned - start);
+        uintptr_t end = start + padded;
+        if (end > aligned + size)
+            munmap((void*)(aligned + size), end - (aligned + size));
+        return (void*)aligned;
+    }
+}
+
+std::unique_ptr<ChunkArena> ChunkArena::Create(const ChunkArenaOptions& options)
+{
+    std::unique_ptr<ChunkArena> arena(new ChunkArena());
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    arena->count = options.count == 0 ? 1 : options.count;
+    size_t bufferSize = options.bufferSize == 0 ? pageSize : options.bufferSize;
+
+    void* base = nullptr;
+    bool populated = false;
+    if (options.hugePages == HugePages::Explicit)
+    {
+        // Fails unless enough pages are reserved in /proc/sys/vm/nr_hugepages.
+        arena->bufferSize = RoundUp(bufferSize, HUGE_PAGE_SIZE);
+        arena->mappedSize = arena->bufferSize * arena->count;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (options.prefault ? MAP_POPULATE : 0);
+        base = mmap(nullptr, arena->mappedSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (base == MAP_FAILED)
+            base = nullptr;
+        else
+        {
+            arena->pageKind = "hugetlb";
+            populated = options.prefault;
+        }
+    }
+    if (base == nullptr && options.hugePages != HugePages::None)
+    {
+        arena->bufferSize = RoundUp(bufferSize, HUGE_PAGE_SIZE);
+        arena->mappedSize = arena->bufferSize * arena->count;
+        base = MapAligned(arena->mappedSize);
+        if (base != nullptr && madvise(base, arena->mappedSize, MADV_HUGEPAGE) == 0)
+            arena->pageKind = "thp";
+    }
+    if (base == nullptr)
+    {
+        arena->bufferSize = RoundUp(bufferSize, pageSize);
+        arena->mappedSize = arena->bufferSize * arena->count;
+        base = mmap(nullptr, arena->mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return nullptr;
+        arena->pageKind = "4k";
+    }
+    arena->base = static_cast<unsigned char*>(base);
+
+    // Touch every page now (MAP_POPULATE already did it for hugetlb). Writing,
+    // not reading, so each page gets its own frame instead of the shared zero
+    // page; with THP the first write in each 2 MiB extent brings in a huge page.
+    if (options.prefault && !populated)
+    {
+        for (size_t offset = 0; offset < arena->mappedSize; offset += pageSize)
+            arena->base[offset] = 0;
+    }
+
+    for (size_t i = arena->count; i-- > 0; )
+        arena->freeBuffers.push_back(arena->base + i * arena->bufferSize);
+    return arena;
+}
+
+ChunkArena::~ChunkArena()
+{
+    if (base != nullptr)
+        munmap(base, mappedSize);
+}
+
+unsigned char* ChunkArena::Acquire()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (freeBuffers.empty())
+        return nullptr;
+    unsigned char* buffer = freeBuffers.back();
+    freeBuffers.pop_back();
+    return buffer;
+}
+
+void ChunkArena::Release(unsigned char* buffer)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    freeBuffers.push_back(buffer);
+}
@@ -0,0 +1,73 @@
+// ChunkArena.h : a fixed set of chunk buffers, mapped once (on huge pages
+// where possible) and recycled, instead of committing and releasing memory for
+// every chunk (Linux).
+//
+// Committing a fresh 1 GB buffer per chunk costs a page fault per 4 KiB page
+// (262144 per GB) the first time each page is written, plus the TLB misses of
+// walking that many small pages. The arena maps all its buffers when it is
+// created, optionally faults them in right away, and hands the same buffers
+// out again and again, so steady-state processing takes no page faults at all.
+//
+// Page sizes, in order of preference for HugePages::Explicit:
+//   hugetlb  MAP_HUGETLB, from the pool in /proc/sys/vm/nr_hugepages
+//   thp      transparent huge pages requested with madvise(MADV_HUGEPAGE)
+//   4k       ordinary pages if the kernel gives no huge pages
+//
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum class HugePages
+{
+    None,           // 4 KiB pages.
+    Transparent,    // madvise(MADV_HUGEPAGE).
+    Explicit        // MAP_HUGETLB, falling back to Transparent.
+};
+
+struct ChunkArenaOptions
+{
+    size_t bufferSize = 64u << 20;      // Rounded up to the page size in use (2 MiB with huge pages).
+    size_t count = 4;
+    HugePages hugePages = HugePages::Explicit;
+    bool prefault = true;               // Fault every page in at creation.
+};
+
+class ChunkArena
+{
+public:
+    // Create: maps the buffers. Returns null, with errno set, if the memory
+    // cannot be mapped at all.
+    static std::unique_ptr<ChunkArena> Create(const ChunkArenaOptions& options);
+    ~ChunkArena();
+
+    ChunkArena(const ChunkArena&) = delete;
+    ChunkArena& operator=(const ChunkArena&) = delete;
+
+    // Acquire: a free buffer, or nullptr if all are in use. Thread-safe.
+    unsigned char* Acquire();
+    // Release: returns a buffer from Acquire() to the arena. Its contents are
+    // kept; the pages stay mapped.
+    void Release(unsigned char* buffer);
+
+    size_t BufferSize() const { return bufferSize; }
+    size_t Count() const { return count; }
+    // "hugetlb", "thp" or "4k": what the mapping was created with. For thp the
+    // kernel may still back some of it with 4 KiB pages (see AnonHugePages in
+    // /proc/meminfo).
+    const char* PageKind() const { return pageKind; }
+
+private:
+    ChunkArena() = default;
+
+    unsigned char* base = nullptr;
+    size_t mappedSize = 0;
+    size_t bufferSize = 0;
+    size_t count = 0;
+    const char* pageKind = "4k";
+
+    std::mutex lock;
+    std::vector<unsigned char*> freeBuffers;
+};
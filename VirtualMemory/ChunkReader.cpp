@@ -0,0 +1,531 @@
+// ChunkReader.cpp : io_uring and reader-thread pipelines (Linux). See ChunkReader.h.
+//
+#include "ChunkReader.h"
+#include "ChunkArena.h"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define CHUNKREADER_HAVE_IO_URING
+#endif
+#endif
+
+namespace
+{
+    const size_t ALIGNMENT = 4096;      // Buffer, offset and length alignment for O_DIRECT.
+
+    using Clock = std::chrono::steady_clock;
+
+    double SecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // One chunk buffer and the read that fills it.
+    struct Slot
+    {
+        unsigned char* buffer = nullptr;
+        uint64_t offset = 0;        // File offset of the chunk.
+        size_t size = 0;            // Bytes expected (less at the end of the file).
+        size_t filled = 0;          // Bytes read so far.
+        bool inFlight = false;
+        bool done = false;
+        int error = 0;
+        iovec iov;                  // io_uring READV needs it until the read completes.
+    };
+
+    // The chunks of a file and the buffers they cycle through.
+    struct Pipeline
+    {
+        int fd = -1;
+        uint64_t fileSize = 0;
+        size_t chunkSize = 0;
+        uint64_t nChunks = 0;
+        bool directIO = false;
+        ChunkArena* arena = nullptr;
+        std::vector<Slot> slots;
+
+        ~Pipeline()
+        {
+            for (Slot& slot : slots)
+            {
+                if (arena != nullptr && slot.buffer != nullptr)
+                    arena->Release(slot.buffer);
+                else
+                    free(slot.buffer);
+            }
+            if (fd >= 0)
+                close(fd);
+        }
+
+        // Points slot (chunk % depth) at chunk.
+        Slot& Assign(uint64_t chunk)
+        {
+            Slot& slot = slots[chunk % slots.size()];
+            slot.offset = chunk * chunkSize;
+            slot.size = fileSize - slot.offset < chunkSize ? (size_t)(fileSize - slot.offset) : chunkSize;
+            slot.filled = 0;
+            slot.done = false;
+            slot.error = 0;
+            return slot;
+        }
+
+        // Length to request for the rest of slot: O_DIRECT needs whole
+        // aligned blocks, and the kernel stops at the end of the file anyway.
+        size_t RequestLength(const Slot& slot) const
+        {
+            size_t len = slot.size - slot.filled;
+            if (directIO)
+                len = (len + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            return len;
+        }
+    };
+
+    // ---------------------- io_uring ----------------------
+
+#ifdef CHUNKREADER_HAVE_IO_URING
+
+    // A minimal io_uring: one submission and one completion queue mapped from
+    // the kernel, driven with io_uring_enter.
+    class Ring
+    {
+    public:
+        ~Ring()
+        {
+            if (sqes != nullptr)
+                munmap(sqes, sqesSize);
+            if (cqRing != nullptr && cqRing != sqRing)
+                munmap(cqRing, cqRingSize);
+            if (sqRing != nullptr)
+                munmap(sqRing, sqRingSize);
+            if (fd >= 0)
+                close(fd);
+        }
+
+        bool Init(unsigned entries)
+        {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+            if (fd < 0)
+                return false;
+
+            sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (singleMap && cqRingSize > sqRingSize)
+                sqRingSize = cqRingSize;
+
+            sqRing = Map(sqRingSize, IORING_OFF_SQ_RING);
+            if (sqRing == nullptr)
+                return false;
+            cqRing = singleMap ? sqRing : Map(cqRingSize, IORING_OFF_CQ_RING);
+            sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = static_cast<io_uring_sqe*>(Map(sqesSize, IORING_OFF_SQES));
+            if (cqRing == nullptr || sqes == nullptr)
+                return false;
+
+            unsigned char* sq = static_cast<unsigned char*>(sqRing);
+            sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            unsigned char* cq = static_cast<unsigned char*>(cqRing);
+            cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            return true;
+        }
+
+        // Queues a vectored read and submits it. The ring has an entry per
+        // slot and each slot has at most one read in flight, so it never fills.
+        //
+        // A buffered read of cached data would otherwise be done inline by
+        // io_uring_enter, i.e. the page cache copy would run on the processing
+        // thread; IOSQE_ASYNC hands it to a kernel worker instead.
+        bool SubmitRead(int file, iovec* iov, uint64_t offset, uint64_t userData, bool async)
+        {
+            unsigned tail = *sqTail;
+            unsigned index = tail & sqMask;
+            io_uring_sqe* sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = file;
+            sqe->addr = (uint64_t)(uintptr_t)iov;
+            sqe->len = 1;
+            sqe->off = offset;
+            sqe->user_data = userData;
+            if (async)
+                sqe->flags = IOSQE_ASYNC;
+            sqArray[index] = index;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+            for (;;)
+            {
+                long submitted = syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0);
+                if (submitted >= 0)
+                    return true;
+                if (errno != EINTR && errno != EAGAIN)
+                    return false;
+            }
+        }
+
+        // Waits for one completion.
+        bool Wait(uint64_t& userData, int& result)
+        {
+            for (;;)
+            {
+                unsigned head = *cqHead;
+                if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+                {
+                    const io_uring_cqe& cqe = cqes[head & cqMask];
+                    userData = cqe.user_data;
+                    result = cqe.res;
+                    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                    return true;
+                }
+                long rc = syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (rc < 0 && errno != EINTR)
+                    return false;
+            }
+        }
+
+    private:
+        void* Map(size_t size, off_t offset)
+        {
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+            return p == MAP_FAILED ? nullptr : p;
+        }
+
+        int fd = -1;
+        void* sqRing = nullptr;
+        void* cqRing = nullptr;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+        unsigned* sqTail = nullptr;
+        unsigned* sqArray = nullptr;
+        unsigned sqMask = 0;
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned cqMask = 0;
+        io_uring_cqe* cqes = nullptr;
+    };
+
+    bool SubmitSlot(Ring& ring, Pipeline& pipeline, size_t index)
+    {
+        Slot& slot = pipeline.slots[index];
+        slot.iov.iov_base = slot.buffer + slot.filled;
+        slot.iov.iov_len = pipeline.RequestLength(slot);
+        slot.inFlight = ring.SubmitRead(pipeline.fd, &slot.iov, slot.offset + slot.filled, index, !pipeline.directIO);
+        if (!slot.inFlight)
+        {
+            slot.error = errno;
+            slot.done = true;
+        }
+        return slot.inFlight;
+    }
+
+    // Handles one completion: a short read is resubmitted for the rest.
+    bool Complete(Ring& ring, Pipeline& pipeline)
+    {
+        uint64_t index;
+        int result;
+        if (!ring.Wait(index, result))
+            return false;
+
+        Slot& slot = pipeline.slots[index];
+        slot.inFlight = false;
+        if (result < 0)
+        {
+            slot.error = -result;
+            slot.done = true;
+        }
+        else if (result == 0)
+        {
+            // The file shrank; hand over what there is.
+            slot.size = slot.filled;
+            slot.done = true;
+        }
+        else
+        {
+            slot.filled += (size_t)result;
+            if (slot.filled >= slot.size)
+            {
+                slot.filled = slot.size;
+                slot.done = true;
+            }
+            else
+            {
+                SubmitSlot(ring, pipeline, index);
+            }
+        }
+        return true;
+    }
+
+    // Returns false if io_uring is not available; otherwise runs the pipeline
+    // and reports its outcome in ok/error.
+    bool RunIoUring(Pipeline& pipeline, const ChunkCallback& callback, ChunkReaderStats& stats, bool& ok, int& error)
+    {
+        Ring ring;
+        if (!ring.Init((unsigned)pipeline.slots.size()))
+            return false;
+        stats.backend = "io_uring";
+
+        size_t depth = pipeline.slots.size();
+        for (uint64_t chunk = 0; chunk < depth && chunk < pipeline.nChunks; chunk++)
+        {
+            pipeline.Assign(chunk);
+            SubmitSlot(ring, pipeline, (size_t)chunk);
+        }
+
+        ok = true;
+        for (uint64_t chunk = 0; chunk < pipeline.nChunks && ok; chunk++)
+        {
+            Slot& slot = pipeline.slots[chunk % depth];
+            auto waitStart = Clock::now();
+            while (!slot.done)
+            {
+                if (!Complete(ring, pipeline))
+                {
+                    slot.error = errno;
+                    break;
+                }
+            }
+            stats.waitSeconds += SecondsSince(waitStart);
+            if (slot.error != 0)
+            {
+                ok = false;
+                error = slot.error;
+                break;
+            }
+
+            auto processStart = Clock::now();
+            bool more = callback(FileChunk{ slot.buffer, slot.size, slot.offset });
+            stats.processSeconds += SecondsSince(processStart);
+            stats.bytes += slot.size;
+            stats.chunks++;
+            if (!more)
+                break;
+
+            if (chunk + depth < pipeline.nChunks)
+            {
+                pipeline.Assign(chunk + depth);
+                SubmitSlot(ring, pipeline, (size_t)(chunk % depth));
+            }
+        }
+
+        // The buffers are freed after this returns: wait out the reads that
+        // are still in flight.
+        for (;;)
+        {
+            bool pending = false;
+            for (const Slot& slot : pipeline.slots)
+                pending = pending || slot.inFlight;
+            if (!pending)
+                break;
+            uint64_t index;
+            int result;
+            if (!ring.Wait(index, result))
+                break;
+            pipeline.slots[index].inFlight = false;
+        }
+        return true;
+    }
+
+#endif // CHUNKREADER_HAVE_IO_URING
+
+    // ---------------------- Reader Thread ----------------------
+
+    // Fills the rest of slot with pread; returns false with slot.error set.
+    bool ReadSlot(Pipeline& pipeline, Slot& slot)
+    {
+        while (slot.filled < slot.size)
+        {
+            ssize_t n = pread(pipeline.fd, slot.buffer + slot.filled, pipeline.RequestLength(slot),
+                              (off_t)(slot.offset + slot.filled));
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                slot.error = errno;
+                return false;
+            }
+            if (n == 0)
+            {
+                slot.size = slot.filled;
+                break;
+            }
+            slot.filled += (size_t)n;
+        }
+        if (slot.filled > slot.size)
+            slot.filled = slot.size;
+        return true;
+    }
+
+    void RunThread(Pipeline& pipeline, const ChunkCallback& callback, ChunkReaderStats& stats, bool& ok, int& error)
+    {
+        stats.backend = "thread";
+        size_t depth = pipeline.slots.size();
+        std::mutex lock;
+        std::condition_variable changed;
+        bool stop = false;
+
+        // The reader fills slots in chunk order; a slot is free again once the
+        // processing side has cleared its done flag.
+        std::thread reader([&]()
+            {
+                for (uint64_t chunk = 0; chunk < pipeline.nChunks; chunk++)
+                {
+                    Slot& slot = pipeline.slots[chunk % depth];
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        changed.wait(guard, [&] { return stop || !slot.inFlight; });
+                        if (stop)
+                            return;
+                        pipeline.Assign(chunk);
+                    }
+                    bool read = ReadSlot(pipeline, slot);
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    slot.inFlight = true;   // Holds data the processing side has not consumed.
+                    slot.done = true;
+                    changed.notify_all();
+                    if (!read)
+                        return;
+                }
+            });
+
+        ok = true;
+        for (uint64_t chunk = 0; chunk < pipeline.nChunks; chunk++)
+        {
+            Slot& slot = pipeline.slots[chunk % depth];
+            auto waitStart = Clock::now();
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&] { return slot.done; });
+            }
+            stats.waitSeconds += SecondsSince(waitStart);
+            if (slot.error != 0)
+            {
+                ok = false;
+                error = slot.error;
+                break;
+            }
+
+            auto processStart = Clock::now();
+            bool more = callback(FileChunk{ slot.buffer, slot.size, slot.offset });
+            stats.processSeconds += SecondsSince(processStart);
+            stats.bytes += slot.size;
+            stats.chunks++;
+            if (!more)
+                break;
+
+            std::lock_guard<std::mutex> guard(lock);
+            slot.done = false;
+            slot.inFlight = false;
+            changed.notify_all();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+            changed.notify_all();
+        }
+        reader.join();
+    }
+}
+
+bool ProcessFileChunks(const char* path, const ChunkReaderOptions& options, const ChunkCallback& callback,
+                       ChunkReaderStats* stats)
+{
+    ChunkReaderStats local;
+    ChunkReaderStats& s = stats != nullptr ? *stats : local;
+    s = ChunkReaderStats();
+    auto start = Clock::now();
+
+    Pipeline pipeline;
+    if (options.directIO)
+    {
+        pipeline.fd = open(path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+        pipeline.directIO = pipeline.fd >= 0;
+    }
+    if (pipeline.fd < 0)
+        pipeline.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (pipeline.fd < 0)
+        return false;
+    s.directIO = pipeline.directIO;
+
+    struct stat st;
+    if (fstat(pipeline.fd, &st) != 0)
+        return false;
+    if (!pipeline.directIO)
+        posix_fadvise(pipeline.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    pipeline.fileSize = (uint64_t)st.st_size;
+    size_t chunkSize = options.chunkSize == 0 ? ALIGNMENT : options.chunkSize;
+    if (options.arena != nullptr && chunkSize > options.arena->BufferSize())
+        chunkSize = options.arena->BufferSize();
+    pipeline.chunkSize = (chunkSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    pipeline.nChunks = (pipeline.fileSize + pipeline.chunkSize - 1) / pipeline.chunkSize;
+
+    size_t depth = options.depth == 0 ? 1 : options.depth;
+    if (pipeline.nChunks > 0 && depth > pipeline.nChunks)
+        depth = (size_t)pipeline.nChunks;
+    pipeline.arena = options.arena;
+    pipeline.slots.reserve(depth);
+    for (size_t i = 0; i < depth; i++)
+    {
+        void* buffer = nullptr;
+        if (options.arena != nullptr)
+            buffer = options.arena->Acquire();
+        else if (posix_memalign(&buffer, ALIGNMENT, pipeline.chunkSize) != 0)
+            buffer = nullptr;
+        if (buffer == nullptr)
+            break;
+        pipeline.slots.emplace_back();
+        pipeline.slots.back().buffer = static_cast<unsigned char*>(buffer);
+    }
+    if (pipeline.slots.empty())
+    {
+        errno = options.arena != nullptr ? EBUSY : ENOMEM;
+        return false;
+    }
+
+    bool ok = true;
+    int error = 0;
+    bool ran = false;
+#ifdef CHUNKREADER_HAVE_IO_URING
+    if (options.backend != ChunkReadBackend::Thread)
+        ran = RunIoUring(pipeline, callback, s, ok, error);
+#endif
+    if (!ran)
+    {
+        if (options.backend == ChunkReadBackend::IoUring)
+        {
+            errno = ENOSYS;
+            return false;
+        }
+        RunThread(pipeline, callback, s, ok, error);
+    }
+
+    s.seconds = SecondsSince(start);
+    if (!ok)
+        errno = error;
+    return ok;
+}
@@ -0,0 +1,68 @@
+// ChunkReader.h : pipelined chunked reader (Linux). Keeps several chunk reads
+// in flight while the caller processes the chunks that have arrived.
+//
+// The serial loop "read a chunk, process it, read the next" leaves the disk idle
+// during processing and the CPU idle during reads. Here `depth` chunk buffers
+// circulate: all of them are queued for reading up front, the callback gets
+// chunk i as soon as it is complete (always in file order), and its buffer is
+// queued again for chunk i + depth when the callback returns. The wall time
+// tends to max(read time, process time) instead of their sum.
+//
+// Reads go through io_uring (raw system calls, no liburing needed) where the
+// kernel allows it, otherwise through a reader thread that fills the buffers
+// with pread().
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+class ChunkArena;
+
+struct FileChunk
+{
+    const unsigned char* data;
+    size_t size;
+    uint64_t offset;        // Offset of data[0] in the file.
+};
+
+// Return false to stop early. data is only valid during the call.
+using ChunkCallback = std::function<bool(const FileChunk& chunk)>;
+
+enum class ChunkReadBackend
+{
+    Auto,                   // io_uring if available, else the reader thread.
+    IoUring,
+    Thread
+};
+
+struct ChunkReaderOptions
+{
+    size_t chunkSize = 64u << 20;       // Rounded up to a multiple of 4 KiB.
+    size_t depth = 4;                   // Chunk buffers in flight; 1 reads and processes serially.
+    ChunkReadBackend backend = ChunkReadBackend::Auto;
+    bool directIO = false;              // O_DIRECT: bypass the page cache (if the file system allows it).
+    // Buffers to read into (ChunkArena.h). Without an arena each run allocates
+    // its own; with one, chunkSize is capped at the arena's buffer size and the
+    // depth at the buffers it has free.
+    ChunkArena* arena = nullptr;
+};
+
+struct ChunkReaderStats
+{
+    uint64_t bytes = 0;
+    uint64_t chunks = 0;
+    double seconds = 0;                 // Wall time of the whole run.
+    double waitSeconds = 0;             // Time the processing side waited for a chunk to arrive.
+    double processSeconds = 0;          // Time spent in the callback.
+    const char* backend = "";           // "io_uring" or "thread".
+    bool directIO = false;              // O_DIRECT was in effect.
+};
+
+// ProcessFileChunks: calls callback on consecutive chunks of the file at path,
+// in order, until the end of the file or until callback returns false. Returns
+// false, with errno set, if the file cannot be opened or read; stats (optional)
+// is filled in either way.
+bool ProcessFileChunks(const char* path, const ChunkReaderOptions& options, const ChunkCallback& callback,
+                       ChunkReaderStats* stats = nullptr);
@@ -0,0 +1,145 @@
+// MappedFile.cpp : sliding-window mmap engine (Linux). See MappedFile.h.
+//
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <chrono>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    struct Mapping
+    {
+        void* base = nullptr;
+        size_t size = 0;
+        uint64_t offset = 0;
+    };
+
+    // Maps size bytes of fd at offset (a multiple of the page size).
+    bool MapWindow(int fd, uint64_t offset, size_t size, Mapping& mapping)
+    {
+        void* base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+        if (base == MAP_FAILED)
+            return false;
+        madvise(base, size, MADV_SEQUENTIAL);
+        mapping.base = base;
+        mapping.size = size;
+        mapping.offset = offset;
+        return true;
+    }
+
+    void UnmapWindow(int fd, Mapping& mapping, bool dropPageCache)
+    {
+        if (mapping.base == nullptr)
+            return;
+        // Drop the pages from this process first; munmap alone would do it
+        // too, but MADV_DONTNEED makes the release explicit while the next
+        // window is already being read.
+        madvise(mapping.base, mapping.size, MADV_DONTNEED);
+        munmap(mapping.base, mapping.size);
+        if (dropPageCache)
+            posix_fadvise(fd, (off_t)mapping.offset, (off_t)mapping.size, POSIX_FADV_DONTNEED);
+        mapping = Mapping();
+    }
+
+    void ReadFaults(long& major, long& minor)
+    {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        major = usage.ru_majflt;
+        minor = usage.ru_minflt;
+    }
+}
+
+bool ProcessMappedFile(const char* path, const MappedFileOptions& options, const WindowCallback& callback,
+                       MappedFileStats* stats)
+{
+    MappedFileStats local;
+    MappedFileStats& s = stats != nullptr ? *stats : local;
+    s = MappedFileStats();
+
+    auto start = std::chrono::steady_clock::now();
+    long majorStart, minorStart;
+    ReadFaults(majorStart, minorStart);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+    const uint64_t fileSize = (uint64_t)st.st_size;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t window = options.windowSize == 0 ? pageSize : options.windowSize;
+    window = (window + pageSize - 1) / pageSize * pageSize;
+
+    auto windowAt = [&](uint64_t offset) -> size_t
+    {
+        return fileSize - offset < window ? (size_t)(fileSize - offset) : window;
+    };
+
+    bool ok = true;
+    int error = 0;
+    Mapping current, next;
+    if (fileSize > 0 && !MapWindow(fd, 0, windowAt(0), current))
+    {
+        ok = false;
+        error = errno;
+    }
+
+    while (ok && current.base != nullptr)
+    {
+        // Start reading the next window before the callback touches this one.
+        uint64_t nextOffset = current.offset + current.size;
+        if (options.prefetchNext && nextOffset < fileSize)
+        {
+            if (MapWindow(fd, nextOffset, windowAt(nextOffset), next))
+                madvise(next.base, next.size, MADV_WILLNEED);
+        }
+
+        FileWindow view = { static_cast<const unsigned char*>(current.base), current.size, current.offset };
+        bool more = callback(view);
+        s.bytes += current.size;
+        s.windows++;
+
+        UnmapWindow(fd, current, options.dropPageCache);
+        if (!more || nextOffset >= fileSize)
+            break;
+
+        if (next.base != nullptr)
+        {
+            current = next;
+            next = Mapping();
+        }
+        else if (!MapWindow(fd, nextOffset, windowAt(nextOffset), current))
+        {
+            ok = false;
+            error = errno;
+        }
+    }
+    UnmapWindow(fd, next, options.dropPageCache);
+    close(fd);
+
+    long majorEnd, minorEnd;
+    ReadFaults(majorEnd, minorEnd);
+    s.majorFaults = majorEnd - majorStart;
+    s.minorFaults = minorEnd - minorStart;
+    s.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!ok)
+        errno = error;
+    return ok;
+}
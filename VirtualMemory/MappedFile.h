@@ -0,0 +1,49 @@
+// MappedFile.h : Linux engine that processes a large file through a sliding
+// window of read-only mappings, without copying it into private memory.
+//
+// Instead of committing a buffer per chunk and read()ing the file into it, each
+// window of the file is mmap()ed straight from the page cache and handed to a
+// callback. The next window is mapped and MADV_WILLNEED'ed before the callback
+// runs on the current one, so its I/O overlaps the processing; the finished
+// window is MADV_DONTNEED'ed and unmapped, so the resident set stays at about
+// two windows whatever the file size.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+struct FileWindow
+{
+    const unsigned char* data;
+    size_t size;
+    uint64_t offset;        // Offset of data[0] in the file.
+};
+
+// Return false to stop early.
+using WindowCallback = std::function<bool(const FileWindow& window)>;
+
+struct MappedFileOptions
+{
+    size_t windowSize = 256u << 20;     // Rounded up to a multiple of the page size.
+    bool prefetchNext = true;           // Map and MADV_WILLNEED the next window ahead of the callback.
+    bool dropPageCache = false;         // Also evict finished windows from the page cache
+                                        // (POSIX_FADV_DONTNEED), for files read only once.
+};
+
+struct MappedFileStats
+{
+    uint64_t bytes = 0;                 // Bytes handed to the callback.
+    uint64_t windows = 0;
+    double seconds = 0;
+    long majorFaults = 0;               // Page faults that waited for I/O, during the run.
+    long minorFaults = 0;
+};
+
+// ProcessMappedFile: calls callback on consecutive windows of the file at path
+// until the end of the file or until callback returns false. Returns false,
+// with errno set, if the file cannot be opened or mapped; stats (optional) is
+// filled in either way.
+bool ProcessMappedFile(const char* path, const MappedFileOptions& options, const WindowCallback& callback,
+                       MappedFileStats* stats = nullptr);
@@ -0,0 +1,353 @@
+// MemoryTelemetry.cpp : /proc and getrusage readers, background sampler (Linux). See MemoryTelemetry.h.
+//
+#include "MemoryTelemetry.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace
+{
+    // The /proc files, opened once per process. pread at offset 0 makes the
+    // kernel generate the file again, so the same descriptor serves every
+    // sample. /proc/self is resolved at open(), so a forked child inherits
+    // descriptors that still describe its parent: Files() reopens them when
+    // getpid() changes.
+    struct ProcFiles
+    {
+        int statm = -1;
+        int smapsRollup = -1;
+        uint64_t pageSize = 4096;
+
+        void Open()
+        {
+            if (statm >= 0)
+                close(statm);
+            if (smapsRollup >= 0)
+                close(smapsRollup);
+            statm = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+            smapsRollup = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+            pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+        }
+    };
+
+    const ProcFiles& Files()
+    {
+        static ProcFiles files;
+        static std::atomic<pid_t> openedBy{ 0 };
+        static std::mutex lock;
+        pid_t pid = getpid();
+        if (openedBy.load(std::memory_order_acquire) != pid)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (openedBy.load(std::memory_order_relaxed) != pid)
+            {
+                files.Open();
+                openedBy.store(pid, std::memory_order_release);
+            }
+        }
+        return files;
+    }
+
+    // Reads all of fd into buffer (NUL-terminated); returns the length or -1.
+    ssize_t ReadAll(int fd, char* buffer, size_t size)
+    {
+        if (fd < 0)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+        size_t length = 0;
+        while (length + 1 < size)
+        {
+            ssize_t n = pread(fd, buffer + length, size - 1 - length, (off_t)length);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return -1;
+            if (n == 0)
+                break;
+            length += (size_t)n;
+        }
+        buffer[length] = '\0';
+        return (ssize_t)length;
+    }
+
+    // Value in bytes of the "Key:   123 kB" line of an smaps-style file, or 0.
+    uint64_t KilobyteField(const char* text, const char* key)
+    {
+        size_t keyLength = strlen(key);
+        for (const char* line = text; line != nullptr && *line != '\0'; )
+        {
+            if (strncmp(line, key, keyLength) == 0 && line[keyLength] == ':')
+                return strtoull(line + keyLength + 1, nullptr, 10) * 1024;
+            line = strchr(line, '\n');
+            if (line != nullptr)
+                line++;
+        }
+        return 0;
+    }
+
+    void AppendBytes(std::string& out, const char* key, uint64_t value)
+    {
+        char text[64];
+        snprintf(text, sizeof(text), "\"%s\": %" PRIu64, key, value);
+        out += text;
+    }
+
+    // Appends value as a JSON string literal, of any length, with quotes,
+    // backslashes and control characters escaped.
+    void AppendJsonString(std::string& out, const std::string& value)
+    {
+        out += '"';
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)(unsigned char)c);
+                out += escaped;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+}
+
+bool ReadMemorySample(MemorySample& sample, bool detailed)
+{
+    const ProcFiles& files = Files();
+
+    // statm: size resident shared text lib data dt, in pages.
+    char text[4096];
+    if (ReadAll(files.statm, text, sizeof(text)) <= 0)
+        return false;
+    unsigned long long size = 0, resident = 0, shared = 0;
+    if (sscanf(text, "%llu %llu %llu", &size, &resident, &shared) != 3)
+    {
+        errno = EIO;
+        return false;
+    }
+    sample.virtualBytes = size * files.pageSize;
+    sample.rssBytes = resident * files.pageSize;
+    sample.fileBytes = shared * files.pageSize;
+    sample.anonBytes = resident > shared ? (resident - shared) * files.pageSize : 0;
+    sample.anonHugeBytes = 0;
+    sample.detailed = false;
+
+    if (detailed && ReadAll(files.smapsRollup, text, sizeof(text)) > 0)
+    {
+        uint64_t rss = KilobyteField(text, "Rss");
+        sample.anonBytes = KilobyteField(text, "Anonymous");
+        sample.fileBytes = rss > sample.anonBytes ? rss - sample.anonBytes : 0;
+        sample.anonHugeBytes = KilobyteField(text, "AnonHugePages");
+        sample.detailed = true;
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    sample.peakRssBytes = (uint64_t)usage.ru_maxrss * 1024;
+    sample.majorFaults = usage.ru_majflt;
+    sample.minorFaults = usage.ru_minflt;
+    return true;
+}
+
+MemorySampler::MemorySampler(const MemorySamplerOptions& options)
+    : options(options)
+{
+}
+
+MemorySampler::~MemorySampler()
+{
+    Stop();
+}
+
+double MemorySampler::Now() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+}
+
+void MemorySampler::Record(const MemorySample& sample)
+{
+    if (nSamples >= options.maxSamples)
+    {
+        dropped++;
+        return;
+    }
+    MemoryPhase& phase = phases.back();
+    phase.samples.push_back(sample);
+    if (sample.rssBytes > phase.peakRssBytes)
+        phase.peakRssBytes = sample.rssBytes;
+    if (sample.anonBytes > phase.peakAnonBytes)
+        phase.peakAnonBytes = sample.anonBytes;
+    nSamples++;
+}
+
+bool MemorySampler::Start(const char* name)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (running)
+        return false;
+    started = std::chrono::steady_clock::now();
+    MemorySample sample;
+    if (!ReadMemorySample(sample, options.detailed))
+        return false;
+
+    phases.clear();
+    nSamples = 0;
+    dropped = 0;
+    phases.push_back(MemoryPhase());
+    phases.back().name = name;
+    Record(sample);
+
+    running = true;
+    stopping = false;
+    if (options.intervalMs > 0)
+        thread = std::thread(&MemorySampler::Run, this);
+    return true;
+}
+
+void MemorySampler::Run()
+{
+    const auto interval = std::chrono::milliseconds(options.intervalMs);
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping)
+    {
+        wake.wait_for(guard, interval, [&] { return stopping; });
+        if (stopping)
+            break;
+        // Read /proc without the lock, so Phase() is never held up by it.
+        guard.unlock();
+        MemorySample sample;
+        double now = Now();
+        bool ok = ReadMemorySample(sample, options.detailed);
+        sample.seconds = now;
+        guard.lock();
+        if (ok && !stopping)
+            Record(sample);
+    }
+}
+
+void MemorySampler::Phase(const char* name)
+{
+    MemorySample sample;
+    double now = Now();
+    bool ok = ReadMemorySample(sample, options.detailed);
+    sample.seconds = now;
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!running)
+        return;
+    phases.back().end = now;
+    phases.push_back(MemoryPhase());
+    phases.back().name = name;
+    phases.back().start = now;
+    if (ok)
+        Record(sample);
+}
+
+void MemorySampler::Stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running)
+            return;
+        stopping = true;
+        wake.notify_all();
+    }
+    if (thread.joinable())
+        thread.join();
+
+    MemorySample sample;
+    double now = Now();
+    bool ok = ReadMemorySample(sample, options.detailed);
+    sample.seconds = now;
+    std::lock_guard<std::mutex> guard(lock);
+    if (ok)
+        Record(sample);
+    phases.back().end = now;
+    running = false;
+}
+
+std::vector<MemoryPhase> MemorySampler::Phases() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return phases;
+}
+
+uint64_t MemorySampler::DroppedSamples() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return dropped;
+}
+
+std::string MemorySampler::Json() const
+{
+    std::vector<MemoryPhase> copy;
+    uint64_t nDropped;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        copy = phases;
+        nDropped = dropped;
+    }
+
+    std::string out = "{\n  \"interval_ms\": " + std::to_string(options.intervalMs) +
+                      ",\n  \"detailed\": " + (options.detailed ? "true" : "false") +
+                      ",\n  \"dropped\": " + std::to_string(nDropped) + ",\n  \"phases\": [";
+    char text[256];
+    for (size_t p = 0; p < copy.size(); p++)
+    {
+        const MemoryPhase& phase = copy[p];
+        // The name goes straight into out: it may be longer than text.
+        out += p == 0 ? "\n    {\"name\": " : ",\n    {\"name\": ";
+        AppendJsonString(out, phase.name);
+        snprintf(text, sizeof(text), ", \"start\": %.6f, \"end\": %.6f, ", phase.start, phase.end);
+        out += text;
+        AppendBytes(out, "peak_rss", phase.peakRssBytes);
+        out += ", ";
+        AppendBytes(out, "peak_anon", phase.peakAnonBytes);
+        out += ",\n     \"columns\": [\"t\", \"rss\", \"anon\", \"file\", \"anon_huge\", \"peak_rss\", \"major_faults\", "
+               "\"minor_faults\"],\n     \"samples\": [";
+        for (size_t i = 0; i < phase.samples.size(); i++)
+        {
+            const MemorySample& s = phase.samples[i];
+            snprintf(text, sizeof(text), "%s\n       [%.6f, %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64
+                     ", %ld, %ld]", i == 0 ? "" : ",", s.seconds, s.rssBytes, s.anonBytes, s.fileBytes,
+                     s.anonHugeBytes, s.peakRssBytes, s.majorFaults, s.minorFaults);
+            out += text;
+        }
+        out += "]}";
+    }
+    out += "\n  ]\n}\n";
+    return out;
+}
+
+bool MemorySampler::WriteJson(const char* path) const
+{
+    std::string json = Json();
+    FILE* file = fopen(path, "w");
+    if (file == nullptr)
+        return false;
+    bool ok = fwrite(json.data(), 1, json.size(), file) == json.size();
+    int error = errno;
+    if (fclose(file) != 0)
+        ok = false;
+    else if (!ok)
+        errno = error;
+    return ok;
+}
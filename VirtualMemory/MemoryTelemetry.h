@@ -0,0 +1,109 @@
+// MemoryTelemetry.h : memory use of the current process (Linux), one sample at
+// a time or as a time series recorded by a background thread.
+//
+// Sources, from cheap to expensive:
+//   /proc/self/statm         resident and shared (file-backed) pages, a few
+//                            counters the kernel keeps anyway
+//   getrusage                peak RSS and page faults
+//   /proc/self/smaps_rollup  anonymous and huge-page totals; the kernel walks
+//                            every mapping to produce it, so it is optional
+// The /proc files are kept open and re-read with pread, so reading a sample
+// costs a couple of system calls and no allocation.
+//
+// A sampler records the series under named phases ("read", "process", ...)
+// and writes it as JSON, to compare the real RSS ceiling of each phase with
+// the window and pool sizes that were configured.
+//
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct MemorySample
+{
+    double seconds = 0;             // Since the sampler started (0 for ReadMemorySample).
+    uint64_t rssBytes = 0;          // Resident set.
+    uint64_t anonBytes = 0;         // Resident anonymous memory (heap, buffers, arenas).
+    uint64_t fileBytes = 0;         // Resident file-backed and shared memory (mapped files, libraries).
+    uint64_t anonHugeBytes = 0;     // Anonymous memory on transparent huge pages; detailed samples only.
+    uint64_t peakRssBytes = 0;      // Highest RSS so far (getrusage).
+    uint64_t virtualBytes = 0;      // Address space.
+    long majorFaults = 0;           // Since the start of the process.
+    long minorFaults = 0;
+    bool detailed = false;          // anonBytes and anonHugeBytes come from smaps_rollup.
+};
+
+// ReadMemorySample: one sample of the current process. With detailed the
+// anonymous / file split comes from smaps_rollup, otherwise from statm
+// (resident minus shared). Returns false, with errno set, if /proc cannot be
+// read.
+bool ReadMemorySample(MemorySample& sample, bool detailed = false);
+
+struct MemorySamplerOptions
+{
+    unsigned intervalMs = 10;       // Time between samples; 0 samples only at phase boundaries.
+    bool detailed = false;          // Read smaps_rollup every sample.
+    size_t maxSamples = 1u << 20;   // Over all phases; later samples are dropped (and counted).
+};
+
+struct MemoryPhase
+{
+    std::string name;
+    double start = 0;
+    double end = 0;                 // Start of the next phase, or when the sampler stopped.
+    uint64_t peakRssBytes = 0;      // Highest RSS among the samples of this phase.
+    uint64_t peakAnonBytes = 0;
+    std::vector<MemorySample> samples;
+};
+
+class MemorySampler
+{
+public:
+    explicit MemorySampler(const MemorySamplerOptions& options = MemorySamplerOptions());
+    ~MemorySampler();
+
+    MemorySampler(const MemorySampler&) = delete;
+    MemorySampler& operator=(const MemorySampler&) = delete;
+
+    // Start: begins phase name and the background thread. Returns false if
+    // the sampler is already running or /proc cannot be read.
+    bool Start(const char* name = "main");
+    // Phase: ends the current phase and begins name. Takes a sample at the
+    // boundary, so even short phases have one.
+    void Phase(const char* name);
+    // Stop: takes a last sample and joins the thread. Called by the destructor.
+    void Stop();
+
+    // Phases: the phases so far (a copy; safe while running).
+    std::vector<MemoryPhase> Phases() const;
+    uint64_t DroppedSamples() const;
+
+    // Json: {"interval_ms", "detailed", "dropped", "phases": [{"name", "start",
+    // "end", "peak_rss", "peak_anon", "columns": [...], "samples": [[...], ...]}]}
+    // with byte counts in bytes and times in seconds.
+    std::string Json() const;
+    // WriteJson: Json() to path. Returns false, with errno set, on failure.
+    bool WriteJson(const char* path) const;
+
+private:
+    void Run();
+    void Record(const MemorySample& sample);    // Requires lock.
+    double Now() const;
+
+    MemorySamplerOptions options;
+    std::chrono::steady_clock::time_point started;
+    mutable std::mutex lock;
+    std::condition_variable wake;
+    bool running = false;
+    bool stopping = false;
+    std::thread thread;
+    std::vector<MemoryPhase> phases;
+    size_t nSamples = 0;
+    uint64_t dropped = 0;
+};
@@ -0,0 +1,388 @@
+// ParallelChunks.cpp : reader / worker pool / ordered reducer (Linux). See ParallelChunks.h.
+//
+#include "ParallelChunks.h"
+#include "ChunkArena.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const size_t ALIGNMENT = 4096;      // Buffer, offset and length alignment for O_DIRECT.
+    const uint64_t STOP = ~0ull;        // Queue entry that tells a worker to exit.
+
+    using Clock = std::chrono::steady_clock;
+
+    double SecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // Bounded multi-producer / multi-consumer queue (Vyukov): each cell has a
+    // sequence number that says whether it is free for the push of ticket
+    // `tail` or holds the value for the pop of ticket `head`. Push and pop
+    // claim a ticket with a compare-and-swap and never take a lock.
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t minCapacity)
+        {
+            size_t capacity = 2;
+            while (capacity < minCapacity)
+                capacity *= 2;
+            mask = capacity - 1;
+            cells.reset(new Cell[capacity]);
+            for (size_t i = 0; i < capacity; i++)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // Returns false if the queue is full.
+        bool TryPush(uint64_t value)
+        {
+            size_t pos = tail.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell& cell = cells[pos & mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+                if (diff == 0)
+                {
+                    if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        cell.value = value;
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Returns false if the queue is empty.
+        bool TryPop(uint64_t& value)
+        {
+            size_t pos = head.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell& cell = cells[pos & mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+                if (diff == 0)
+                {
+                    if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        value = cell.value;
+                        cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            uint64_t value;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        size_t mask = 0;
+        alignas(64) std::atomic<size_t> tail{ 0 };
+        alignas(64) std::atomic<size_t> head{ 0 };
+    };
+
+    // Counting semaphore. The queue itself never blocks; the stages sleep
+    // here when there is nothing for them (futex-based, no system call while
+    // the count stays positive).
+    class Semaphore
+    {
+    public:
+        Semaphore() { sem_init(&sem, 0, 0); }
+        ~Semaphore() { sem_destroy(&sem); }
+        Semaphore(const Semaphore&) = delete;
+        Semaphore& operator=(const Semaphore&) = delete;
+
+        void Post() { sem_post(&sem); }
+        void Wait()
+        {
+            while (sem_wait(&sem) != 0 && errno == EINTR)
+            {
+            }
+        }
+
+    private:
+        sem_t sem;
+    };
+
+    // One chunk buffer. Chunk i always goes to slot i % K: the reducer frees
+    // the slots in file order, so the reader can take them in the same order.
+    struct Slot
+    {
+        unsigned char* buffer = nullptr;
+        FileChunk chunk = {};
+        uint64_t index = 0;
+        int error = 0;              // Read error; the task is skipped.
+        Semaphore done;             // Posted by the worker once the task has run.
+    };
+
+    struct Pipeline
+    {
+        int fd = -1;
+        bool directIO = false;
+        uint64_t fileSize = 0;
+        size_t chunkSize = 0;
+        uint64_t nChunks = 0;
+        ChunkArena* arena = nullptr;
+        std::unique_ptr<Slot[]> slots;
+        size_t nSlots = 0;
+
+        ~Pipeline()
+        {
+            for (size_t i = 0; i < nSlots; i++)
+            {
+                if (arena != nullptr)
+                    arena->Release(slots[i].buffer);
+                else
+                    free(slots[i].buffer);
+            }
+            if (fd >= 0)
+                close(fd);
+        }
+    };
+
+    // Reads chunk `index` into slot; returns false with slot.error set.
+    bool ReadChunk(Pipeline& pipeline, Slot& slot, uint64_t index)
+    {
+        uint64_t offset = index * pipeline.chunkSize;
+        size_t size = pipeline.fileSize - offset < pipeline.chunkSize ? (size_t)(pipeline.fileSize - offset)
+                                                                       : pipeline.chunkSize;
+        size_t filled = 0;
+        slot.error = 0;
+        while (filled < size)
+        {
+            size_t len = size - filled;
+            if (pipeline.directIO)
+                len = (len + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            ssize_t n = pread(pipeline.fd, slot.buffer + filled, len, (off_t)(offset + filled));
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                slot.error = errno;
+                break;
+            }
+            if (n == 0)
+                break;              // The file shrank; hand over what there is.
+            filled += (size_t)n;
+        }
+        if (filled > size)
+            filled = size;
+        slot.index = index;
+        slot.chunk = FileChunk{ slot.buffer, filled, offset };
+        return slot.error == 0;
+    }
+}
+
+void ResolveParallelChunkOptions(ParallelChunkOptions& options)
+{
+    if (options.workers == 0)
+    {
+        options.workers = std::thread::hardware_concurrency();
+        if (options.workers == 0)
+            options.workers = 1;
+    }
+    if (options.inFlight == 0)
+        options.inFlight = 2 * options.workers;
+}
+
+bool ProcessFileChunksParallel(const char* path, const ParallelChunkOptions& options, const ChunkTask& task,
+                               const ChunkReduce& reduce, ParallelChunkStats* stats)
+{
+    ParallelChunkStats local;
+    ParallelChunkStats& s = stats != nullptr ? *stats : local;
+    s = ParallelChunkStats();
+    auto start = Clock::now();
+
+    ParallelChunkOptions resolved = options;
+    ResolveParallelChunkOptions(resolved);
+
+    Pipeline pipeline;
+    if (options.directIO)
+    {
+        pipeline.fd = open(path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+        pipeline.directIO = pipeline.fd >= 0;
+    }
+    if (pipeline.fd < 0)
+        pipeline.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (pipeline.fd < 0)
+        return false;
+    s.directIO = pipeline.directIO;
+
+    struct stat st;
+    if (fstat(pipeline.fd, &st) != 0)
+        return false;
+    if (!pipeline.directIO)
+        posix_fadvise(pipeline.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    pipeline.fileSize = (uint64_t)st.st_size;
+    size_t chunkSize = resolved.chunkSize == 0 ? ALIGNMENT : resolved.chunkSize;
+    if (resolved.arena != nullptr && chunkSize > resolved.arena->BufferSize())
+        chunkSize = resolved.arena->BufferSize();
+    pipeline.chunkSize = (chunkSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    pipeline.nChunks = (pipeline.fileSize + pipeline.chunkSize - 1) / pipeline.chunkSize;
+
+    size_t nSlots = resolved.inFlight;
+    if (pipeline.nChunks > 0 && nSlots > pipeline.nChunks)
+        nSlots = (size_t)pipeline.nChunks;
+    size_t nWorkers = resolved.workers < nSlots ? resolved.workers : nSlots;
+    pipeline.arena = resolved.arena;
+    pipeline.slots.reset(new Slot[nSlots]);
+    for (; pipeline.nSlots < nSlots; pipeline.nSlots++)
+    {
+        void* buffer = nullptr;
+        if (resolved.arena != nullptr)
+            buffer = resolved.arena->Acquire();
+        else if (posix_memalign(&buffer, ALIGNMENT, pipeline.chunkSize) != 0)
+            buffer = nullptr;
+        if (buffer == nullptr)
+            break;
+        pipeline.slots[pipeline.nSlots].buffer = static_cast<unsigned char*>(buffer);
+    }
+    if (pipeline.nSlots == 0)
+    {
+        errno = resolved.arena != nullptr ? EBUSY : ENOMEM;
+        return false;
+    }
+    nSlots = pipeline.nSlots;
+    if (nWorkers > nSlots)
+        nWorkers = nSlots;
+    s.workers = nWorkers;
+    s.inFlight = nSlots;
+
+    // Room for every slot plus a STOP per worker, so a push never fails.
+    BoundedQueue queue(nSlots + nWorkers);
+    Semaphore queued;               // Entries in the queue.
+    Semaphore freeSlots;            // Buffers the reader may fill.
+    for (size_t i = 0; i < nSlots; i++)
+        freeSlots.Post();
+    std::atomic<bool> stop{ false };
+    std::atomic<uint64_t> workNanoseconds{ 0 };
+
+    auto push = [&](uint64_t value)
+    {
+        queue.TryPush(value);
+        queued.Post();
+    };
+
+    std::thread reader([&]()
+        {
+            auto readTime = Clock::duration::zero();
+            for (uint64_t chunk = 0; chunk < pipeline.nChunks; chunk++)
+            {
+                freeSlots.Wait();
+                if (stop.load(std::memory_order_acquire))
+                    break;
+                Slot& slot = pipeline.slots[chunk % nSlots];
+                auto readStart = Clock::now();
+                bool read = ReadChunk(pipeline, slot, chunk);
+                readTime += Clock::now() - readStart;
+                push(chunk % nSlots);
+                if (!read)
+                    break;
+            }
+            s.readSeconds = std::chrono::duration<double>(readTime).count();
+            for (size_t i = 0; i < nWorkers; i++)
+                push(STOP);
+        });
+
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < nWorkers; w++)
+    {
+        workers.emplace_back([&]()
+            {
+                auto workTime = Clock::duration::zero();
+                for (;;)
+                {
+                    queued.Wait();
+                    // Cannot fail: the reader posts only after its push is
+                    // complete, and each post admits one pop.
+                    uint64_t index = STOP;
+                    queue.TryPop(index);
+                    if (index == STOP)
+                        break;
+                    Slot& slot = pipeline.slots[index];
+                    if (slot.error == 0 && !stop.load(std::memory_order_acquire))
+                    {
+                        auto workStart = Clock::now();
+                        task(slot.chunk, slot.index, (size_t)index);
+                        workTime += Clock::now() - workStart;
+                    }
+                    slot.done.Post();
+                }
+                workNanoseconds += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(workTime).count();
+            });
+    }
+
+    // Reducer: chunks in file order.
+    bool ok = true;
+    int error = 0;
+    for (uint64_t chunk = 0; chunk < pipeline.nChunks; chunk++)
+    {
+        Slot& slot = pipeline.slots[chunk % nSlots];
+        auto waitStart = Clock::now();
+        slot.done.Wait();
+        s.reduceWaitSeconds += SecondsSince(waitStart);
+        if (slot.error != 0)
+        {
+            ok = false;
+            error = slot.error;
+            break;
+        }
+
+        bool more = reduce(slot.chunk, chunk, (size_t)(chunk % nSlots));
+        s.bytes += slot.chunk.size;
+        s.chunks++;
+        if (!more)
+            break;
+        freeSlots.Post();
+    }
+
+    // Unblock the reader if it is waiting for a buffer; it stops, sends the
+    // workers their STOP entries, and the workers skip whatever is queued.
+    stop.store(true, std::memory_order_release);
+    freeSlots.Post();
+    reader.join();
+    for (std::thread& worker : workers)
+        worker.join();
+
+    s.workSeconds = workNanoseconds.load() / 1e9;
+    s.seconds = SecondsSince(start);
+    if (!ok)
+        errno = error;
+    return ok;
+}
@@ -0,0 +1,81 @@
+// ParallelChunks.h : processes the chunks of a file on several worker threads
+// and hands their results back in file order (Linux).
+//
+// Three stages:
+//   reader   one thread pread()s consecutive chunks into free buffers and
+//            pushes them onto a bounded lock-free queue
+//   workers  N threads pop chunks and run the per-chunk work in parallel
+//   reducer  the calling thread takes the finished chunks strictly in file
+//            order (chunk i waits for chunk i - 1) and combines the results
+// A buffer returns to the reader only once the reducer is done with it, so at
+// most `inFlight` chunks exist at any time: a slow stage stalls the ones before
+// it instead of letting memory grow.
+//
+#pragma once
+
+#include "ChunkReader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct ParallelChunkOptions
+{
+    size_t chunkSize = 64u << 20;       // Rounded up to a multiple of 4 KiB.
+    size_t workers = 0;                 // 0: one per hardware thread.
+    size_t inFlight = 0;                // Chunk buffers (K); 0: twice the workers. At least workers + 1 keeps
+                                        // every worker busy while the reader fills the next buffer.
+    bool directIO = false;              // O_DIRECT: bypass the page cache (if the file system allows it).
+    ChunkArena* arena = nullptr;        // Buffers to read into, as in ChunkReaderOptions.
+};
+
+struct ParallelChunkStats
+{
+    uint64_t bytes = 0;
+    uint64_t chunks = 0;
+    size_t workers = 0;
+    size_t inFlight = 0;
+    double seconds = 0;                 // Wall time of the whole run.
+    double readSeconds = 0;             // Reader thread time in pread.
+    double workSeconds = 0;             // Sum over the workers of their time in the work callback.
+    double reduceWaitSeconds = 0;       // Time the reducer waited for the next chunk in order.
+    bool directIO = false;
+};
+
+// Runs on a worker thread. slot (< stats.inFlight) identifies the buffer the
+// chunk is in; no other chunk uses it until the reducer has seen this one.
+using ChunkTask = std::function<void(const FileChunk& chunk, uint64_t index, size_t slot)>;
+// Runs on the calling thread, once per chunk, in file order, after the task for
+// that chunk. The chunk data is still valid. Return false to stop early.
+using ChunkReduce = std::function<bool(const FileChunk& chunk, uint64_t index, size_t slot)>;
+
+// ProcessFileChunksParallel: runs task on every chunk of the file at path on
+// the worker threads and reduce on each, in order, on the calling thread.
+// Returns false, with errno set, if the file cannot be opened or read; stats
+// (optional) is filled in either way.
+bool ProcessFileChunksParallel(const char* path, const ParallelChunkOptions& options, const ChunkTask& task,
+                               const ChunkReduce& reduce, ParallelChunkStats* stats = nullptr);
+
+// ResolveParallelChunkOptions: replaces the 0 defaults of workers and
+// inFlight with the values ProcessFileChunksParallel would use. It uses at
+// most inFlight slots (fewer if the arena has fewer buffers free).
+void ResolveParallelChunkOptions(ParallelChunkOptions& options);
+
+// MapReduceFileChunks: the same with a per-chunk result. map runs in parallel;
+// reduce receives each chunk's result in file order.
+template <typename Result>
+bool MapReduceFileChunks(const char* path, const ParallelChunkOptions& options,
+                         const std::function<Result(const FileChunk& chunk)>& map,
+                         const std::function<bool(const FileChunk& chunk, Result& result)>& reduce,
+                         ParallelChunkStats* stats = nullptr)
+{
+    ParallelChunkOptions resolved = options;
+    ResolveParallelChunkOptions(resolved);
+
+    // One result per buffer: a slot is not reused before its result is reduced.
+    std::vector<Result> results(resolved.inFlight);
+    auto task = [&](const FileChunk& chunk, uint64_t, size_t slot) { results[slot] = map(chunk); };
+    auto ordered = [&](const FileChunk& chunk, uint64_t, size_t slot) { return reduce(chunk, results[slot]); };
+    return ProcessFileChunksParallel(path, resolved, task, ordered, stats);
+}
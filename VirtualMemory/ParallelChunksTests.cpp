@@ -0,0 +1,210 @@
+// ParallelChunksTests.cpp : tests for ProcessFileChunksParallel (ParallelChunks.h, Linux).
+//
+//   checksum   an order-dependent checksum of a multi-chunk file, combined by
+//              the reducer, matches a serial one for 1, 2 and 4 workers, with
+//              the default number of buffers and with workers + 1
+//   stop       a reducer that returns false after a few chunks ends the run
+//              with the other threads joined and no more chunks reduced
+//   edges      an empty file (no chunks), a file shorter than one chunk, and a
+//              missing file (false, errno ENOENT)
+//
+// Exits with status 1 if any check fails.
+//
+#include "ParallelChunks.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace
+{
+    const size_t CHUNK_SIZE = 64u << 10;
+
+    int failures = 0;
+
+    // FNV-1a over data, continuing from hash.
+    uint64_t Fnv1a(uint64_t hash, const unsigned char* data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= data[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    // Combines the per-chunk hashes in order, so a chunk reduced out of place
+    // changes the result.
+    uint64_t Combine(uint64_t total, uint64_t chunkHash)
+    {
+        return (total ^ chunkHash) * 0x9e3779b97f4a7c15ull + 1;
+    }
+
+    uint64_t SerialChecksum(const std::vector<unsigned char>& data)
+    {
+        uint64_t total = 0;
+        for (size_t offset = 0; offset < data.size(); offset += CHUNK_SIZE)
+        {
+            size_t size = data.size() - offset < CHUNK_SIZE ? data.size() - offset : CHUNK_SIZE;
+            total = Combine(total, Fnv1a(0xcbf29ce484222325ull, data.data() + offset, size));
+        }
+        return total;
+    }
+
+    // Writes data to a new temporary file and returns its path.
+    std::string WriteTempFile(const std::vector<unsigned char>& data)
+    {
+        char path[] = "/tmp/parallel_chunks_testXXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0)
+        {
+            perror("mkstemp");
+            exit(2);
+        }
+        size_t done = 0;
+        while (done < data.size())
+        {
+            ssize_t n = write(fd, data.data() + done, data.size() - done);
+            if (n <= 0)
+            {
+                perror("write");
+                exit(2);
+            }
+            done += (size_t)n;
+        }
+        close(fd);
+        return path;
+    }
+
+    std::vector<unsigned char> MakeData(size_t size)
+    {
+        std::vector<unsigned char> data(size);
+        uint32_t random = 2463534242u;
+        for (unsigned char& byte : data)
+        {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            byte = (unsigned char)random;
+        }
+        return data;
+    }
+
+    // Runs the checksum through ProcessFileChunksParallel. stopAfter: chunks
+    // to reduce before the reducer returns false (0: never).
+    bool ParallelChecksum(const std::string& path, size_t workers, size_t inFlight, uint64_t stopAfter,
+                          uint64_t& checksum, uint64_t& reduced, ParallelChunkStats& stats)
+    {
+        ParallelChunkOptions options;
+        options.chunkSize = CHUNK_SIZE;
+        options.workers = workers;
+        options.inFlight = inFlight;
+        ResolveParallelChunkOptions(options);
+
+        std::vector<uint64_t> hashes(options.inFlight);
+        checksum = 0;
+        reduced = 0;
+        bool inOrder = true;
+        auto task = [&](const FileChunk& chunk, uint64_t, size_t slot)
+        {
+            hashes[slot] = Fnv1a(0xcbf29ce484222325ull, chunk.data, chunk.size);
+        };
+        auto reduce = [&](const FileChunk& chunk, uint64_t index, size_t slot)
+        {
+            inOrder = inOrder && index == reduced && chunk.offset == index * CHUNK_SIZE;
+            checksum = Combine(checksum, hashes[slot]);
+            reduced++;
+            return stopAfter == 0 || reduced < stopAfter;
+        };
+        bool ok = ProcessFileChunksParallel(path.c_str(), options, task, reduce, &stats);
+        if (!inOrder)
+        {
+            failures++;
+            printf("FAIL workers=%zu: chunks reduced out of order\n", workers);
+        }
+        return ok;
+    }
+
+    void TestChecksum(const char* name, size_t size)
+    {
+        std::vector<unsigned char> data = MakeData(size);
+        std::string path = WriteTempFile(data);
+        uint64_t expected = SerialChecksum(data);
+        uint64_t nChunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+        for (size_t workers : { 1, 2, 4 })
+        {
+            for (size_t inFlight : { (size_t)0, workers + 1 })
+            {
+                uint64_t checksum, reduced;
+                ParallelChunkStats stats;
+                bool ok = ParallelChecksum(path, workers, inFlight, 0, checksum, reduced, stats);
+                if (!ok || checksum != expected || reduced != nChunks || stats.chunks != nChunks ||
+                    stats.bytes != size)
+                {
+                    failures++;
+                    printf("FAIL %s workers=%zu inFlight=%zu: ok %d, %llu of %llu chunks, %llu bytes, checksum %s\n",
+                           name, workers, inFlight, (int)ok, (unsigned long long)reduced,
+                           (unsigned long long)nChunks, (unsigned long long)stats.bytes,
+                           checksum == expected ? "matches" : "differs");
+                }
+            }
+        }
+        unlink(path.c_str());
+    }
+
+    void TestStop()
+    {
+        const uint64_t stopAfter = 3;
+        std::vector<unsigned char> data = MakeData(40 * CHUNK_SIZE);
+        std::string path = WriteTempFile(data);
+        for (size_t workers : { 1, 2, 4 })
+        {
+            uint64_t checksum, reduced;
+            ParallelChunkStats stats;
+            bool ok = ParallelChecksum(path, workers, 0, stopAfter, checksum, reduced, stats);
+            if (!ok || reduced != stopAfter || stats.chunks != stopAfter)
+            {
+                failures++;
+                printf("FAIL stop workers=%zu: ok %d, %llu chunks reduced after stopping at %llu\n", workers, (int)ok,
+                       (unsigned long long)reduced, (unsigned long long)stopAfter);
+            }
+        }
+        unlink(path.c_str());
+    }
+
+    void TestMissingFile()
+    {
+        uint64_t checksum, reduced;
+        ParallelChunkStats stats;
+        errno = 0;
+        bool ok = ParallelChecksum("/nonexistent/parallel_chunks_test", 2, 0, 0, checksum, reduced, stats);
+        if (ok || errno != ENOENT || reduced != 0)
+        {
+            failures++;
+            printf("FAIL missing file: ok %d, errno %d, %llu chunks\n", (int)ok, errno, (unsigned long long)reduced);
+        }
+    }
+}
+
+int main()
+{
+    TestChecksum("multi-chunk", 17 * CHUNK_SIZE + 123);
+    TestChecksum("empty", 0);
+    TestChecksum("sub-chunk", 100);
+    TestStop();
+    TestMissingFile();
+
+    if (failures != 0)
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
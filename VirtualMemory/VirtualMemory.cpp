@@ -1,9 +1,16 @@
 // VirtualMemory.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
+// Windows: reserves address space, commits a chunk at a time and reads the file
+// into it. Linux: maps the file a window at a time (MappedFile.h), so nothing is
+// copied and the resident set stays bounded, or reads it through a pipeline
+// that keeps several chunk reads in flight during processing (ChunkReader.h).
+//
 #define NOMINMAX
 #include <iostream>
+#ifdef _WIN32
 #include<Windows.h>
 #include<Psapi.h>
+#endif
 #include <fstream>
 #include <vector>
 
@@ -13,6 +20,7 @@
 #define _128_KB_    (1024*1024*128)
 #define _4_KB_      (4096)
 
+#ifdef _WIN32
 
 void PrintMemoryUsage()
 {
@@ -91,4 +99,252 @@ int main()
 
     system("pause");
     return 0;
-}
\ No newline at end of file
+}
+
+#else
+
+#include "ChunkArena.h"
+#include "ChunkReader.h"
+#include "MappedFile.h"
+#include "MemoryTelemetry.h"
+#include "ParallelChunks.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+void PrintMemoryUsage()
+{
+    MemorySample sample;
+    if (!ReadMemorySample(sample, true))
+        return;
+    std::cout << "[RAM] Resident: " << sample.rssBytes / 1024 << " KB (anonymous " << sample.anonBytes / 1024
+              << " KB, file " << sample.fileBytes / 1024 << " KB), peak " << sample.peakRssBytes / 1024 << " KB\n";
+    std::cout << "[Virtual Memory] Address space: " << sample.virtualBytes / 1024 << " KB\n";
+    std::cout << "[Faults] " << sample.majorFaults << " major, " << sample.minorFaults << " minor\n";
+}
+
+// Example processing: sums the 64-bit words of the chunk `passes` times (the
+// extra passes stand in for heavier per-chunk work).
+uint64_t ProcessChunk(const unsigned char* data, size_t size, int passes)
+{
+    uint64_t sum = 0;
+    size_t nWords = size / 8;
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (size_t i = 0; i < nWords; i++)
+        {
+            uint64_t word;
+            std::memcpy(&word, data + 8 * i, 8);
+            sum += word;
+        }
+        for (size_t i = nWords * 8; i < size; i++)
+            sum += data[i];
+    }
+    return sum;
+}
+
+int Usage(const char* program)
+{
+    std::cerr << "usage: " << program << " [--engine=mmap|uring|thread|parallel] [--chunk-mb=N] [--depth=N] [--direct]"
+              << " [--huge-pages=none|thp|explicit] [--workers=N] [--passes=N] [--quiet]"
+              << " [--memory-json=PATH] [--sample-ms=N] [FILE]\n"
+              << "  mmap:   sliding window of mappings (MappedFile.h), --chunk-mb is the window\n"
+              << "  uring:  --depth chunk buffers in flight through io_uring (ChunkReader.h)\n"
+              << "  thread: the same with a reader thread; --depth=1 reads and processes serially\n"
+              << "  parallel: --workers threads process the chunks, --depth buffers in flight (ParallelChunks.h)\n"
+              << "  --huge-pages: uring/thread/parallel read into a pre-faulted ChunkArena (ChunkArena.h)\n"
+              << "  --memory-json: sample memory use every --sample-ms (default 10) and write it as JSON\n";
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    std::string path = "large_file.dat";
+    std::string engine = "mmap";
+    size_t chunkMB = 0;
+    size_t depth = 0;
+    size_t workers = 0;
+    bool directIO = false;
+    bool quiet = false;
+    std::string hugePages;
+    std::string memoryJson;
+    unsigned sampleMs = 10;
+    int passes = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--engine=") == 0)
+            engine = arg.substr(9);
+        else if (arg.compare(0, 11, "--chunk-mb=") == 0)
+            chunkMB = (size_t)std::strtoull(arg.c_str() + 11, nullptr, 10);
+        else if (arg.compare(0, 8, "--depth=") == 0)
+            depth = (size_t)std::strtoull(arg.c_str() + 8, nullptr, 10);
+        else if (arg.compare(0, 10, "--workers=") == 0)
+            workers = (size_t)std::strtoull(arg.c_str() + 10, nullptr, 10);
+        else if (arg.compare(0, 9, "--passes=") == 0)
+            passes = std::atoi(arg.c_str() + 9);
+        else if (arg.compare(0, 13, "--huge-pages=") == 0)
+            hugePages = arg.substr(13);
+        else if (arg.compare(0, 14, "--memory-json=") == 0)
+            memoryJson = arg.substr(14);
+        else if (arg.compare(0, 12, "--sample-ms=") == 0)
+            sampleMs = (unsigned)std::strtoul(arg.c_str() + 12, nullptr, 10);
+        else if (arg == "--direct")
+            directIO = true;
+        else if (arg == "--quiet")
+            quiet = true;
+        else if (arg.compare(0, 2, "--") == 0)
+            return Usage(argv[0]);
+        else
+            path = arg;
+    }
+    if (engine != "mmap" && engine != "uring" && engine != "thread" && engine != "parallel")
+        return Usage(argv[0]);
+    if (!hugePages.empty() && hugePages != "none" && hugePages != "thp" && hugePages != "explicit")
+        return Usage(argv[0]);
+
+    std::cout << "BEFORE MEMORY PAGING" << std::endl;
+    PrintMemoryUsage();
+
+    // Phases: "setup" (options, arena) and "process" (the engine run).
+    MemorySamplerOptions samplerOptions;
+    samplerOptions.intervalMs = sampleMs;
+    samplerOptions.detailed = true;
+    MemorySampler sampler(samplerOptions);
+    if (!memoryJson.empty())
+        sampler.Start("setup");
+
+    uint64_t checksum = 0;
+    auto process = [&](const unsigned char* data, size_t size, uint64_t offset)
+    {
+        checksum += ProcessChunk(data, size, passes);
+        if (!quiet)
+        {
+            std::cout << "Processing chunk at offset " << offset << " (" << size / 1024 << " KB)" << std::endl;
+            std::cout << "First byte of the chunk: " << (int)data[0] << std::endl;
+        }
+        return true;
+    };
+
+    bool ok;
+    uint64_t bytes, chunks;
+    double seconds;
+    std::string detail;
+    if (engine == "mmap")
+    {
+        MappedFileOptions options;
+        if (chunkMB != 0)
+            options.windowSize = chunkMB << 20;
+        options.dropPageCache = directIO;
+        MappedFileStats stats;
+        sampler.Phase("process");
+        ok = ProcessMappedFile(path.c_str(), options,
+            [&](const FileWindow& window) { return process(window.data, window.size, window.offset); }, &stats);
+        bytes = stats.bytes;
+        chunks = stats.windows;
+        seconds = stats.seconds;
+        detail = std::to_string(stats.majorFaults) + " major / " + std::to_string(stats.minorFaults) + " minor faults";
+    }
+    else
+    {
+        // Buffers in flight: --depth, or the engine's default.
+        ChunkReaderOptions readerOptions;
+        ParallelChunkOptions parallelOptions;
+        parallelOptions.workers = workers;
+        parallelOptions.inFlight = depth;
+        ResolveParallelChunkOptions(parallelOptions);
+        if (depth == 0)
+            depth = engine == "parallel" ? parallelOptions.inFlight : readerOptions.depth;
+
+        std::unique_ptr<ChunkArena> arena;
+        if (!hugePages.empty())
+        {
+            ChunkArenaOptions arenaOptions;
+            arenaOptions.bufferSize = chunkMB != 0 ? chunkMB << 20 : readerOptions.chunkSize;
+            arenaOptions.count = depth;
+            arenaOptions.hugePages = hugePages == "none" ? HugePages::None :
+                                     hugePages == "thp" ? HugePages::Transparent : HugePages::Explicit;
+            arena = ChunkArena::Create(arenaOptions);
+            if (arena == nullptr)
+            {
+                std::cerr << "Failed to create the chunk arena: " << std::strerror(errno) << std::endl;
+                return -1;
+            }
+        }
+        std::string arenaDetail = arena != nullptr ? std::string(", ") + arena->PageKind() + " arena" : "";
+
+        if (engine == "parallel")
+        {
+            if (chunkMB != 0)
+                parallelOptions.chunkSize = chunkMB << 20;
+            parallelOptions.directIO = directIO;
+            parallelOptions.arena = arena.get();
+            ParallelChunkStats stats;
+            sampler.Phase("process");
+            ok = MapReduceFileChunks<uint64_t>(path.c_str(), parallelOptions,
+                [&](const FileChunk& chunk) { return ProcessChunk(chunk.data, chunk.size, passes); },
+                [&](const FileChunk& chunk, uint64_t& sum)
+                {
+                    checksum += sum;
+                    if (!quiet)
+                    {
+                        std::cout << "Processing chunk at offset " << chunk.offset << " (" << chunk.size / 1024 << " KB)" << std::endl;
+                        std::cout << "First byte of the chunk: " << (int)chunk.data[0] << std::endl;
+                    }
+                    return true;
+                }, &stats);
+            bytes = stats.bytes;
+            chunks = stats.chunks;
+            seconds = stats.seconds;
+            detail = std::to_string(stats.workers) + " workers" + (stats.directIO ? ", O_DIRECT" : "") + arenaDetail +
+                     ", " + std::to_string(stats.inFlight) + " in flight, read " + std::to_string(stats.readSeconds) +
+                     " s, worked " + std::to_string(stats.workSeconds) + " s, reducer waited " +
+                     std::to_string(stats.reduceWaitSeconds) + " s";
+        }
+        else
+        {
+            if (chunkMB != 0)
+                readerOptions.chunkSize = chunkMB << 20;
+            readerOptions.depth = depth;
+            readerOptions.directIO = directIO;
+            readerOptions.backend = engine == "uring" ? ChunkReadBackend::IoUring : ChunkReadBackend::Thread;
+            readerOptions.arena = arena.get();
+            ChunkReaderStats stats;
+            sampler.Phase("process");
+            ok = ProcessFileChunks(path.c_str(), readerOptions,
+                [&](const FileChunk& chunk) { return process(chunk.data, chunk.size, chunk.offset); }, &stats);
+            bytes = stats.bytes;
+            chunks = stats.chunks;
+            seconds = stats.seconds;
+            detail = std::string(stats.backend) + (stats.directIO ? ", O_DIRECT" : "") + arenaDetail + ", depth " +
+                     std::to_string(depth) + ", waited " + std::to_string(stats.waitSeconds) + " s, processed " +
+                     std::to_string(stats.processSeconds) + " s";
+        }
+    }
+
+    if (!memoryJson.empty())
+    {
+        sampler.Stop();
+        if (!sampler.WriteJson(memoryJson.c_str()))
+            std::cerr << "Failed to write " << memoryJson << ": " << std::strerror(errno) << std::endl;
+    }
+
+    if (!ok)
+    {
+        std::cerr << "Failed to process " << path << ": " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+
+    std::cout << "AFTER MEMORY PAGING" << std::endl;
+    PrintMemoryUsage();
+
+    std::cout << "Processed " << bytes << " bytes in " << chunks << " chunks, " << seconds << " s ("
+              << (seconds > 0 ? bytes / seconds / 1e9 : 0.0) << " GB/s), " << detail << ", checksum "
+              << std::hex << checksum << std::dec << std::endl;
+    std::cout << "File processed successfully." << std::endl;
+    return 0;
+}
+
+#endif